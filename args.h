@@ -4,5 +4,5 @@
 #include "symtbl.h"
 #include "token.h"
 
-token_t *pop_arg(list_t *args, const symtbl_t *symtbl, const int reqtype);
+int type_fits(const unsigned int type, const int reqtype);
 int ret_res(symtbl_t *symtbl, const void *val, const unsigned int type);
\ No newline at end of file
@@ -4,8 +4,18 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "builtin.h"
+#include "inline.h"
+#include "lex.h"
+#include "memo.h"
+#include "opt.h"
+#include "par.h"
+#include "sema.h"
+#include "types.h"
 #include "util.h"
 
+int load_lno = 0;
+
 ast_t *init_ast(void) {
   ast_t *ast = alloc(sizeof(ast_t));
   assert(ast);
@@ -21,7 +31,41 @@ ast_t *init_ast(void) {
 
 int should_branch(const char *kwd) {
   return !strcmp(kwd, "def") || !strcmp(kwd, "if") || !strcmp(kwd, "for") ||
-         !strcmp(kwd, "else") || !strcmp(kwd, "end");
+         !strcmp(kwd, "pfor") || !strcmp(kwd, "else") || !strcmp(kwd, "end");
+}
+
+/* kwd of the innermost for or pfor the node being added is in, if any. */
+static const char *loop_of(const ast_t *ast) {
+  const char *loop = NULL;
+  for (node_t *n = ast->stack->head; n; n = n->next) {
+    const char *kwd = ((ast_node_t *)n->data)->kwd;
+    if (!strcmp(kwd, "for") || !strcmp(kwd, "pfor")) loop = kwd;
+  }
+
+  return loop;
+}
+
+/**
+ * Top-level decls make up the body of symtbl->init. Their syms are declared as
+ * globals as they're parsed, so that functions loaded before init has run
+ * (e.g, called by it) don't take them for locals.
+ */
+static int add_global(const ast_node_t *node, symtbl_t *symtbl) {
+  if (!symtbl->init) {
+    ast_node_t *def = alloc(sizeof(ast_node_t));
+    def->kwd = "def";
+    def->ch = NULL;
+    def->type = fdecl;
+    def->lno = node->lno;
+    def->tokens = init_list();
+    def->lch = init_list();
+    def->rch = init_list();
+    symtbl->init = init_fsig("globals", init_list(), def);
+  }
+
+  const decl_node_t *dnode = node->ch;
+  return declare_global(symtbl, dnode->lhs) &&
+         add(((ast_node_t *)symtbl->init->node)->lch, node);
 }
 
 int add_node(ast_t *ast, const ast_node_t *node, symtbl_t *symtbl) {
@@ -42,14 +86,32 @@ int add_node(ast_t *ast, const ast_node_t *node, symtbl_t *symtbl) {
     }
 
     assert(register_func(symtbl, fnode->func, fnode->args, node));
+    sig = get_fsig(symtbl, fnode->func);
+    sig->decl_pure = fnode->pure;
+    sig->decl_const = fnode->is_const;
     ast->in_func = 1;
   }
 
+  if (node->type == vdecl && ast->in_func == 0)
+    return add_global(node, symtbl);
+
   if (strcmp(kwd, "def") && ast->in_func == 0) {
     fprintf(stderr, "ast.c: dangling statement [%s]\n", kwd);
     return 0;
   }
 
+  const char *loop = loop_of(ast);
+  if ((node->type == fbreak || node->type == fcontinue) && !loop) {
+    fprintf(stderr, "ast.c: %s is invalid outside of a for\n", kwd);
+    return 0;
+  }
+
+  /* Every index of a pfor runs, none of them can end it early. */
+  if (node->type == fbreak && !strcmp(loop, "pfor")) {
+    fprintf(stderr, "ast.c: break is invalid in a pfor\n");
+    return 0;
+  }
+
   /**
    * Since we do not have anything on the stack, adding this node to AST should
    * be straight forward.
@@ -72,7 +134,8 @@ int add_node(ast_t *ast, const ast_node_t *node, symtbl_t *symtbl) {
    * also must be pushed to the stack so that it acts as a reference to the next
    * incoming node.
    */
-  if (!strcmp(kwd, "def") || !strcmp(kwd, "if") || !strcmp(kwd, "for")) {
+  if (!strcmp(kwd, "def") || !strcmp(kwd, "if") || !strcmp(kwd, "for") ||
+      !strcmp(kwd, "pfor")) {
     ast_node_t *top = peek_last(ast->stack);
     assert(add((ast->atl == 1 ? top->lch : top->rch), node));
 
@@ -110,7 +173,7 @@ int add_node(ast_t *ast, const ast_node_t *node, symtbl_t *symtbl) {
     /* TOS is no longer a reference to the next incoming node. */
     ast_node_t *top = pop_last(ast->stack);
     if (strcmp(top->kwd, "def") && strcmp(top->kwd, "if") &&
-        strcmp(top->kwd, "for")) {
+        strcmp(top->kwd, "for") && strcmp(top->kwd, "pfor")) {
       fprintf(stderr, "ast.c: end is invalid for [%s]\n", top->kwd);
       return 0;
     }
@@ -130,4 +193,252 @@ int add_node(ast_t *ast, const ast_node_t *node, symtbl_t *symtbl) {
   ast_node_t *top = peek_last(ast->stack);
   assert(add((ast->atl == 1 ? top->lch : top->rch), node));
   return 1;
-}
\ No newline at end of file
+}
+
+/**
+ * The front end only registers the signature of a function and records where
+ * its body lives in the source. The body is lexed, parsed and linked into the
+ * def node here, on the first call to the function.
+ */
+int compile_body(fsig_t *sig, symtbl_t *symtbl) {
+  if (!sig || !sig->lazy) return 1;
+  if (!sig->src || fseek(sig->src, sig->body_beg, SEEK_SET)) {
+    fprintf(stderr, "ast.c: could not read body of %s()\n", sig->func);
+    return 0;
+  }
+
+  /* Resume add_node() as if the def node had just been pushed. */
+  ast_t *ast = init_ast();
+  assert(add(ast->stack, sig->node));
+  ast->in_func = 1;
+
+  char buf[512];
+  int lno = sig->body_lno;
+
+  while (ftell(sig->src) < sig->body_end && fgets(buf, sizeof buf, sig->src)) {
+    /* Where the load stops if the line fails. */
+    load_lno = ++lno;
+    list_t *tokens = lex(buf);
+    if (!tokens) return 0;
+    if (tokens->size == 0) continue;
+
+    const char *kwd = ((token_t *)(tokens->head->data))->tk;
+    ast_node_t *node = init_node(tokens);
+    if (!node) {
+      fprintf(stderr, "ast.c: init_node() fail [%s] L[%d]\n", kwd, lno);
+      return 0;
+    }
+
+    node->lno = lno;
+    if (!add_node(ast, node, symtbl)) {
+      fprintf(stderr, "ast.c: add_node() fail [%s] L[%d]\n", kwd, lno);
+      return 0;
+    }
+  }
+
+  if (ast->stack->size != 1 || ast->auxstack->size != 0) {
+    fprintf(stderr, "ast.c: unterminated block in %s()\n", sig->func);
+    return 0;
+  }
+
+  sig->lazy = 0;
+  return 1;
+}
+static int link_call(func_node_t *fnode, const symtbl_t *symtbl,
+                     const int lno) {
+  if (fnode->sig || fnode->builtin) return 1;
+
+  fsig_t *sig = get_fsig(symtbl, fnode->func);
+  if (sig) {
+    if (sig->args->size != fnode->args->size) {
+      fprintf(stderr, "ast.c: %s() requires [%d] args, got [%d] L[%d]\n",
+              fnode->func, sig->args->size, fnode->args->size, lno);
+      return 0;
+    }
+
+    fnode->sig = sig;
+    return 1;
+  }
+
+  const builtin_t *builtin = get_builtin(fnode->func);
+  if (!builtin) {
+    fprintf(stderr, "ast.c: could not call %s() L[%d]\n", fnode->func, lno);
+    return 0;
+  }
+
+  if (builtin->n_args != -1 && builtin->n_args != fnode->args->size) {
+    fprintf(stderr, "ast.c: %s() takes %d args L[%d]\n", fnode->func,
+            builtin->n_args, lno);
+    return 0;
+  }
+
+  fnode->builtin = builtin;
+  return 1;
+}
+
+static int link_operand(void *buf, const unsigned int type,
+                        const symtbl_t *symtbl, const int lno) {
+  if (type == fretval) return link_call(buf, symtbl, lno);
+  if (type != indx) return 1;
+
+  const indx_node_t *ixnode = buf;
+  return (!ixnode->beg ||
+          link_operand(ixnode->beg, ixnode->ltype, symtbl, lno)) &&
+         (!ixnode->end ||
+          link_operand(ixnode->end, ixnode->rtype, symtbl, lno));
+}
+
+/**
+ * Tail calls to main are left alone, main is never called with args. Nor are
+ * those made by memoized functions, their result is recorded once they return.
+ */
+static void mark_tail(func_node_t *fnode, const fsig_t *caller) {
+  fnode->tail =
+      fnode->sig && strcmp(fnode->sig->func, "main") && !caller->memo;
+}
+
+/**
+ * nodes are in the body of sig. tail is set if nodes ends the function, i.e. a
+ * bare call at the end of it is a tail call. The last node of both branches of
+ * an if in tail position is in tail position too, the body of a for never is.
+ */
+static int link_block(const list_t *nodes, const symtbl_t *symtbl,
+                      const fsig_t *sig, const int tail) {
+  for (node_t *n = nodes->head; n; n = n->next) {
+    const ast_node_t *node = n->data;
+    const int lno = node->lno, last = tail && !n->next;
+    int ok = 1;
+
+    switch (node->type) {
+      case cond:
+      case floop: {
+        const cnode_t *cnode = node->ch;
+        const int btail = last && node->type == cond;
+        ok = link_operand(cnode->lhs, cnode->ltype, symtbl, lno) &&
+             link_operand(cnode->rhs, cnode->rtype, symtbl, lno) &&
+             link_block(node->lch, symtbl, sig, btail) &&
+             link_block(node->rch, symtbl, sig, btail);
+        break;
+      }
+
+      case vdecl: {
+        const decl_node_t *dnode = node->ch;
+        ok = link_operand(dnode->rhs, dnode->rtype, symtbl, lno);
+        break;
+      }
+
+      case cout: {
+        const print_node_t *pnode = node->ch;
+        ok = link_operand(pnode->arg, pnode->type, symtbl, lno);
+        break;
+      }
+
+      case rettype: {
+        const return_node_t *rnode = node->ch;
+        ok = !rnode->val || link_operand(rnode->val, rnode->type, symtbl, lno);
+        if (ok && rnode->val && rnode->type == fretval)
+          mark_tail(rnode->val, sig);
+        break;
+      }
+
+      /* The body of a pfor makes no calls, see par.c. */
+      case pfloop: {
+        const pfor_node_t *pnode = node->ch;
+        ok = link_operand(pnode->beg, pnode->btype, symtbl, lno) &&
+             link_operand(pnode->end, pnode->etype, symtbl, lno);
+        break;
+      }
+
+      case fcall:
+        ok = link_call(node->ch, symtbl, lno);
+        if (ok && last) mark_tail(node->ch, sig);
+        break;
+
+      case fdefer:
+        ok = link_call(node->ch, symtbl, lno);
+        break;
+    }
+
+    if (!ok) {
+      load_lno = lno;
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * A var or const in a function can't have the sym of a global var, it would
+ * assign the global rather than declare a local - only args shadow globals.
+ * Globals are assigned without var.
+ */
+static int check_decls(const list_t *nodes, const symtbl_t *symtbl,
+                       const fsig_t *sig) {
+  for (node_t *n = nodes->head; n; n = n->next) {
+    const ast_node_t *node = n->data;
+    const char *sym =
+        node->type == vdecl ? ((decl_node_t *)node->ch)->lhs : NULL;
+
+    if (sym && (!strcmp(node->kwd, "var") || !strcmp(node->kwd, "const")) &&
+        get_global(symtbl, sym) && !is_arg(sig, sym)) {
+      fprintf(stderr,
+              "ast.c: %s [%s] in %s() is a global, assign it without %s or "
+              "rename it L[%d]\n",
+              node->kwd, sym, sig->func, node->kwd, node->lno);
+      load_lno = node->lno;
+      return 0;
+    }
+
+    if (!check_decls(node->lch, symtbl, sig) ||
+        !check_decls(node->rch, symtbl, sig))
+      return 0;
+  }
+
+  return 1;
+}
+
+int prepare_body(fsig_t *sig, symtbl_t *symtbl) {
+  /* A body that failed fails every later call at the same line, silently. */
+  if (sig->prepared) {
+    if (sig->prepared < 0) load_lno = sig->fail_lno;
+    return sig->prepared > 0;
+  }
+
+  sig->prepared = -1;
+  sig->fail_lno = load_lno = ((ast_node_t *)sig->node)->lno;
+  if (sig->lazy && !compile_body(sig, symtbl)) goto fail;
+
+  const list_t *body = ((ast_node_t *)sig->node)->lch;
+  if (sig != symtbl->init && !check_decls(body, symtbl, sig)) goto fail;
+
+  check_body(sig, symtbl);
+  if (!check_par(sig, symtbl)) goto fail;
+
+  inline_calls(sig, symtbl);
+  if (!optimize(sig, symtbl)) goto fail;
+
+  sig->prepared = 1;
+  return 1;
+
+fail:
+  sig->fail_lno = load_lno;
+  return 0;
+}
+
+/**
+ * Loads sig on its first call - prepares the body, decides whether its calls
+ * are memoized and links every call in it to its target (a user defined
+ * function or a builtin), so that calls don't have to look their target up or
+ * check their arity again.
+ */
+int load_body(fsig_t *sig, symtbl_t *symtbl) {
+  if (sig->linked) return 1;
+  if (!prepare_body(sig, symtbl)) return 0;
+  if (!memo_func(sig, symtbl)) return 0;
+  if (!infer_types(sig, symtbl)) return 0;
+  if (!link_block(((ast_node_t *)sig->node)->lch, symtbl, sig, 1)) return 0;
+
+  sig->linked = 1;
+  return 1;
+}
@@ -10,4 +10,18 @@ typedef struct ast {
 } ast_t;
 
 ast_t *init_ast(void);
-int add_node(ast_t *ast, const ast_node_t *node, symtbl_t *symtbl);
\ No newline at end of file
+int add_node(ast_t *ast, const ast_node_t *node, symtbl_t *symtbl);
+int compile_body(fsig_t *sig, symtbl_t *symtbl);
+/**
+ * Compiles the body of sig if it was skipped, checks its pfors, inlines calls
+ * into it and optimizes it (see par.c, inline.c and opt.c). Only done once,
+ * fails while it's being done, i.e, when inline_calls() gets back to a
+ * function it's inlining into.
+ * If any of it fails, every later call fails at the same line without
+ * reporting it again.
+ */
+int prepare_body(fsig_t *sig, symtbl_t *symtbl);
+int load_body(fsig_t *sig, symtbl_t *symtbl);
+
+/* Line of the statement the last load_body() that failed stopped at. */
+extern int load_lno;
\ No newline at end of file
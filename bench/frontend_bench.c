@@ -0,0 +1,230 @@
+/**
+ * frontend_bench.c
+ * Throughput benchmark for the front end (lex, parse, AST construction).
+ *
+ * Generates a synthetic program of the requested shape and size in memory and
+ * times lex(), init_node() and add_node() separately over every line of it.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ast.h"
+#include "lex.h"
+#include "node.h"
+#include "symtbl.h"
+#include "util.h"
+
+typedef struct prog {
+  char **lines;
+  unsigned long n_lines, cap, bytes;
+} prog_t;
+
+static void emit(prog_t *prog, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void emit(prog_t *prog, const char *fmt, ...) {
+  if (prog->n_lines == prog->cap) {
+    prog->cap = prog->cap ? prog->cap * 2 : 1024;
+    prog->lines = realloc(prog->lines, prog->cap * sizeof(char *));
+  }
+
+  char buf[512];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(buf, sizeof buf, fmt, ap);
+  va_end(ap);
+
+  prog->bytes += strlen(buf);
+  prog->lines[prog->n_lines++] = strdup(buf);
+}
+
+/* Many small functions with a bit of everything in them. */
+static void gen_funcs(prog_t *prog, const unsigned long n_lines) {
+  for (unsigned long f = 0; prog->n_lines < n_lines; f++) {
+    emit(prog, "def f%lu(a, b)\n", f);
+    emit(prog, "    var x = a + 2 * (b - 1)\n");
+    emit(prog, "    if x > %lu\n", f % 100);
+    emit(prog, "        print 'f%lu: x is large'\n", f);
+    emit(prog, "    else\n");
+    emit(prog, "        x++\n");
+    emit(prog, "    end\n");
+    emit(prog, "    for x < 100\n");
+    emit(prog, "        x++\n");
+    emit(prog, "    end\n");
+    emit(prog, "    return x\n");
+    emit(prog, "end\n");
+  }
+}
+
+/* Deeply nested if/for blocks. */
+static void gen_nested(prog_t *prog, const unsigned long n_lines,
+                       const unsigned int depth) {
+  for (unsigned long f = 0; prog->n_lines < n_lines; f++) {
+    emit(prog, "def n%lu(i)\n", f);
+    for (unsigned int d = 0; d < depth; d++)
+      emit(prog, "%*s%s i < %u\n", 4 * (d + 1), "", d % 2 ? "for" : "if", d);
+
+    emit(prog, "%*sprint i\n", 4 * (depth + 1), "");
+    for (unsigned int d = depth; d > 0; d--) emit(prog, "%*send\n", 4 * d, "");
+    emit(prog, "end\n");
+  }
+}
+
+/* Long arithmetic expressions. */
+static void gen_expr(prog_t *prog, const unsigned long n_lines,
+                     const unsigned int width) {
+  static const char *ops[] = {"+", "-", "*", "/"};
+
+  for (unsigned long f = 0; prog->n_lines < n_lines; f++) {
+    emit(prog, "def e%lu(a, b, c)\n", f);
+    for (unsigned int l = 0; l < 8; l++) {
+      char buf[448];
+      int len = snprintf(buf, sizeof buf, "    var v%u = a", l);
+
+      for (unsigned int t = 0; t < width && len < 400; t++)
+        len += snprintf(&buf[len], sizeof buf - len, " %s (%c %s %u)",
+                        ops[t % 4], "abc"[t % 3], ops[(t + 1) % 4], t + 1);
+
+      emit(prog, "%s\n", buf);
+    }
+
+    emit(prog, "end\n");
+  }
+}
+
+/* Many string literals. */
+static void gen_strings(prog_t *prog, const unsigned long n_lines) {
+  for (unsigned long f = 0; prog->n_lines < n_lines; f++) {
+    emit(prog, "def s%lu()\n", f);
+    for (unsigned int l = 0; l < 8; l++) {
+      emit(prog, "    var s%u = 'literal %lu.%u with some padding text'\n", l, f,
+           l);
+      emit(prog, "    print \"another literal, %lu.%u\"\n", f, l);
+    }
+
+    emit(prog, "end\n");
+  }
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [-s funcs|nested|expr|strings] [-n lines] [-d depth] "
+          "[-w width]\n",
+          argv0);
+}
+
+int main(int argc, char **argv) {
+  const char *shape = "funcs";
+  unsigned long n_lines = 20000;
+  unsigned int depth = 16, width = 24;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:n:d:w:")) != -1) {
+    switch (opt) {
+      case 's':
+        shape = optarg;
+        break;
+      case 'n':
+        n_lines = strtoul(optarg, NULL, 10);
+        break;
+      case 'd':
+        depth = strtoul(optarg, NULL, 10);
+        break;
+      case 'w':
+        width = strtoul(optarg, NULL, 10);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  prog_t prog = {NULL, 0, 0, 0};
+  if (!strcmp(shape, "funcs"))
+    gen_funcs(&prog, n_lines);
+  else if (!strcmp(shape, "nested"))
+    gen_nested(&prog, n_lines, depth);
+  else if (!strcmp(shape, "expr"))
+    gen_expr(&prog, n_lines, width);
+  else if (!strcmp(shape, "strings"))
+    gen_strings(&prog, n_lines);
+  else {
+    usage(argv[0]);
+    return 1;
+  }
+
+  list_t **tokens = malloc(prog.n_lines * sizeof(list_t *));
+  ast_node_t **nodes = malloc(prog.n_lines * sizeof(ast_node_t *));
+  unsigned long n_tokens = 0;
+
+  /* lex() */
+  unsigned int allocs = alloc_count();
+  double beg = now();
+  for (unsigned long i = 0; i < prog.n_lines; i++) {
+    tokens[i] = lex(prog.lines[i]);
+    if (!tokens[i]) return 1;
+    n_tokens += tokens[i]->size;
+  }
+
+  const double t_lex = now() - beg;
+  const unsigned int lex_allocs = alloc_count() - allocs;
+
+  /* init_node() -> parse() */
+  allocs = alloc_count();
+  beg = now();
+  for (unsigned long i = 0; i < prog.n_lines; i++) {
+    nodes[i] = init_node(tokens[i]);
+    if (!nodes[i]) return 1;
+  }
+
+  const double t_parse = now() - beg;
+  const unsigned int parse_allocs = alloc_count() - allocs;
+
+  /* add_node() */
+  ast_t *ast = init_ast();
+  symtbl_t *symtbl = init_symtbl();
+
+  allocs = alloc_count();
+  beg = now();
+  for (unsigned long i = 0; i < prog.n_lines; i++) {
+    if (!add_node(ast, nodes[i], symtbl)) return 1;
+  }
+
+  const double t_ast = now() - beg;
+  const unsigned int ast_allocs = alloc_count() - allocs;
+
+  const double mb = prog.bytes / (1024.0 * 1024.0);
+  const unsigned long n_nodes = prog.n_lines;
+
+  printf("shape %s: %lu lines, %lu bytes, %lu tokens\n", shape, prog.n_lines,
+         prog.bytes, n_tokens);
+  printf("%-10s %10s %10s %14s %14s %14s\n", "phase", "ms", "MB/s", "tokens/s",
+         "nodes/s", "allocs/token");
+  printf("%-10s %10.2f %10.2f %14.0f %14s %14.2f\n", "lex", t_lex * 1e3,
+         mb / t_lex, n_tokens / t_lex, "-", (double)lex_allocs / n_tokens);
+  printf("%-10s %10.2f %10.2f %14.0f %14.0f %14.2f\n", "parse", t_parse * 1e3,
+         mb / t_parse, n_tokens / t_parse, n_nodes / t_parse,
+         (double)parse_allocs / n_tokens);
+  printf("%-10s %10.2f %10.2f %14.0f %14.0f %14.2f\n", "add_node",
+         t_ast * 1e3, mb / t_ast, n_tokens / t_ast, n_nodes / t_ast,
+         (double)ast_allocs / n_tokens);
+
+  for (unsigned long i = 0; i < prog.n_lines; i++) free(prog.lines[i]);
+  free(prog.lines);
+  free(tokens);
+  free(nodes);
+
+  cleanup();
+  return 0;
+}
@@ -4,16 +4,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "num.h"
 #include "util.h"
 
-struct method {
-  char *func;
-  int n_args;
-  int argtypes[2];
-  int (*fptr)(const token_t **fargs, symtbl_t *symtbl,
-              const unsigned int arglen);
-};
-
 /* str related */
 int __cmp(const token_t **args, symtbl_t *symtbl, const unsigned int arglen);
 int __len(const token_t **args, symtbl_t *symtbl, const unsigned int arglen);
@@ -26,71 +19,66 @@ int __exit(const token_t **args, symtbl_t *symtbl, const unsigned int arglen);
 int __gcms(const token_t **args, symtbl_t *symtbl, const unsigned int arglen);
 int __type(const token_t **args, symtbl_t *symtbl, const unsigned int arglen);
 
-static struct method builtins[] = {{"cmp", +2, {string, string}, __cmp},
-                                   {"len", +1, {string}, __len},
-                                   {"idx", +2, {string, string}, __idx},
-                                   {"put", -1, {}, __put},
-                                   {"rev", +1, {string}, __rev},
-                                   {"exit", +1, {numeric}, __exit},
-                                   {"gc", +1, {-1}, __gcms},
-                                   {"type", +1, {-1}, __type}};
-
-/**
- * Checks if the supplied args match the req args (count vs type of args) and
- * invokes the specified function.
- */
-int eval_builtin(const func_node_t *fnode, symtbl_t *symtbl) {
-  char *func = fnode->func;
-  list_t *args = fnode->args;
-
-  const long unsigned int size = sizeof(builtins) / sizeof(struct method);
-
-  for (int i = 0; i < size; i++) {
-    if (!strcmp(builtins[i].func, func)) {
-      struct method builtin = builtins[i];
+static const builtin_t builtins[] = {{"cmp", +2, {string, string}, __cmp},
+                                     {"len", +1, {string}, __len},
+                                     {"idx", +2, {string, string}, __idx},
+                                     {"put", -1, {}, __put},
+                                     {"rev", +1, {string}, __rev},
+                                     {"exit", +1, {integer}, __exit},
+                                     {"gc", +1, {-1}, __gcms},
+                                     {"type", +1, {-1}, __type}};
 
-      /* if n_args is set to -1, it means that this function takes vargs. */
-      unsigned int n_args = builtin.n_args != -1 ? builtin.n_args : args->size;
-      const token_t *fargs[n_args];
+const builtin_t *get_builtin(const char *func) {
+  const long unsigned int size = sizeof(builtins) / sizeof(builtin_t);
 
-      /* varg function */
-      if (builtin.n_args == -1) {
-        for (unsigned int j = 0; j < n_args; j++) {
-          fargs[j] = pop_arg(args, symtbl, -1);
-        }
+  for (int i = 0; i < size; i++)
+    if (!strcmp(builtins[i].func, func)) return &builtins[i];
 
-        return builtins[i].fptr(fargs, symtbl, n_args);
-      }
+  return NULL;
+}
 
-      if (builtin.n_args != args->size) {
-        fprintf(stderr, "builtin.c: %s() takes %d args\n", func,
-                builtin.n_args);
-        return 0;
-      }
+/**
+ * Checks if the supplied args match the req args (count vs type of args) and
+ * invokes the builtin. args have already been resolved to values.
+ */
+int call_builtin(const builtin_t *builtin, const token_t **args,
+                 const unsigned int arglen, symtbl_t *symtbl) {
+  /* if n_args is set to -1, it means that this function takes vargs. */
+  if (builtin->n_args == -1) return builtin->fptr(args, symtbl, arglen);
+
+  if (builtin->n_args != arglen) {
+    fprintf(stderr, "builtin.c: %s() takes %d args\n", builtin->func,
+            builtin->n_args);
+    return 0;
+  }
 
-      for (unsigned int j = 0; j < n_args; j++)
-        fargs[j] = pop_arg(args, symtbl, builtin.argtypes[j]);
-      return builtins[i].fptr(fargs, symtbl, n_args);
+  for (unsigned int j = 0; j < arglen; j++) {
+    if (builtin->argtypes[j] != -1 &&
+        !type_fits(args[j]->type, builtin->argtypes[j])) {
+      fprintf(stderr, "args.c: invalid arg [%d instead of %d]\n",
+              args[j]->type, builtin->argtypes[j]);
+      cleanup();
+      _Exit(1);
     }
   }
 
-  return 0;
+  return builtin->fptr(args, symtbl, arglen);
 }
 
 int __cmp(const token_t **args, symtbl_t *symtbl, const unsigned int arglen) {
-  double c = strcmp((char *)args[0]->tk, (char *)args[1]->tk);
-  return ret_res(symtbl, &c, numeric);
+  long long c = strcmp((char *)args[0]->tk, (char *)args[1]->tk);
+  return ret_res(symtbl, &c, integer);
 }
 
 int __len(const token_t **args, symtbl_t *symtbl, const unsigned int arglen) {
-  double len = strlen((char *)args[0]->tk);
-  return ret_res(symtbl, &len, numeric);
+  long long len = strlen((char *)args[0]->tk);
+  return ret_res(symtbl, &len, integer);
 }
 
 int __idx(const token_t **args, symtbl_t *symtbl, const unsigned int arglen) {
   char *ptr = strstr((char *)args[0]->tk, (char *)args[1]->tk);
-  double idx = !ptr ? -1 : (char *)ptr - (char *)args[0]->tk;
-  return ret_res(symtbl, &idx, numeric);
+  long long idx = !ptr ? -1 : (char *)ptr - (char *)args[0]->tk;
+  return ret_res(symtbl, &idx, integer);
 }
 
 int __put(const token_t **args, symtbl_t *symtbl, const unsigned int arglen) {
@@ -106,9 +94,18 @@ int __put(const token_t **args, symtbl_t *symtbl, const unsigned int arglen) {
       case string:
         printf("%s ", (char *)arg->tk);
         break;
-      case numeric:
-        printf("%g ", *(double *)arg->tk);
+      case integer: {
+        char buf[32];
+        fmt_int(*(long long *)arg->tk, buf, sizeof buf);
+        printf("%s ", buf);
         break;
+      }
+      case numeric: {
+        char buf[32];
+        fmt_num(*(double *)arg->tk, buf, sizeof buf);
+        printf("%s ", buf);
+        break;
+      }
 
         /**
          * Guaranteed to not hit this, __parse_arglist() is good enough to
@@ -124,22 +121,20 @@ int __put(const token_t **args, symtbl_t *symtbl, const unsigned int arglen) {
   return 1;
 }
 
+/* Returns a reversed copy, the arg itself may be a literal in the AST. */
 int __rev(const token_t **args, symtbl_t *symtbl, const unsigned int arglen) {
-  char *s = (char *)args[0]->tk;
+  const char *s = (char *)args[0]->tk;
   const unsigned int len = strlen(s);
-  const unsigned int mid = len / 2;
+  char *r = alloc(len + 1);
 
-  for (unsigned int i = 0; i < mid; i++) {
-    char c = s[i];
-    s[i] = s[len - i - 1];
-    s[len - i - 1] = c;
-  }
+  for (unsigned int i = 0; i < len; i++) r[i] = s[len - i - 1];
+  r[len] = '\0';
 
-  return ret_res(symtbl, s, string);
+  return ret_res(symtbl, r, string);
 }
 
 int __exit(const token_t **args, symtbl_t *symtbl, const unsigned int arglen) {
-  double exitcode = *(double *)args[0]->tk;
+  long long exitcode = *(long long *)args[0]->tk;
   cleanup();
   _Exit(exitcode);
 }
@@ -152,6 +147,6 @@ int __gcms(const token_t **args, symtbl_t *symtbl, const unsigned int arglen) {
 
 int __type(const token_t **args, symtbl_t *symtbl, const unsigned int arglen) {
   const token_t *arg = args[0];
-  double d = arg->type;
-  return ret_res(symtbl, &d, numeric);
+  long long t = arg->type;
+  return ret_res(symtbl, &t, integer);
 }
\ No newline at end of file
@@ -4,4 +4,15 @@
 #include "list.h"
 #include "symtbl.h"
 
-int eval_builtin(const func_node_t *fnode, symtbl_t *symtbl);
\ No newline at end of file
+typedef struct builtin {
+  char *func;
+  /* -1 if the builtin takes vargs. */
+  int n_args;
+  int argtypes[2];
+  int (*fptr)(const token_t **fargs, symtbl_t *symtbl,
+              const unsigned int arglen);
+} builtin_t;
+
+int call_builtin(const builtin_t *builtin, const token_t **args,
+                 const unsigned int arglen, symtbl_t *symtbl);
+const builtin_t *get_builtin(const char *func);
\ No newline at end of file
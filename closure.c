@@ -0,0 +1,963 @@
+/**
+ * closure.c
+ * Closure compiled engine, a lighter alternative to the VM.
+ *
+ * Every node of a function body is compiled once into a handler (a function
+ * pointer) bound to its pre-decoded operands - slots instead of syms, decoded
+ * constants instead of tokens and the operator picked at compile time instead
+ * of strcmp()'d on every run. Common shapes get their own handlers, e.g, "add
+ * two slots" or "compare a slot with a constant". Locals live in a value_t
+ * array on the C stack, calls recurse in C like they do on the tree-walker.
+ */
+
+#include "closure.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "ast.h"
+#include "builtin.h"
+#include "compile.h"
+#include "expr.h"
+#include "jit.h"
+#include "memo.h"
+#include "util.h"
+#include "value.h"
+#include "vm.h"
+
+/**
+ * Returned by statement handlers. cl_break & cl_continue are taken by the
+ * innermost for.
+ */
+enum { cl_fail, cl_next, cl_ret, cl_tail, cl_break, cl_continue };
+
+typedef struct cl_frame {
+  eval_t *eval;
+  value_t *slots;
+  value_t ret;
+  int has_ret;
+  unsigned int defer_base;
+  /* Set with cl_tail, the callee runs in place of this frame. */
+  const struct cl_func *tail;
+  int tail_bare;
+} cl_frame_t;
+
+typedef struct cl_expr cl_expr_t;
+typedef struct cl_cond cl_cond_t;
+typedef struct cl_stmt cl_stmt_t;
+
+/* Evaluates e into out, returns 0 on error. */
+typedef int (*expr_fn)(const cl_expr_t *e, cl_frame_t *f, value_t *out);
+
+/* Returns 1 if the condition holds, 0 if it doesn't and -1 on error. */
+typedef int (*cond_fn)(const cl_cond_t *c, cl_frame_t *f);
+
+typedef int (*stmt_fn)(const cl_stmt_t *s, cl_frame_t *f);
+
+struct cl_expr {
+  expr_fn fn;
+  const char *op;
+  int slot, rslot;
+  value_t k;
+  cl_expr_t *lhs, *rhs;
+  /* Args of a call, or the string, lb & ub of a slice. */
+  cl_expr_t **args;
+  const callsite_t *cs;
+  unsigned char flags;
+};
+
+struct cl_cond {
+  cond_fn fn;
+  int slot, rslot;
+  value_t k;
+  cl_expr_t *lhs, *rhs;
+};
+
+typedef struct cl_block {
+  cl_stmt_t **stmts;
+  unsigned int n, cap;
+} cl_block_t;
+
+struct cl_stmt {
+  stmt_fn fn;
+  int lno, slot;
+  value_t k;
+  cl_expr_t *expr;
+  cl_cond_t *cond;
+  cl_block_t body, alt;
+  const callsite_t *cs;
+  cl_expr_t **args;
+};
+
+typedef struct cl_func {
+  cl_block_t body;
+  unsigned int n_args, n_slots;
+  /* Memo table of the function if it's memoized, see memo.c. */
+  memo_t *memo;
+} cl_func_t;
+
+/**
+ * Deferred calls of all the active frames, each frame owns the ones above its
+ * defer_base.
+ */
+static const cl_stmt_t **defers = NULL;
+static unsigned int n_defers = 0, defers_cap = 0;
+
+/**
+ * Number of run_func() calls on the C stack, see eval_t.max_depth. Calls
+ * recurse in C, so they also fail once the C stack is close to its limit in
+ * case max_depth was raised past what it can hold.
+ */
+static unsigned int depth = 0;
+static const char *stack_base = NULL;
+static unsigned long stack_room = (unsigned long)-1;
+
+static int stack_exceeded(const eval_t *eval) {
+  const char here = 0;
+  if (!stack_base) {
+    struct rlimit rl;
+    stack_base = &here;
+    if (!getrlimit(RLIMIT_STACK, &rl) && rl.rlim_cur != RLIM_INFINITY)
+      stack_room = rl.rlim_cur - rl.rlim_cur / 8;
+  }
+
+  const unsigned long used =
+      stack_base > &here ? stack_base - &here : &here - stack_base;
+  return depth >= eval->max_depth || used > stack_room;
+}
+
+/* Args of a tail call, until run_func() copies them into the new slots. */
+static value_t *tail_args = NULL;
+static unsigned int tail_cap = 0;
+
+static double num(const value_t *val) {
+  return val->type == integer ? (double)val->as.i : val->as.d;
+}
+
+static int nonnum(void) {
+  fprintf(stderr, "closure.c: non-numeric in exprtree\n");
+  return 0;
+}
+
+/* Slow path of the arithmetic handlers, same rules as eval_expr(). */
+static int arith(const char *op, const value_t *l, const value_t *r,
+                 value_t *out) {
+  value_t res;
+
+  if (l->type == integer && r->type == integer) {
+    res.type = integer;
+    res.as.i = eval_int(l->as.i, r->as.i, op);
+  } else if (is_num(l->type) && is_num(r->type)) {
+    res.type = numeric;
+    res.as.d = eval_double(num(l), num(r), op);
+  } else {
+    return nonnum();
+  }
+
+  *out = res;
+  return 1;
+}
+
+static int compare_values(const char *op, value_t *l, value_t *r) {
+  token_t a = value_token(l), b = value_token(r);
+  const int res = compare(&a, &b, op);
+  if (res < 0) fprintf(stderr, "closure.c: could not eval condition\n");
+
+  return res;
+}
+
+/**
+ * Expression handlers.
+ */
+
+static int e_const(const cl_expr_t *e, cl_frame_t *f, value_t *out) {
+  (void)f;
+  *out = e->k;
+  return 1;
+}
+
+static int e_load(const cl_expr_t *e, cl_frame_t *f, value_t *out) {
+  *out = f->slots[e->slot];
+  return 1;
+}
+
+/**
+ * Generates the handlers of a binary operator - <name>_ss (slot op slot),
+ * <name>_sk (slot op constant) and <name>_ee (any two expressions). intexpr is
+ * the fast path for two integers a and b.
+ */
+#define BINARY(name, opstr, intexpr)                                          \
+  static int name(const value_t *l, const value_t *r, value_t *out) {        \
+    if (l->type == integer && r->type == integer) {                          \
+      const unsigned long long a = l->as.i, b = r->as.i;                     \
+      (void)a;                                                               \
+      (void)b;                                                               \
+      out->as.i = (intexpr);                                                 \
+      out->type = integer;                                                   \
+      return 1;                                                              \
+    }                                                                        \
+    return arith(opstr, l, r, out);                                          \
+  }                                                                          \
+  static int name##_ss(const cl_expr_t *e, cl_frame_t *f, value_t *out) {    \
+    return name(&f->slots[e->slot], &f->slots[e->rslot], out);               \
+  }                                                                          \
+  static int name##_sk(const cl_expr_t *e, cl_frame_t *f, value_t *out) {    \
+    return name(&f->slots[e->slot], &e->k, out);                             \
+  }                                                                          \
+  static int name##_ee(const cl_expr_t *e, cl_frame_t *f, value_t *out) {    \
+    value_t l, r;                                                            \
+    if (!e->lhs->fn(e->lhs, f, &l) || !e->rhs->fn(e->rhs, f, &r)) return 0; \
+    return name(&l, &r, out);                                                \
+  }
+
+BINARY(e_add, "+", a + b)
+BINARY(e_sub, "-", a - b)
+BINARY(e_mul, "*", a * b)
+BINARY(e_div, "/", eval_int(l->as.i, r->as.i, "/"))
+BINARY(e_mod, "%", eval_int(l->as.i, r->as.i, "%"))
+BINARY(e_shl, "<<", eval_int(l->as.i, r->as.i, "<<"))
+BINARY(e_shr, ">>", eval_int(l->as.i, r->as.i, ">>"))
+BINARY(e_band, "&", a & b)
+BINARY(e_bor, "|", a | b)
+BINARY(e_bxor, "^", a ^ b)
+
+/* u+, u- and ~ */
+static int e_unary(const cl_expr_t *e, cl_frame_t *f, value_t *out) {
+  value_t v;
+  if (!e->rhs->fn(e->rhs, f, &v)) return 0;
+
+  if (v.type == integer)
+    v.as.i = eval_int(0, v.as.i, e->op);
+  else if (v.type == numeric)
+    v.as.d = eval_double(0, v.as.d, e->op);
+  else
+    return nonnum();
+
+  *out = v;
+  return 1;
+}
+
+static int call(cl_frame_t *f, const callsite_t *cs, cl_expr_t **args,
+                const unsigned char want, value_t *out);
+
+static int e_call(const cl_expr_t *e, cl_frame_t *f, value_t *out) {
+  return call(f, e->cs, e->args, 1, out);
+}
+
+static int e_slice(const cl_expr_t *e, cl_frame_t *f, value_t *out) {
+  value_t arg, lb, ub;
+  cl_expr_t *const *x = e->args;
+
+  if (!x[0]->fn(x[0], f, &arg)) return 0;
+  if (x[1] && !x[1]->fn(x[1], f, &lb)) return 0;
+  if (x[2] && !x[2]->fn(x[2], f, &ub)) return 0;
+
+  token_t a = value_token(&arg), l, u;
+  if (x[1]) l = value_token(&lb);
+  if (x[2]) u = value_token(&ub);
+
+  char *s = slice(&a, x[1] ? &l : NULL, x[2] ? &u : NULL, e->flags);
+  if (!s) return 0;
+
+  out->type = string;
+  out->as.p = s;
+  return 1;
+}
+
+/* A slice of a literal that opt.c proved to be in range, k holds its length. */
+static int e_slice_in_range(const cl_expr_t *e, cl_frame_t *f, value_t *out) {
+  value_t arg, lb, ub;
+  cl_expr_t *const *x = e->args;
+
+  if (!x[0]->fn(x[0], f, &arg)) return 0;
+  if (x[1] && !x[1]->fn(x[1], f, &lb)) return 0;
+  if (x[2] && !x[2]->fn(x[2], f, &ub)) return 0;
+
+  out->type = string;
+  out->as.p = slice_in_range(arg.as.p, e->k.as.i, x[1] ? &lb : NULL,
+                             x[2] ? &ub : NULL, e->flags);
+  return 1;
+}
+
+/**
+ * Condition handlers, generated like the binary operators.
+ */
+
+#define COMPARE(name, opstr, cop)                                             \
+  static int name(value_t *l, value_t *r) {                                  \
+    if (l->type == integer && r->type == integer) return l->as.i cop r->as.i; \
+    if (is_num(l->type) && is_num(r->type)) return num(l) cop num(r);        \
+    return compare_values(opstr, l, r);                                      \
+  }                                                                          \
+  static int name##_ss(const cl_cond_t *c, cl_frame_t *f) {                  \
+    return name(&f->slots[c->slot], &f->slots[c->rslot]);                    \
+  }                                                                          \
+  static int name##_sk(const cl_cond_t *c, cl_frame_t *f) {                  \
+    value_t k = c->k;                                                        \
+    return name(&f->slots[c->slot], &k);                                     \
+  }                                                                          \
+  static int name##_ee(const cl_cond_t *c, cl_frame_t *f) {                  \
+    value_t l, r;                                                            \
+    if (!c->lhs->fn(c->lhs, f, &l) || !c->rhs->fn(c->rhs, f, &r)) return -1; \
+    return name(&l, &r);                                                     \
+  }
+
+COMPARE(c_lt, "<", <)
+COMPARE(c_le, "<=", <=)
+COMPARE(c_eq, "==", ==)
+COMPARE(c_ne, "!=", !=)
+COMPARE(c_gt, ">", >)
+COMPARE(c_ge, ">=", >=)
+
+/**
+ * Statement handlers.
+ */
+
+static int run_block(const cl_block_t *block, cl_frame_t *f) {
+  for (unsigned int i = 0; i < block->n; i++) {
+    const cl_stmt_t *s = block->stmts[i];
+    lno = s->lno;
+
+    const int res = s->fn(s, f);
+    if (res != cl_next) return res;
+  }
+
+  return cl_next;
+}
+
+static int s_store(const cl_stmt_t *s, cl_frame_t *f) {
+  return s->expr->fn(s->expr, f, &f->slots[s->slot]) ? cl_next : cl_fail;
+}
+
+static int s_store_k(const cl_stmt_t *s, cl_frame_t *f) {
+  f->slots[s->slot] = s->k;
+  return cl_next;
+}
+
+static int s_if(const cl_stmt_t *s, cl_frame_t *f) {
+  const int res = s->cond->fn(s->cond, f);
+  if (res < 0) return cl_fail;
+
+  return run_block(res ? &s->body : &s->alt, f);
+}
+
+static int s_for(const cl_stmt_t *s, cl_frame_t *f) {
+  for (;;) {
+    const int res = s->cond->fn(s->cond, f);
+    if (res <= 0) return res < 0 ? cl_fail : cl_next;
+
+    const int bres = run_block(&s->body, f);
+    if (bres == cl_break) return cl_next;
+    if (bres != cl_next && bres != cl_continue) return bres;
+  }
+}
+
+static int s_break(const cl_stmt_t *s, cl_frame_t *f) {
+  (void)s;
+  (void)f;
+  return cl_break;
+}
+
+static int s_continue(const cl_stmt_t *s, cl_frame_t *f) {
+  (void)s;
+  (void)f;
+  return cl_continue;
+}
+
+static int s_inc(const cl_stmt_t *s, cl_frame_t *f) {
+  value_t *v = &f->slots[s->slot];
+
+  if (v->type == integer) {
+    v->as.i = (unsigned long long)v->as.i + s->k.as.i;
+  } else if (v->type == numeric) {
+    v->as.d += s->k.as.i;
+  } else {
+    fprintf(stderr, "closure.c: unary cannot be used on non-numeric types\n");
+    return cl_fail;
+  }
+
+  return cl_next;
+}
+
+static int s_print(const cl_stmt_t *s, cl_frame_t *f) {
+  value_t v;
+  if (!s->expr->fn(s->expr, f, &v)) return cl_fail;
+
+  token_t tk = value_token(&v);
+  print_token(&tk);
+  return cl_next;
+}
+
+static int s_read(const cl_stmt_t *s, cl_frame_t *f) {
+  char *buf = alloc(512);
+  memset(buf, 0, 512);
+  if (scanf("%511s", buf) < 0) buf[0] = '\0';
+
+  f->slots[s->slot].type = string;
+  f->slots[s->slot].as.p = buf;
+  return cl_next;
+}
+
+static int s_call(const cl_stmt_t *s, cl_frame_t *f) {
+  return call(f, s->cs, s->args, 0, NULL) ? cl_next : cl_fail;
+}
+
+static int s_defer(const cl_stmt_t *s, cl_frame_t *f) {
+  (void)f;
+  defers = grow(defers, &defers_cap, n_defers, sizeof(cl_stmt_t *));
+  defers[n_defers++] = s;
+  return cl_next;
+}
+
+static int s_ret(const cl_stmt_t *s, cl_frame_t *f) {
+  if (s->expr) {
+    if (!s->expr->fn(s->expr, f, &f->ret)) return cl_fail;
+    f->has_ret = 1;
+  }
+
+  return cl_ret;
+}
+
+static const cl_func_t *get_func(eval_t *eval, fsig_t *sig);
+
+/**
+ * Calls in tail position hand the callee & its args to run_func(), which runs
+ * it in place of the caller. Returns cl_next if the call has to be made as
+ * usual - the callee doesn't run on closures or deferred calls are pending,
+ * those must run after the callee returns.
+ */
+static int tail(const cl_stmt_t *s, cl_frame_t *f, const int bare) {
+  fsig_t *sig = s->cs->sig;
+  if (!sig || sig->no_closure || sig->native || n_defers != f->defer_base)
+    return cl_next;
+  if (!load_body(sig, f->eval->tbl)) {
+    lno = load_lno;
+    return cl_fail;
+  }
+
+  /* Memoized callees record their result once they return. */
+  const cl_func_t *callee = get_func(f->eval, sig);
+  if (!callee || callee->memo) return cl_next;
+
+  const unsigned int argc = s->cs->argc;
+  value_t argv[argc + 1];
+  for (unsigned int i = 0; i < argc; i++)
+    if (!s->args[i]->fn(s->args[i], f, &argv[i])) return cl_fail;
+
+  tail_args = grow(tail_args, &tail_cap, argc, sizeof(value_t));
+  memcpy(tail_args, argv, argc * sizeof(value_t));
+
+  f->tail = callee;
+  f->tail_bare = bare;
+  return cl_tail;
+}
+
+static int s_tail(const cl_stmt_t *s, cl_frame_t *f) {
+  const int res = tail(s, f, 1);
+  return res != cl_next ? res : s_call(s, f);
+}
+
+static int s_ret_tail(const cl_stmt_t *s, cl_frame_t *f) {
+  const int res = tail(s, f, 0);
+  if (res != cl_next) return res;
+
+  if (!call(f, s->cs, s->args, 1, &f->ret)) return cl_fail;
+  f->has_ret = 1;
+  return cl_ret;
+}
+
+/**
+ * Compiler. Uses the same scoping rules (and gives up in the same cases) as
+ * the bytecode compiler, see compile.c.
+ */
+
+typedef struct builder {
+  symtbl_t *symtbl;
+  scope_t scope;
+} builder_t;
+
+static void *new(const unsigned long size) {
+  void *p = alloc(size);
+  memset(p, 0, size);
+  return p;
+}
+
+static cl_expr_t *leaf_expr(builder_t *b, const token_t *tk) {
+  cl_expr_t *e = new(sizeof(cl_expr_t));
+  e->fn = e_const;
+
+  if (tk->type != identifier) {
+    e->k = to_value(tk);
+    return e;
+  }
+
+  cvar_t *v = resolve_sym(&b->scope, tk->tk);
+
+  if (v) {
+    e->fn = e_load;
+    e->slot = v->slot;
+  } else if (!global_const(b->symtbl, tk->tk, &e->k)) {
+    b->scope.ok = 0;
+  }
+
+  return e;
+}
+
+static cl_expr_t *compile_exprtree(builder_t *b, const binary_node_t *node) {
+  static const char *ops[] = {"+", "-",  "*", "/", "%",  "<<", ">>",
+                              "&", "|", "^", "u-", "u+", "~"};
+  static const expr_fn k_ss[] = {e_add_ss, e_sub_ss,  e_mul_ss, e_div_ss,
+                                 e_mod_ss, e_shl_ss,  e_shr_ss, e_band_ss,
+                                 e_bor_ss, e_bxor_ss};
+  static const expr_fn k_sk[] = {e_add_sk, e_sub_sk,  e_mul_sk, e_div_sk,
+                                 e_mod_sk, e_shl_sk,  e_shr_sk, e_band_sk,
+                                 e_bor_sk, e_bxor_sk};
+  static const expr_fn k_ee[] = {e_add_ee, e_sub_ee,  e_mul_ee, e_div_ee,
+                                 e_mod_ee, e_shl_ee,  e_shr_ee, e_band_ee,
+                                 e_bor_ee, e_bxor_ee};
+
+  if (!node->lhs && !node->rhs) return leaf_expr(b, node->val);
+
+  unsigned int i = 0;
+  for (; i < sizeof ops / sizeof(char *); i++)
+    if (!strcmp(node->val->tk, ops[i])) break;
+
+  cl_expr_t *e = new(sizeof(cl_expr_t));
+  if (i == sizeof ops / sizeof(char *)) {
+    b->scope.ok = 0;
+    return e;
+  }
+
+  e->op = ops[i];
+  e->rhs = compile_exprtree(b, node->rhs);
+
+  /* Prefix operators only look at rhs, lhs is a placeholder. */
+  if (i >= sizeof k_ee / sizeof(expr_fn)) {
+    e->fn = e_unary;
+    return e;
+  }
+
+  e->lhs = compile_exprtree(b, node->lhs);
+  e->fn = k_ee[i];
+
+  if (e->lhs->fn == e_load && e->rhs->fn == e_load) {
+    e->fn = k_ss[i];
+    e->slot = e->lhs->slot;
+    e->rslot = e->rhs->slot;
+  } else if (e->lhs->fn == e_load && e->rhs->fn == e_const) {
+    e->fn = k_sk[i];
+    e->slot = e->lhs->slot;
+    e->k = e->rhs->k;
+  }
+
+  return e;
+}
+
+static const callsite_t *callsite(builder_t *b, const func_node_t *fnode,
+                                  cl_expr_t ***args) {
+  /* Linked by load_body(). */
+  if (!fnode->sig && !fnode->builtin) {
+    b->scope.ok = 0;
+    return NULL;
+  }
+
+  callsite_t *cs = new(sizeof(callsite_t));
+  cs->func = fnode->func;
+  cs->sig = fnode->sig;
+  cs->builtin = fnode->builtin;
+  cs->argc = fnode->args->size;
+
+  *args = new((cs->argc + 1) * sizeof(cl_expr_t *));
+  unsigned int i = 0;
+  for (node_t *arg = fnode->args->head; arg; arg = arg->next)
+    (*args)[i++] = leaf_expr(b, arg->data);
+
+  return cs;
+}
+
+static cl_expr_t *compile_operand(builder_t *b, void *buf,
+                                  const unsigned int type) {
+  switch (type) {
+    case exprtree:
+      return compile_exprtree(b, buf);
+
+    case fretval: {
+      cl_expr_t *e = new(sizeof(cl_expr_t));
+      e->fn = e_call;
+      e->cs = callsite(b, buf, &e->args);
+      return e;
+    }
+
+    case indx: {
+      const indx_node_t *ixnode = buf;
+      cl_expr_t *e = new(sizeof(cl_expr_t));
+      e->fn = ixnode->in_range ? e_slice_in_range : e_slice;
+      e->flags = ixnode->schar;
+      e->k.as.i = ixnode->len;
+      e->args = new(3 * sizeof(cl_expr_t *));
+      e->args[0] = leaf_expr(b, ixnode->arg);
+      if (ixnode->beg)
+        e->args[1] = compile_operand(b, ixnode->beg, ixnode->ltype);
+      if (ixnode->end)
+        e->args[2] = compile_operand(b, ixnode->end, ixnode->rtype);
+      return e;
+    }
+
+    case none:
+    case identifier:
+    case string:
+    case numeric:
+    case integer:
+    case glist:
+    case gstack: {
+      token_t tk = {buf, type};
+      return leaf_expr(b, &tk);
+    }
+  }
+
+  b->scope.ok = 0;
+  return new(sizeof(cl_expr_t));
+}
+
+static cl_cond_t *compile_cond(builder_t *b, const cnode_t *cnode) {
+  static const char *ops[] = {"<", "<=", "==", "!=", ">", ">="};
+  static const cond_fn k_ss[] = {c_lt_ss, c_le_ss, c_eq_ss,
+                                 c_ne_ss, c_gt_ss, c_ge_ss};
+  static const cond_fn k_sk[] = {c_lt_sk, c_le_sk, c_eq_sk,
+                                 c_ne_sk, c_gt_sk, c_ge_sk};
+  static const cond_fn k_ee[] = {c_lt_ee, c_le_ee, c_eq_ee,
+                                 c_ne_ee, c_gt_ee, c_ge_ee};
+
+  cl_cond_t *c = new(sizeof(cl_cond_t));
+  c->lhs = compile_operand(b, cnode->lhs, cnode->ltype);
+  c->rhs = compile_operand(b, cnode->rhs, cnode->rtype);
+
+  unsigned int i = 0;
+  for (; i < 6; i++)
+    if (!strcmp(cnode->op, ops[i])) break;
+
+  if (i == 6) {
+    b->scope.ok = 0;
+    return c;
+  }
+
+  c->fn = k_ee[i];
+  if (c->lhs->fn == e_load && c->rhs->fn == e_load) {
+    c->fn = k_ss[i];
+    c->slot = c->lhs->slot;
+    c->rslot = c->rhs->slot;
+  } else if (c->lhs->fn == e_load && c->rhs->fn == e_const) {
+    c->fn = k_sk[i];
+    c->slot = c->lhs->slot;
+    c->k = c->rhs->k;
+  }
+
+  return c;
+}
+
+static void compile_block(builder_t *b, const list_t *nodes,
+                          cl_block_t *block);
+
+static cl_stmt_t *compile_node(builder_t *b, const ast_node_t *node) {
+  cl_stmt_t *s = new(sizeof(cl_stmt_t));
+  s->lno = node->lno;
+
+  switch (node->type) {
+    case vdecl: {
+      decl_node_t *dnode = node->ch;
+      s->expr = compile_operand(b, dnode->rhs, dnode->rtype);
+
+      cvar_t *v = assign_sym(&b->scope, dnode->lhs, dnode->is_const);
+      if (!v) return s;
+
+      s->fn = s->expr->fn == e_const ? s_store_k : s_store;
+      s->slot = v->slot;
+      s->k = s->expr->k;
+      return s;
+    }
+
+    case cond:
+    case floop:
+      s->fn = node->type == cond ? s_if : s_for;
+      s->cond = compile_cond(b, node->ch);
+
+      if (node->type == floop) b->scope.loops++;
+      open_scope(&b->scope);
+      compile_block(b, node->lch, &s->body);
+      close_scope(&b->scope);
+      if (node->type == floop) b->scope.loops--;
+
+      if (node->type == cond) {
+        open_scope(&b->scope);
+        compile_block(b, node->rch, &s->alt);
+        close_scope(&b->scope);
+      }
+
+      return s;
+
+    case cout: {
+      print_node_t *pnode = node->ch;
+      s->fn = s_print;
+      s->expr = compile_operand(b, pnode->arg, pnode->type);
+      return s;
+    }
+
+    case cin: {
+      cvar_t *v = assign_sym(&b->scope, ((read_node_t *)node->ch)->arg, 0);
+      s->fn = s_read;
+      if (v) s->slot = v->slot;
+      return s;
+    }
+
+    case fcall:
+      s->fn = ((func_node_t *)node->ch)->tail ? s_tail : s_call;
+      s->cs = callsite(b, node->ch, &s->args);
+      return s;
+
+    /**
+     * Deferred calls resolve their args when the function returns, so only
+     * syms declared at the top level of the function are visible to them.
+     */
+    case fdefer: {
+      func_node_t *fnode = node->ch;
+      s->fn = s_defer;
+      s->cs = callsite(b, fnode, &s->args);
+
+      unsigned int i = 0;
+      for (node_t *arg = fnode->args->head; arg; arg = arg->next, i++) {
+        token_t *tk = arg->data;
+        cvar_t *v =
+            tk->type == identifier ? resolve_sym(&b->scope, tk->tk) : NULL;
+        if (tk->type == identifier && (!v || v->depth != 0)) b->scope.ok = 0;
+      }
+
+      return s;
+    }
+
+    case post_dec:
+    case post_inc: {
+      cvar_t *v = resolve_sym(&b->scope, ((unary_node_t *)node->ch)->arg);
+      if (!v || v->is_const) {
+        b->scope.ok = 0;
+        return s;
+      }
+
+      s->fn = s_inc;
+      s->slot = v->slot;
+      s->k.type = integer;
+      s->k.as.i = node->type == post_inc ? 1 : -1;
+      return s;
+    }
+
+    case fbreak:
+      s->fn = s_break;
+      return s;
+
+    case fcontinue:
+      s->fn = s_continue;
+      return s;
+
+    case rettype: {
+      return_node_t *rnode = node->ch;
+      s->fn = s_ret;
+      if (rnode->val && rnode->type == fretval &&
+          ((func_node_t *)rnode->val)->tail) {
+        s->fn = s_ret_tail;
+        s->cs = callsite(b, rnode->val, &s->args);
+      } else if (rnode->val) {
+        s->expr = compile_operand(b, rnode->val, rnode->type);
+      }
+      return s;
+    }
+  }
+
+  b->scope.ok = 0;
+  return s;
+}
+
+static void compile_block(builder_t *b, const list_t *nodes,
+                          cl_block_t *block) {
+  for (node_t *node = nodes->head; node && b->scope.ok; node = node->next) {
+    block->stmts =
+        grow(block->stmts, &block->cap, block->n, sizeof(cl_stmt_t *));
+    block->stmts[block->n++] = compile_node(b, node->data);
+  }
+}
+
+/**
+ * Returns the closures of sig, compiling them on the first call. Returns NULL
+ * if sig must run on the tree-walker.
+ */
+static const cl_func_t *get_func(eval_t *eval, fsig_t *sig) {
+  if (sig->closure) return sig->closure;
+  if (sig->no_closure || !sig->linked) return NULL;
+
+  builder_t b;
+  b.symtbl = eval->tbl;
+  init_scope(&b.scope, sig, eval->tbl);
+
+  cl_func_t *fn = new(sizeof(cl_func_t));
+  fn->n_args = sig->args->size;
+  fn->memo = sig->memo;
+  compile_block(&b, ((ast_node_t *)sig->node)->lch, &fn->body);
+  fn->n_slots = b.scope.n_slots;
+
+  if (!b.scope.ok) {
+    sig->no_closure = 1;
+    return NULL;
+  }
+
+  sig->closure = fn;
+  return fn;
+}
+
+/**
+ * Runs fn with args and its deferred calls. res & has_res are set to what it
+ * returned. A tail call runs its callee in the next iteration, so the C stack
+ * doesn't grow with it. Memoized functions never make one.
+ */
+static int run_func(eval_t *eval, const cl_func_t *fn, const value_t *args,
+                    value_t *res, int *has_res) {
+  int discard = 0;
+
+  if (fn->memo && memo_get(fn->memo, args, fn->n_args, res)) {
+    *has_res = 1;
+    return 1;
+  }
+
+  if (stack_exceeded(eval)) {
+    fprintf(stderr, "closure.c: stack depth exceeded at L[%d]\n", lno);
+    return 0;
+  }
+
+  depth++;
+
+run:;
+  value_t slots[fn->n_slots + 1];
+  memcpy(slots, args, fn->n_args * sizeof(value_t));
+
+  cl_frame_t f = {eval, slots, {0, {0}}, 0, n_defers, NULL, 0};
+  const int bres = run_block(&fn->body, &f);
+  if (bres == cl_fail) {
+    n_defers = f.defer_base;
+    depth--;
+    return 0;
+  }
+
+  /* Nothing was deferred, see tail(). A bare call discards the result. */
+  if (bres == cl_tail) {
+    fn = f.tail;
+    args = tail_args;
+    discard |= f.tail_bare;
+    goto run;
+  }
+
+  while (n_defers > f.defer_base) {
+    const cl_stmt_t *d = defers[--n_defers];
+    lno = d->lno;
+
+    if (!call(&f, d->cs, d->args, 0, NULL)) {
+      n_defers = f.defer_base;
+      depth--;
+      return 0;
+    }
+  }
+
+  *res = f.ret;
+  *has_res = f.has_ret && !discard;
+  if (fn->memo && *has_res) memo_put(fn->memo, args, fn->n_args, res);
+
+  depth--;
+  return 1;
+}
+
+static int call(cl_frame_t *f, const callsite_t *cs, cl_expr_t **args,
+                const unsigned char want, value_t *out) {
+  value_t argv[cs->argc + 1];
+  for (unsigned int i = 0; i < cs->argc; i++)
+    if (!args[i]->fn(args[i], f, &argv[i])) return 0;
+
+  fsig_t *sig = cs->sig;
+  const cl_func_t *callee = NULL;
+
+  if (sig && !sig->no_closure) {
+    if (!load_body(sig, f->eval->tbl)) {
+      lno = load_lno;
+      return 0;
+    }
+    callee = get_func(f->eval, sig);
+  }
+
+  if (!callee) return call_out(f->eval, cs, argv, want, out);
+
+  value_t ret;
+  int has_ret = 0;
+  const int jres = jit_call(f->eval, sig, argv, cs->argc);
+  if (!jres) return 0;
+
+  if (jres > 0)
+    has_ret = take_ret(f->eval->tbl, &ret);
+  else if (!run_func(f->eval, callee, argv, &ret, &has_ret))
+    return 0;
+
+  if (!want) return 1;
+
+  if (!has_ret) {
+    fprintf(stderr, "closure.c: %s() did not return anything\n", cs->func);
+    return 0;
+  }
+
+  *out = ret;
+  return 1;
+}
+
+/**
+ * Runs sig on closures if it can be compiled, with the args of fnode resolved
+ * in the caller's frame. Returns -1 if sig must run on the tree-walker instead.
+ */
+int closure_call(eval_t *eval, fsig_t *sig, const func_node_t *fnode) {
+  if (sig->no_closure) return -1;
+  if (!load_body(sig, eval->tbl)) {
+    lno = load_lno;
+    return 0;
+  }
+
+  const cl_func_t *fn = get_func(eval, sig);
+  if (!fn) return -1;
+
+  /* Linking checked that fnode passes fn->n_args, main is passed none. */
+  const unsigned int argc = fnode ? fnode->args->size : 0;
+
+  value_t args[fn->n_args + 1];
+  memset(args, 0, sizeof args);
+  if (argc && !eval_args(eval, fnode, args)) return 0;
+
+  const int jres = jit_call(eval, sig, args, argc);
+  if (jres >= 0) return jres;
+
+  value_t res;
+  int has_res = 0;
+  if (!run_func(eval, fn, args, &res, &has_res)) return 0;
+
+  if (has_res) set_ret(eval->tbl, &res);
+  return 1;
+}
+
+const cl_block_t *closure_block(const list_t *nodes, scope_t *scope,
+                                symtbl_t *symtbl) {
+  builder_t b;
+  b.symtbl = symtbl;
+  b.scope = *scope;
+
+  cl_block_t *block = new(sizeof(cl_block_t));
+  compile_block(&b, nodes, block);
+  *scope = b.scope;
+  return b.scope.ok ? block : NULL;
+}
+
+/* A continue at the top of block ends it like its end does. */
+int closure_run(const cl_block_t *block, value_t *slots) {
+  cl_frame_t f = {NULL, slots, {0, {0}}, 0, 0, NULL, 0};
+  return run_block(block, &f) != cl_fail;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "compile.h"
+#include "eval.h"
+#include "node.h"
+#include "symtbl.h"
+#include "value.h"
+
+int closure_call(eval_t *eval, fsig_t *sig, const func_node_t *fnode);
+/**
+ * Compiles nodes on closures, with syms resolved in scope (whose slots the
+ * caller lays out). Returns NULL if they can't run on closures. Used for the
+ * bodies of pfors, see par.c.
+ */
+const struct cl_block *closure_block(const list_t *nodes, scope_t *scope,
+                                     symtbl_t *symtbl);
+/**
+ * Runs block with slots as its locals, returns 0 on error. A block that makes
+ * no calls, prints or reads only touches slots, it can run on any thread.
+ */
+int closure_run(const struct cl_block *block, value_t *slots);
@@ -0,0 +1,561 @@
+/**
+ * compile.c
+ * Compiles the AST of a function into bytecode for the VM (see vm.c).
+ *
+ * Variables are resolved to slots at compile time, following the same block
+ * scoping that scope_cleanup() applies at runtime. Anything the compiler can't
+ * map onto the VM with the exact same behaviour makes compile_func() return
+ * NULL, and that function keeps running on the tree-walker.
+ */
+
+#include "compile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "builtin.h"
+#include "token.h"
+#include "util.h"
+
+typedef struct compiler {
+  chunk_t *chunk;
+  symtbl_t *symtbl;
+  scope_t scope;
+  int sp, lno;
+  /**
+   * Where a continue jumps to in the innermost for (its condition), and the
+   * jumps of the breaks out of it, patched once its end is known.
+   */
+  unsigned int loop_top, *breaks, n_breaks, cap_breaks;
+} compiler_t;
+
+void *grow(void *arr, unsigned int *cap, const unsigned int n,
+           const unsigned long size) {
+  if (n < *cap) return arr;
+
+  const unsigned int ncap = *cap ? *cap * 2 : 16;
+  void *narr = alloc(ncap * size);
+  if (arr) memcpy(narr, arr, n * size);
+
+  *cap = ncap;
+  return narr;
+}
+
+static void fail(compiler_t *c) { c->scope.ok = 0; }
+
+static void stack(compiler_t *c, const int delta) {
+  c->sp += delta;
+  if (c->sp > (int)c->chunk->max_stack) c->chunk->max_stack = c->sp;
+}
+
+static unsigned int emit(compiler_t *c, const unsigned char op, const int a,
+                         const unsigned char b) {
+  chunk_t *chunk = c->chunk;
+
+  /* lines grows in lockstep with code. */
+  if (chunk->n_code == chunk->cap_code) {
+    unsigned int cap = chunk->cap_code;
+    chunk->code = grow(chunk->code, &chunk->cap_code, chunk->n_code,
+                       sizeof(instr_t));
+    chunk->lines = grow(chunk->lines, &cap, chunk->n_code, sizeof(int));
+  }
+
+  chunk->code[chunk->n_code] = (instr_t){op, b, a};
+  chunk->lines[chunk->n_code] = c->lno;
+  return chunk->n_code++;
+}
+
+static void patch(compiler_t *c, const unsigned int at) {
+  c->chunk->code[at].a = c->chunk->n_code;
+}
+
+static int add_const(compiler_t *c, const value_t val) {
+  chunk_t *chunk = c->chunk;
+  chunk->consts = grow(chunk->consts, &chunk->cap_consts, chunk->n_consts,
+                       sizeof(value_t));
+  chunk->consts[chunk->n_consts] = val;
+  return chunk->n_consts++;
+}
+
+int global_const(const symtbl_t *symtbl, const char *sym, value_t *val) {
+  const entry_t *e = get_global(symtbl, sym);
+  if (!e || !e->is_const) return 0;
+  if (e->vtype != integer && e->vtype != numeric && e->vtype != string)
+    return 0;
+
+  *val = to_value(&(token_t){e->val, e->vtype});
+  return 1;
+}
+
+cvar_t *add_var(scope_t *scope, const char *sym, const unsigned int is_const) {
+  scope->vars =
+      grow(scope->vars, &scope->cap_vars, scope->n_vars, sizeof(cvar_t));
+  cvar_t *v = &scope->vars[scope->n_vars++];
+  v->sym = sym;
+  v->slot = scope->n_slots++;
+  v->depth = scope->depth;
+  v->is_const = is_const;
+  return v;
+}
+
+void init_scope(scope_t *scope, const fsig_t *sig, const symtbl_t *symtbl) {
+  memset(scope, 0, sizeof(scope_t));
+  scope->symtbl = symtbl;
+  scope->ok = 1;
+
+  for (node_t *arg = sig->args->head; arg; arg = arg->next)
+    add_var(scope, ((token_t *)arg->data)->tk, 0);
+}
+
+cvar_t *resolve_sym(const scope_t *scope, const char *sym) {
+  for (unsigned int i = scope->n_vars; i > 0; i--)
+    if (!strcmp(scope->vars[i - 1].sym, sym)) return &scope->vars[i - 1];
+
+  return NULL;
+}
+
+cvar_t *declare_sym(scope_t *scope, const char *sym,
+                    const unsigned int is_const) {
+  if (is_reserved(sym) || get_global(scope->symtbl, sym)) {
+    scope->ok = 0;
+    return NULL;
+  }
+
+  return add_var(scope, sym, is_const);
+}
+
+cvar_t *assign_sym(scope_t *scope, const char *sym,
+                   const unsigned int is_const) {
+  cvar_t *v = resolve_sym(scope, sym);
+
+  /**
+   * Re-running a const decl in a loop fails at runtime on the tree-walker.
+   * Leave that (and writes to consts) to it.
+   */
+  if ((v && v->is_const) || (is_const && scope->loops)) {
+    scope->ok = 0;
+    return NULL;
+  }
+
+  if (!v) return declare_sym(scope, sym, is_const);
+
+  v->is_const = is_const;
+  return v;
+}
+
+void open_scope(scope_t *scope) { scope->depth++; }
+
+/* Syms declared inside the block are gone once it ends. */
+void close_scope(scope_t *scope) {
+  scope->depth--;
+  while (scope->n_vars && scope->vars[scope->n_vars - 1].depth > scope->depth)
+    scope->n_vars--;
+}
+
+static void compile_token(compiler_t *c, token_t *tk) {
+  if (tk->type == identifier) {
+    value_t val;
+    cvar_t *v = resolve_sym(&c->scope, tk->tk);
+
+    if (v) {
+      emit(c, op_load, v->slot, 0);
+    } else if (global_const(c->symtbl, tk->tk, &val)) {
+      emit(c, op_const, add_const(c, val), 0);
+    } else {
+      fail(c);
+    }
+  } else {
+    emit(c, op_const, add_const(c, to_value(tk)), 0);
+  }
+
+  stack(c, +1);
+}
+
+static void compile_exprtree(compiler_t *c, const binary_node_t *node) {
+  static const char *ops[] = {"+",  "-",  "*", "/", "%",  "<<", ">>",
+                              "&",  "|",  "^", "u-", "u+", "~"};
+  static const unsigned char opcodes[] = {
+      op_add,  op_sub, op_mul,  op_div, op_mod, op_shl,  op_shr,
+      op_band, op_bor, op_bxor, op_neg, op_pos, op_bnot};
+
+  if (!node->lhs && !node->rhs) {
+    compile_token(c, node->val);
+    return;
+  }
+
+  unsigned int i = 0;
+  for (; i < sizeof ops / sizeof(char *); i++)
+    if (!strcmp(node->val->tk, ops[i])) break;
+
+  if (i == sizeof ops / sizeof(char *)) {
+    fail(c);
+    return;
+  }
+
+  /* Prefix operators only look at rhs, lhs is a placeholder. */
+  if (opcodes[i] >= op_neg) {
+    compile_exprtree(c, node->rhs);
+    emit(c, opcodes[i], 0, 0);
+    return;
+  }
+
+  compile_exprtree(c, node->lhs);
+  compile_exprtree(c, node->rhs);
+  emit(c, opcodes[i], 0, 0);
+  stack(c, -1);
+}
+
+static int add_call(compiler_t *c, const func_node_t *fnode) {
+  /* Linked by load_body(). */
+  if (!fnode->sig && !fnode->builtin) return -1;
+
+  chunk_t *chunk = c->chunk;
+  chunk->calls = grow(chunk->calls, &chunk->cap_calls, chunk->n_calls,
+                      sizeof(callsite_t));
+
+  callsite_t *cs = &chunk->calls[chunk->n_calls];
+  cs->func = fnode->func;
+  cs->sig = fnode->sig;
+  cs->builtin = fnode->builtin;
+  cs->argc = fnode->args->size;
+  return chunk->n_calls++;
+}
+
+static void compile_call(compiler_t *c, const func_node_t *fnode,
+                         const unsigned char want) {
+  const int call = add_call(c, fnode);
+  if (call < 0) {
+    fail(c);
+    return;
+  }
+
+  for (node_t *arg = fnode->args->head; arg; arg = arg->next)
+    compile_token(c, arg->data);
+
+  emit(c, fnode->tail ? op_tailcall : op_call, call, want);
+  stack(c, want - (int)fnode->args->size);
+}
+
+static void compile_operand(compiler_t *c, void *buf, const unsigned int type);
+
+static void compile_indx(compiler_t *c, const indx_node_t *ixnode) {
+  unsigned char flags = ixnode->schar ? slice_schar : 0;
+  compile_token(c, ixnode->arg);
+
+  if (ixnode->beg) {
+    compile_operand(c, ixnode->beg, ixnode->ltype);
+    flags |= slice_lb;
+  }
+
+  if (ixnode->end) {
+    compile_operand(c, ixnode->end, ixnode->rtype);
+    flags |= slice_ub;
+  }
+
+  emit(c, op_slice, 0, flags);
+  stack(c, -!!ixnode->beg - !!ixnode->end);
+}
+
+static void compile_operand(compiler_t *c, void *buf,
+                            const unsigned int type) {
+  switch (type) {
+    case exprtree:
+      compile_exprtree(c, buf);
+      return;
+    case fretval:
+      compile_call(c, buf, 1);
+      return;
+    case indx:
+      compile_indx(c, buf);
+      return;
+    case none:
+    case identifier:
+    case string:
+    case numeric:
+    case integer:
+    case glist:
+    case gstack: {
+      token_t tk = {buf, type};
+      compile_token(c, &tk);
+      return;
+    }
+    default:
+      fail(c);
+  }
+}
+
+static unsigned int compile_cond(compiler_t *c, const cnode_t *cnode) {
+  static const char *ops[] = {"<", "<=", "==", "!=", ">", ">="};
+  static const unsigned char opcodes[] = {op_lt, op_le, op_eq,
+                                          op_ne, op_gt, op_ge};
+
+  compile_operand(c, cnode->lhs, cnode->ltype);
+  compile_operand(c, cnode->rhs, cnode->rtype);
+
+  unsigned int i = 0;
+  for (; i < 6; i++)
+    if (!strcmp(cnode->op, ops[i])) break;
+
+  if (i == 6) fail(c);
+  emit(c, i < 6 ? opcodes[i] : op_eq, 0, 0);
+  stack(c, -1);
+
+  const unsigned int jz = emit(c, op_jz, 0, 0);
+  stack(c, -1);
+  return jz;
+}
+
+static void compile_block(compiler_t *c, const list_t *nodes);
+
+static void compile_node(compiler_t *c, const ast_node_t *node) {
+  c->lno = node->lno;
+
+  switch (node->type) {
+    case vdecl: {
+      decl_node_t *dnode = node->ch;
+      compile_operand(c, dnode->rhs, dnode->rtype);
+
+      cvar_t *v = assign_sym(&c->scope, dnode->lhs, dnode->is_const);
+      if (!v) return;
+
+      emit(c, op_store, v->slot, 0);
+      stack(c, -1);
+      return;
+    }
+
+    case cond: {
+      const unsigned int jz = compile_cond(c, node->ch);
+
+      open_scope(&c->scope);
+      compile_block(c, node->lch);
+      close_scope(&c->scope);
+
+      if (!node->rch->size) {
+        patch(c, jz);
+        return;
+      }
+
+      const unsigned int jmp = emit(c, op_jmp, 0, 0);
+      patch(c, jz);
+
+      open_scope(&c->scope);
+      compile_block(c, node->rch);
+      close_scope(&c->scope);
+
+      patch(c, jmp);
+      return;
+    }
+
+    case floop: {
+      const unsigned int top = c->chunk->n_code, outer = c->loop_top;
+      const unsigned int jz = compile_cond(c, node->ch);
+      const unsigned int n_breaks = c->n_breaks;
+
+      c->loop_top = top;
+      c->scope.loops++;
+      open_scope(&c->scope);
+      compile_block(c, node->lch);
+      close_scope(&c->scope);
+      c->scope.loops--;
+      c->loop_top = outer;
+
+      emit(c, op_jmp, top, 0);
+      patch(c, jz);
+      while (c->n_breaks > n_breaks) patch(c, c->breaks[--c->n_breaks]);
+      return;
+    }
+
+    case fbreak:
+      c->breaks = grow(c->breaks, &c->cap_breaks, c->n_breaks,
+                       sizeof(unsigned int));
+      c->breaks[c->n_breaks++] = emit(c, op_jmp, 0, 0);
+      return;
+
+    case fcontinue:
+      emit(c, op_jmp, c->loop_top, 0);
+      return;
+
+    case cout: {
+      print_node_t *pnode = node->ch;
+      compile_operand(c, pnode->arg, pnode->type);
+      emit(c, op_print, 0, 0);
+      stack(c, -1);
+      return;
+    }
+
+    case cin: {
+      cvar_t *v = assign_sym(&c->scope, ((read_node_t *)node->ch)->arg, 0);
+      if (v) emit(c, op_read, v->slot, 0);
+      return;
+    }
+
+    case fcall:
+      compile_call(c, node->ch, 0);
+      return;
+
+    /**
+     * Deferred calls resolve their args when the function returns, so only
+     * syms declared at the top level of the function are visible to them.
+     */
+    case fdefer: {
+      func_node_t *fnode = node->ch;
+      const int call = add_call(c, fnode);
+      if (call < 0) {
+        fail(c);
+        return;
+      }
+
+      chunk_t *chunk = c->chunk;
+      chunk->defers = grow(chunk->defers, &chunk->cap_defers,
+                           chunk->n_defers, sizeof(defer_site_t));
+
+      defer_site_t *ds = &chunk->defers[chunk->n_defers];
+      ds->call = call;
+      ds->args = alloc((fnode->args->size + 1) * sizeof(int));
+
+      unsigned int i = 0;
+      for (node_t *arg = fnode->args->head; arg; arg = arg->next, i++) {
+        token_t *tk = arg->data;
+        if (tk->type != identifier) {
+          ds->args[i] = -add_const(c, to_value(tk)) - 1;
+          continue;
+        }
+
+        cvar_t *v = resolve_sym(&c->scope, tk->tk);
+        if (!v || v->depth != 0) {
+          fail(c);
+          return;
+        }
+
+        ds->args[i] = v->slot;
+      }
+
+      /* The args are pushed when the deferred call is made. */
+      stack(c, +(int)fnode->args->size);
+      stack(c, -(int)fnode->args->size);
+
+      emit(c, op_defer, chunk->n_defers++, 0);
+      return;
+    }
+
+    case post_dec:
+    case post_inc: {
+      cvar_t *v = resolve_sym(&c->scope, ((unary_node_t *)node->ch)->arg);
+      if (!v || v->is_const) {
+        fail(c);
+        return;
+      }
+
+      emit(c, node->type == post_inc ? op_inc : op_dec, v->slot, 0);
+      return;
+    }
+
+    case rettype: {
+      return_node_t *rnode = node->ch;
+      if (!rnode->val) {
+        emit(c, op_ret, 0, 0);
+        return;
+      }
+
+      compile_operand(c, rnode->val, rnode->type);
+      emit(c, op_ret, 0, 1);
+      stack(c, -1);
+      return;
+    }
+
+    default:
+      fail(c);
+  }
+}
+
+static void compile_block(compiler_t *c, const list_t *nodes) {
+  for (node_t *node = nodes->head; node && c->scope.ok; node = node->next)
+    compile_node(c, node->data);
+}
+
+int chunk_depths(const chunk_t *chunk, int *depth, unsigned char *target) {
+  int d = 0, max = 0;
+  memset(target, 0, chunk->n_code);
+
+  for (unsigned int i = 0; i < chunk->n_code; i++) {
+    const instr_t *ins = &chunk->code[i];
+    depth[i] = d;
+
+    switch (ins->op) {
+      case op_const:
+      case op_load:
+        d++;
+        break;
+      case op_neg:
+      case op_pos:
+      case op_bnot:
+      case op_inc:
+      case op_dec:
+      case op_read:
+      case op_defer:
+      case op_leave:
+        break;
+      case op_slice:
+        d -= !!(ins->b & slice_lb) + !!(ins->b & slice_ub);
+        break;
+      case op_jz:
+        d--;
+        /* fall through */
+      case op_jmp:
+        if (d || ins->a < 0 || ins->a >= (int)chunk->n_code) return -1;
+        target[ins->a] = 1;
+        break;
+      case op_call:
+      case op_tailcall:
+        d += ins->b - (int)chunk->calls[ins->a].argc;
+        break;
+      case op_ret:
+        d -= ins->b;
+        break;
+      /* Stores, pops, prints & binary operators. */
+      default:
+        d--;
+    }
+
+    if (d < 0) return -1;
+    if (d > max) max = d;
+  }
+
+  for (unsigned int i = 0; i < chunk->n_code; i++)
+    if (target[i] && depth[i]) return -1;
+
+  return max;
+}
+
+/**
+ * Compiles the (already parsed) body of sig. Returns NULL if the function
+ * can't run on the VM.
+ */
+chunk_t *compile_func(fsig_t *sig, symtbl_t *symtbl) {
+  if (sig->chunk) return sig->chunk;
+  if (sig->no_chunk || !sig->linked) return NULL;
+
+  chunk_t *chunk = alloc(sizeof(chunk_t));
+  memset(chunk, 0, sizeof(chunk_t));
+  chunk->sig = sig;
+  chunk->n_args = sig->args->size;
+
+  compiler_t c;
+  memset(&c, 0, sizeof c);
+  c.chunk = chunk;
+  c.symtbl = symtbl;
+  c.lno = ((ast_node_t *)sig->node)->lno;
+  init_scope(&c.scope, sig, symtbl);
+
+  compile_block(&c, ((ast_node_t *)sig->node)->lch);
+  emit(&c, op_leave, 0, 0);
+  chunk->n_slots = c.scope.n_slots;
+
+  if (!c.scope.ok) {
+    sig->no_chunk = 1;
+    return NULL;
+  }
+
+  sig->chunk = chunk;
+  return chunk;
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "builtin.h"
+#include "node.h"
+#include "symtbl.h"
+#include "value.h"
+
+/**
+ * Instruction set of the VM. a and b are the operands, their meaning depends
+ * on the opcode -
+ * const    a -> index into consts
+ * load     a -> slot
+ * store    a -> slot
+ * jmp/jz   a -> target pc
+ * inc/dec  a -> slot
+ * slice    b -> slice_lb | slice_ub | slice_schar
+ * read     a -> slot
+ * call     a -> index into calls, b -> 1 if the caller needs the result
+ * tailcall same as call, for calls in tail position
+ * defer    a -> index into defers
+ * ret      b -> 1 if a value is returned
+ */
+enum {
+  op_const,
+  op_load,
+  op_store,
+  op_pop,
+  op_add,
+  op_sub,
+  op_mul,
+  op_div,
+  op_mod,
+  op_shl,
+  op_shr,
+  op_band,
+  op_bor,
+  op_bxor,
+  op_neg,
+  op_pos,
+  op_bnot,
+  op_lt,
+  op_le,
+  op_eq,
+  op_ne,
+  op_gt,
+  op_ge,
+  op_jmp,
+  op_jz,
+  op_inc,
+  op_dec,
+  op_slice,
+  op_print,
+  op_read,
+  op_call,
+  op_tailcall,
+  op_defer,
+  op_ret,
+  op_leave,
+  op_count
+};
+
+enum { slice_lb = 1, slice_ub = 2, slice_schar = 4 };
+
+typedef struct instr {
+  unsigned char op, b;
+  int a;
+} instr_t;
+
+typedef struct callsite {
+  const char *func;
+  /* Exactly one of sig and builtin is set. */
+  fsig_t *sig;
+  const builtin_t *builtin;
+  unsigned int argc;
+} callsite_t;
+
+typedef struct defer_site {
+  unsigned int call;
+  /* Per arg - slot if >= 0, otherwise -(index into consts) - 1. */
+  int *args;
+} defer_site_t;
+
+/**
+ * A compiled function. The first n_args slots hold the arguments, the rest are
+ * its locals. max_stack is the deepest the operand stack gets on top of them.
+ */
+typedef struct chunk {
+  fsig_t *sig;
+  instr_t *code;
+  int *lines;
+  value_t *consts;
+  callsite_t *calls;
+  defer_site_t *defers;
+  unsigned int n_code, n_consts, n_calls, n_defers;
+  unsigned int cap_code, cap_consts, cap_calls, cap_defers;
+  unsigned int n_args, n_slots, max_stack;
+} chunk_t;
+
+/* A local resolved to a slot at compile time. */
+typedef struct cvar {
+  const char *sym;
+  int slot;
+  unsigned int depth, is_const;
+} cvar_t;
+
+/**
+ * Block scopes of the function being compiled, shared by the compilers of all
+ * the engines. ok is cleared as soon as the function uses something that an
+ * engine can't run with the exact behaviour of the tree-walker.
+ */
+typedef struct scope {
+  const symtbl_t *symtbl;
+  cvar_t *vars;
+  unsigned int n_vars, cap_vars, depth, loops, n_slots;
+  int ok;
+} scope_t;
+
+/* Grows arr (alloc'd) so that it can hold at least n + 1 elements. */
+void *grow(void *arr, unsigned int *cap, const unsigned int n,
+           const unsigned long size);
+
+/**
+ * Whether sym is a global const that's set to a number or a string, i.e, one of
+ * the builtin type consts or a top-level const whose decl has run.
+ */
+int global_const(const symtbl_t *symtbl, const char *sym, value_t *val);
+
+/**
+ * Starts a scope with the args of sig in the first slots. Args shadow globals,
+ * any other local can't be declared with the sym of a global - the tree-walker
+ * assigns the global instead.
+ */
+void init_scope(scope_t *scope, const fsig_t *sig, const symtbl_t *symtbl);
+/**
+ * Declares sym in the next slot, whether or not it's the sym of a global, the
+ * way init_scope() does with args.
+ */
+cvar_t *add_var(scope_t *scope, const char *sym, const unsigned int is_const);
+cvar_t *resolve_sym(const scope_t *scope, const char *sym);
+cvar_t *declare_sym(scope_t *scope, const char *sym,
+                    const unsigned int is_const);
+cvar_t *assign_sym(scope_t *scope, const char *sym,
+                   const unsigned int is_const);
+void open_scope(scope_t *scope);
+void close_scope(scope_t *scope);
+
+chunk_t *compile_func(fsig_t *sig, symtbl_t *symtbl);
+
+/**
+ * Works out the depth of the operand stack before every instruction of chunk,
+ * and marks the instructions that are jumped to in target. The stack is empty
+ * at every jump. Returns the deepest it gets, or -1.
+ */
+int chunk_depths(const chunk_t *chunk, int *depth, unsigned char *target);
@@ -0,0 +1,421 @@
+/**
+ * emit.c
+ * Translates a program to C (--emit-c), to be built against the runtime in
+ * rt.c and the cherry_core library.
+ *
+ * Every function is compiled to bytecode first (see compile.c), which resolves
+ * its syms to slots the same way the VM does. Each instruction then becomes a
+ * C statement on the arrays of slots & operand stack of the function, and jumps
+ * become gotos. Programs that use anything the VM can't compile, or that have
+ * top-level decls, are rejected.
+ */
+
+#include "emit.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "compile.h"
+#include "rt.h"
+#include "token.h"
+#include "util.h"
+
+static void emit_str(FILE *out, const char *s) {
+  fputc('"', out);
+  for (; *s; s++) {
+    const unsigned char c = *s;
+    if (c == '"' || c == '\\')
+      fprintf(out, "\\%c", c);
+    else if (c < 32 || c > 126)
+      fprintf(out, "\\%03o", c);
+    else
+      fputc(c, out);
+  }
+
+  fputc('"', out);
+}
+
+static int emit_value(FILE *out, const value_t *val) {
+  switch (val->type) {
+    case integer:
+      if (val->as.i == LLONG_MIN)
+        fprintf(out, "rt_int(-9223372036854775807LL - 1)");
+      else
+        fprintf(out, "rt_int(%lldLL)", val->as.i);
+      return 1;
+    case numeric:
+      fprintf(out, "rt_num(%.17g)", val->as.d);
+      return 1;
+    case string:
+      fprintf(out, "rt_str(");
+      emit_str(out, val->as.p);
+      fprintf(out, ")");
+      return 1;
+    default:
+      fprintf(stderr, "emit.c: can't translate a value of type [%d]\n",
+              val->type);
+      return 0;
+  }
+}
+
+/* Calls cs with its argc args at args (a C expression). */
+static void emit_call(FILE *out, const callsite_t *cs, const char *args,
+                      const char *res, const unsigned char want) {
+  if (cs->builtin) {
+    fprintf(out, "rt_builtin(\"%s\", %s, %d, %d, %s);\n", cs->func, args,
+            cs->argc, want, res);
+  } else if (want) {
+    fprintf(out, "if (!rt_call(f_%s, %s, %s)) rt_noret(\"%s\");\n", cs->func,
+            args, res, cs->func);
+  } else {
+    fprintf(out, "rt_call(f_%s, %s, %s);\n", cs->func, args, res);
+  }
+}
+
+/* Deferred calls resolve their args once the function returns. */
+static int emit_defers(FILE *out, const chunk_t *chunk) {
+  fprintf(out, "  while (defers.n) {\n");
+  fprintf(out, "    switch (defers.sites[--defers.n]) {\n");
+
+  for (unsigned int i = 0; i < chunk->n_defers; i++) {
+    const defer_site_t *ds = &chunk->defers[i];
+    const callsite_t *cs = &chunk->calls[ds->call];
+
+    fprintf(out, "      case %d: {\n", i);
+    fprintf(out, "        value_t argv[%d] = {", cs->argc + 1);
+    for (unsigned int k = 0; k < cs->argc; k++) {
+      if (k) fprintf(out, ", ");
+      if (ds->args[k] >= 0)
+        fprintf(out, "v[%d]", ds->args[k]);
+      else if (!emit_value(out, &chunk->consts[-ds->args[k] - 1]))
+        return 0;
+    }
+
+    fprintf(out, "};\n        ");
+    emit_call(out, cs, "argv", "argv", 0);
+    fprintf(out, "        break;\n      }\n");
+  }
+
+  fprintf(out, "    }\n  }\n");
+  return 1;
+}
+
+/* A tail call the C leaves to rt_call(), or a goto for the function itself. */
+static int is_tail(const chunk_t *chunk, const instr_t *ins) {
+  if (ins->op != op_tailcall) return 0;
+
+  const callsite_t *cs = &chunk->calls[ins->a];
+  return !cs->builtin && cs->argc <= rt_max_args;
+}
+
+static int emit_instr(FILE *out, const chunk_t *chunk, const unsigned int i,
+                      const int top) {
+  static const char *binary[] = {
+      [op_add] = "ADD",   [op_sub] = "SUB", [op_mul] = "MUL",
+      [op_div] = "DIV",   [op_mod] = "MOD", [op_shl] = "SHL",
+      [op_shr] = "SHR",   [op_band] = "BAND", [op_bor] = "BOR",
+      [op_bxor] = "BXOR", [op_neg] = "NEG", [op_pos] = "POS",
+      [op_bnot] = "BNOT"};
+  static const char *cmps[] = {"<", "<=", "==", "!=", ">", ">="};
+
+  const instr_t *ins = &chunk->code[i];
+  const int line = chunk->lines[i];
+
+  switch (ins->op) {
+    case op_const:
+      fprintf(out, "  s[%d] = ", top);
+      if (!emit_value(out, &chunk->consts[ins->a])) return 0;
+      fprintf(out, ";\n");
+      return 1;
+
+    case op_load:
+      fprintf(out, "  s[%d] = v[%d];\n", top, ins->a);
+      return 1;
+
+    case op_store:
+      fprintf(out, "  v[%d] = s[%d];\n", ins->a, top - 1);
+      return 1;
+
+    case op_pop:
+      return 1;
+
+    case op_add:
+    case op_sub:
+    case op_mul:
+    case op_div:
+    case op_mod:
+    case op_shl:
+    case op_shr:
+    case op_band:
+    case op_bor:
+    case op_bxor:
+      fprintf(out, "  RT_%s(s[%d], s[%d], %d);\n", binary[ins->op], top - 2,
+              top - 1, line);
+      return 1;
+
+    case op_neg:
+    case op_pos:
+    case op_bnot:
+      fprintf(out, "  RT_%s(s[%d], %d);\n", binary[ins->op], top - 1, line);
+      return 1;
+
+    case op_lt:
+    case op_le:
+    case op_eq:
+    case op_ne:
+    case op_gt:
+    case op_ge:
+      fprintf(out, "  RT_CMP(s[%d], s[%d], \"%s\", %s, %d);\n", top - 2,
+              top - 1, cmps[ins->op - op_lt], cmps[ins->op - op_lt], line);
+      return 1;
+
+    case op_jmp:
+      fprintf(out, "  goto L%d;\n", ins->a);
+      return 1;
+
+    case op_jz:
+      fprintf(out, "  if (!s[%d].as.i) goto L%d;\n", top - 1, ins->a);
+      return 1;
+
+    case op_inc:
+    case op_dec:
+      fprintf(out, "  RT_STEP(v[%d], %d, %d);\n", ins->a,
+              ins->op == op_inc ? 1 : -1, line);
+      return 1;
+
+    case op_slice: {
+      const int ub = ins->b & slice_ub, lb = ins->b & slice_lb;
+      const int arg = top - 1 - !!lb - !!ub;
+
+      fprintf(out, "  lno = %d;\n", line);
+      fprintf(out, "  rt_slice(&s[%d], ", arg);
+      if (lb)
+        fprintf(out, "&s[%d], ", arg + 1);
+      else
+        fprintf(out, "NULL, ");
+
+      if (ub)
+        fprintf(out, "&s[%d], ", top - 1);
+      else
+        fprintf(out, "NULL, ");
+
+      fprintf(out, "%d);\n", !!(ins->b & slice_schar));
+      return 1;
+    }
+
+    case op_print:
+      fprintf(out, "  rt_print(&s[%d]);\n", top - 1);
+      return 1;
+
+    case op_read:
+      fprintf(out, "  rt_read(&v[%d]);\n", ins->a);
+      return 1;
+
+    /**
+     * Tail calls to the function itself jump back to the top with the args in
+     * the first slots, others return to rt_call() which makes them. Neither
+     * happens while deferred calls are pending. A bare call discards the
+     * result.
+     */
+    case op_call:
+    case op_tailcall: {
+      const callsite_t *cs = &chunk->calls[ins->a];
+      const int argv = top - cs->argc;
+      const int tail = is_tail(chunk, ins);
+
+      char args[32];
+      snprintf(args, sizeof args, "&s[%d]", argv);
+
+      if (!tail) {
+        fprintf(out, "  lno = %d;\n  ", line);
+        emit_call(out, cs, args, args, ins->b);
+        return 1;
+      }
+
+      if (chunk->n_defers) {
+        fprintf(out, "  if (defers.n) {\n    lno = %d;\n    ", line);
+        emit_call(out, cs, args, args, ins->b);
+        fprintf(out, "    goto L%d;\n  }\n", i + 1);
+      }
+
+      if (cs->sig == chunk->sig) {
+        for (unsigned int k = 0; k < cs->argc; k++)
+          fprintf(out, "  v[%d] = s[%d];\n", k, argv + k);
+        if (!ins->b) fprintf(out, "  discard = 1;\n");
+
+        fprintf(out, "  goto top;\n");
+        return 1;
+      }
+
+      if (cs->argc)
+        fprintf(out, "  memcpy(rt_args, %s, %d * sizeof(value_t));\n", args,
+                cs->argc);
+      fprintf(out, "  rt_next = f_%s;\n  rt_depth--;\n", cs->func);
+      if (ins->b)
+        fprintf(out, "  return discard ? rt_tail_bare : rt_tail;\n");
+      else
+        fprintf(out, "  return rt_tail_bare;\n");
+      return 1;
+    }
+
+    case op_defer:
+      fprintf(out, "  rt_defer(&defers, %d);\n", ins->a);
+      return 1;
+
+    case op_ret:
+      if (ins->b) fprintf(out, "  *ret = s[%d];\n  has_ret = 1;\n", top - 1);
+      fprintf(out, "  goto L%d;\n", chunk->n_code - 1);
+      return 1;
+
+    case op_leave:
+      if (chunk->n_defers && !emit_defers(out, chunk)) return 0;
+
+      if (chunk->sig->memo)
+        fprintf(out, "  if (has_ret) memo_put(&m_%s, key, %d, ret);\n",
+                chunk->sig->func, chunk->n_args);
+      fprintf(out, "  rt_depth--;\n");
+      fprintf(out, "  return has_ret && !discard;\n");
+      return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * Functions take their args in args and return 1 if they left a value in ret.
+ * ret may alias args.
+ */
+static int emit_func(FILE *out, const chunk_t *chunk) {
+  int depth[chunk->n_code + 1];
+  unsigned char target[chunk->n_code + 1];
+  const int max = chunk_depths(chunk, depth, target);
+  if (max < 0) return 0;
+
+  /**
+   * op_ret jumps to op_leave, a self tail call to the top. Labels, args, ret
+   * and slots nothing refers to are left out or cast to void, so that the C
+   * builds without warnings.
+   */
+  int self = 0, used_args = chunk->n_args || chunk->sig->memo != NULL;
+  int used_ret = chunk->sig->memo != NULL, used_slots = 0;
+  for (unsigned int i = 0; i < chunk->n_defers; i++) {
+    const defer_site_t *ds = &chunk->defers[i];
+    for (unsigned int k = 0; k < chunk->calls[ds->call].argc; k++)
+      if (ds->args[k] >= 0) used_slots = 1;
+  }
+
+  for (unsigned int i = 0; i < chunk->n_code; i++) {
+    const instr_t *ins = &chunk->code[i];
+    if (ins->op == op_ret) target[chunk->n_code - 1] = 1;
+    if (ins->op == op_ret && ins->b) used_ret = 1;
+    if (ins->op == op_load || ins->op == op_inc || ins->op == op_dec ||
+        ins->op == op_read)
+      used_slots = 1;
+    if (!is_tail(chunk, ins)) continue;
+
+    if (chunk->calls[ins->a].sig == chunk->sig) self = 1;
+    if (chunk->n_defers) target[i + 1] = 1;
+  }
+
+  const char *func = chunk->sig->func;
+  if (chunk->sig->memo) fprintf(out, "\nstatic memo_t m_%s;\n", func);
+
+  fprintf(out, "\nint f_%s(value_t *args, value_t *ret) {\n", func);
+  if (chunk->n_slots) fprintf(out, "  value_t v[%d];\n", chunk->n_slots);
+  /* A bare call still leaves room for a result. */
+  fprintf(out, "  value_t s[%d];\n", max + 1);
+  fprintf(out, "  int has_ret = 0, discard = 0;\n");
+  if (chunk->n_defers) fprintf(out, "  rt_defers_t defers = {NULL, 0, 0};\n");
+
+  /* The args are saved as the key before the slots change. */
+  if (chunk->sig->memo) {
+    fprintf(out, "  value_t key[%d];\n", chunk->n_args + 1);
+    fprintf(out, "\n  if (memo_get(&m_%s, args, %d, ret)) return 1;\n", func,
+            chunk->n_args);
+    fprintf(out, "  memcpy(key, args, %d * sizeof(value_t));\n",
+            chunk->n_args);
+  }
+
+  if (!used_args) fprintf(out, "  (void)args;\n");
+  if (!used_ret) fprintf(out, "  (void)ret;\n");
+  if (chunk->n_slots && !used_slots) fprintf(out, "  (void)v;\n");
+
+  fprintf(out, "\n  rt_enter();\n");
+  if (chunk->n_args)
+    fprintf(out, "  memcpy(v, args, %d * sizeof(value_t));\n", chunk->n_args);
+  if (self) fprintf(out, "\ntop:\n");
+
+  for (unsigned int i = 0; i < chunk->n_code; i++) {
+    if (target[i]) fprintf(out, "L%d:\n", i);
+    if (!emit_instr(out, chunk, i, depth[i])) return 0;
+  }
+
+  fprintf(out, "}\n");
+  return 1;
+}
+
+int emit_c(symtbl_t *symtbl, const char *path, FILE *out) {
+  const fsig_t *entry = get_fsig(symtbl, "main");
+  if (!entry) {
+    fprintf(stderr, "emit.c: missing main()\n");
+    return 0;
+  }
+
+  /* Top-level decls only run on the engines, before main. */
+  if (symtbl->init) {
+    fprintf(stderr, "emit.c: top-level decls can't be translated to C\n");
+    return 0;
+  }
+
+  /* Bodies are compiled lazily, every one of them is needed up front. */
+  for (node_t *n = symtbl->fsigs->head; n; n = n->next) {
+    fsig_t *sig = n->data;
+    if (!load_body(sig, symtbl)) return 0;
+
+    if (!compile_func(sig, symtbl)) {
+      fprintf(stderr, "emit.c: %s() can't be translated to C\n", sig->func);
+      return 0;
+    }
+  }
+
+  /* Nothing is written to out unless every function is translated. */
+  char *funcs = NULL;
+  size_t size = 0;
+  FILE *buf = open_memstream(&funcs, &size);
+  if (!buf) {
+    fprintf(stderr, "emit.c: could not buffer the translation\n");
+    return 0;
+  }
+
+  for (node_t *n = symtbl->fsigs->head; n; n = n->next) {
+    const fsig_t *sig = n->data;
+    if (!emit_func(buf, sig->chunk)) {
+      fprintf(stderr, "emit.c: %s() can't be translated to C\n", sig->func);
+      fclose(buf);
+      free(funcs);
+      return 0;
+    }
+  }
+
+  fclose(buf);
+
+  fprintf(out, "/* Translated from %s by cherry --emit-c. */\n\n", path);
+  fprintf(out, "#include <string.h>\n\n#include \"rt.h\"\n\n");
+
+  for (node_t *n = symtbl->fsigs->head; n; n = n->next)
+    fprintf(out, "int f_%s(value_t *args, value_t *ret);\n",
+            ((fsig_t *)n->data)->func);
+
+  fwrite(funcs, 1, size, out);
+  free(funcs);
+
+  const chunk_t *main = entry->chunk;
+  fprintf(out, "\nint main(void) {\n");
+  fprintf(out, "  value_t args[%d];\n", main->n_args + 1);
+  fprintf(out, "  memset(args, 0, sizeof args);\n\n");
+  fprintf(out, "  rt_init();\n  rt_call(f_main, args, args);\n");
+  fprintf(out, "  return rt_exit();\n}\n");
+  return 1;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "symtbl.h"
+
+/* Writes the program whose functions are in symtbl (read from path) as C. */
+int emit_c(symtbl_t *symtbl, const char *path, FILE *out);
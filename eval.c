@@ -1,34 +1,51 @@
 #include "eval.h"
 
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "ast.h"
 #include "builtin.h"
+#include "closure.h"
+#include "compile.h"
 #include "expr.h"
+#include "jit.h"
+#include "memo.h"
+#include "num.h"
+#include "par.h"
 #include "token.h"
 #include "util.h"
+#include "vm.h"
 
-int lno = 0, warns = 0;
+_Thread_local int lno = 0;
 
-return_node_t *get_fretval(eval_t *eval, const func_node_t *fnode);
-int eval_node(const ast_node_t *node, eval_t *eval);
-char *resolve_indx(const indx_node_t *ixnode, const symtbl_t *symtbl);
-token_t *resolve_var(const symtbl_t *symtbl, const char *sym);
+static const value_t *result_of(const func_node_t *fnode);
+static char *cut(const char *s, const double beg, double end,
+                 const unsigned int schar);
+char *resolve_indx(const indx_node_t *ixnode, const eval_t *eval);
+int eval_print(const ast_node_t *node, eval_t *eval);
+int eval_read(const ast_node_t *node, eval_t *eval);
+int eval_return(const ast_node_t *node, eval_t *eval);
+int eval_unary(const ast_node_t *node, eval_t *eval,
+               const unsigned int unary_type);
 
 eval_t *init_eval(void) {
   eval_t *eval = alloc(sizeof(eval_t));
   assert(eval);
 
   eval->depth = 0;
+  eval->engine = engine_tree;
   eval->tbl = init_symtbl();
+  eval->max_depth = DEFAULT_MAX_DEPTH;
+  eval->jit = 0;
   return eval;
 }
 
 /**
- * Do not resolve and over-write "buf" and "buf_type", rather return the
- * resolved value.
+ * Do not resolve and over-write "buf" and "buf_type", rather store the
+ * resolved value in val.
  *
  * Example -
  * Consider this situation:
@@ -41,109 +58,97 @@ eval_t *init_eval(void) {
  * If we resolve the lb & ub in the indx (when i = 0), we won't be able to
  * resolve it again for i = 1, 2, 3.. as "buf_type" is modified directly. In
  * that case lb & ub do not change with each iteration.
+ *
+ * Numbers are stored in val itself, so nothing is allocated unless a function
+ * is called or a string is sliced.
  */
-token_t *resolve(void *buf, const unsigned int buf_type, const eval_t *eval) {
+int resolve(void *buf, const unsigned int buf_type, const eval_t *eval,
+            value_t *val) {
   if (buf_type == exprtree) {
-    token_t *res = eval_exprtree(buf, eval->tbl);
-    if (!res) return 0;
-
-    return res;
+    eval_exprtree(buf, eval->tbl, val);
+    return 1;
   }
 
+  /* Calls in operands are made before the statement runs, see step(). */
   if (buf_type == fretval) {
-    return_node_t *fresult = get_fretval((eval_t *)eval, buf);
-    if (!fresult) return 0;
-
-    token_t *r = alloc(sizeof(token_t));
-    r->tk = fresult->val;
-    r->type = fresult->type;
+    const value_t *res = result_of(buf);
+    if (!res) {
+      fprintf(stderr, "eval.c: %s() was not called\n",
+              ((func_node_t *)buf)->func);
+      return 0;
+    }
 
-    return r;
+    *val = *res;
+    return 1;
   }
 
-  if (buf_type == identifier) return resolve_var(eval->tbl, buf);
+  if (buf_type == identifier) {
+    entry_t *e = get_symentry(eval->tbl, buf);
+    if (!e) {
+      fprintf(stderr, "eval.c: missing decl for sym [%s]\n", (char *)buf);
+      return 0;
+    }
+
+    const token_t tk = {e->val, e->vtype};
+    *val = to_value(&tk);
+    return 1;
+  }
 
   if (buf_type == indx) {
-    indx_node_t *ixnode = buf;
-    char *s = resolve_indx(ixnode, eval->tbl);
+    char *s = resolve_indx(buf, eval);
     if (!s) return 0;
 
-    token_t *r = alloc(sizeof(token_t));
-    r->tk = s;
-    r->type = string;
-    return r;
+    val->type = string;
+    val->as.p = s;
+    return 1;
   }
 
-  /* No need to resolve, so return buf & buf_type */
-  token_t *t = alloc(sizeof(token_t));
-  t->tk = buf;
-  t->type = buf_type;
-
-  return t;
+  /* No need to resolve, buf is the value. */
+  const token_t tk = {buf, buf_type};
+  *val = to_value(&tk);
+  return 1;
 }
 
-char *resolve_indx(const indx_node_t *ixnode, const symtbl_t *symtbl) {
+char *resolve_indx(const indx_node_t *ixnode, const eval_t *eval) {
   assert(ixnode->ltype != -1 && ixnode->rtype != -1);
 
-  token_t *arg = ixnode->arg;
-  if (arg->type == identifier) {
-    arg = resolve_var(symtbl, arg->tk);
-    if (!arg) return 0;
-  }
-
-  if (arg->type != string) {
-    fprintf(stderr, "eval.c: indexer cannot be applied to non-string\n");
+  /* The arg of a slice that opt.c proved to be in range is a literal. */
+  value_t arg, lb = {none, {0}}, ub = {none, {0}};
+  if (!ixnode->in_range &&
+      !resolve(ixnode->arg->tk, ixnode->arg->type, eval, &arg))
+    return NULL;
+  if (ixnode->beg && !resolve(ixnode->beg, ixnode->ltype, eval, &lb))
+    return NULL;
+  if (ixnode->end && !resolve(ixnode->end, ixnode->rtype, eval, &ub))
     return NULL;
-  }
-
-  void *lb, *ub;
-  unsigned int ltype, rtype;
-
-  if (ixnode->ltype == exprtree) {
-    token_t *t = eval_exprtree(ixnode->beg, symtbl);
-    lb = t->tk;
-    ltype = t->type;
-  } else if (ixnode->ltype == identifier) {
-    token_t *t = resolve_var(symtbl, ixnode->beg);
-    if (!t) return NULL;
-
-    lb = t->tk;
-    ltype = t->type;
-  } else {
-    lb = ixnode->beg;
-    ltype = ixnode->ltype;
-  }
 
-  if (ixnode->rtype == exprtree) {
-    token_t *t = eval_exprtree(ixnode->end, symtbl);
-    ub = t->tk;
-    rtype = t->type;
-  } else if (ixnode->rtype == identifier) {
-    token_t *t = resolve_var(symtbl, ixnode->end);
-    if (!t) return NULL;
+  if (ixnode->in_range)
+    return slice_in_range(ixnode->arg->tk, ixnode->len,
+                          ixnode->beg ? &lb : NULL, ixnode->end ? &ub : NULL,
+                          ixnode->schar);
 
-    ub = t->tk;
-    rtype = t->type;
-  } else {
-    ub = ixnode->end;
-    rtype = ixnode->rtype;
-  }
+  /* types.c found arg to be a string and the bounds numbers. */
+  if (ixnode->typed)
+    return cut(arg.as.p, ixnode->beg ? value_double(&lb) : +0,
+               ixnode->end ? value_double(&ub) : HUGE_VAL, ixnode->schar);
 
-  if ((lb && ltype != numeric) || (ub && rtype != numeric)) {
-    fprintf(stderr, "eval.c: indexer bounds must be numeric\n");
-    return NULL;
-  }
+  const token_t atk = value_token(&arg);
+  const token_t ltk = value_token(&lb), rtk = value_token(&ub);
+  return slice(&atk, ixnode->beg ? &ltk : NULL, ixnode->end ? &rtk : NULL,
+               ixnode->schar);
+}
 
-  double ubl = strlen((char *)arg->tk);
-  double beg = lb ? *(double *)lb : +0;
-  double end = ub ? *(double *)ub : ubl;
-  end = ixnode->schar ? beg + 1 : end;
+/* Returns s[beg:end] (or s[beg] if schar is set), end is clamped to s. */
+static char *cut(const char *s, const double beg, double end,
+                 const unsigned int schar) {
+  double ubl = strlen(s);
+  end = schar ? beg + 1 : end;
 
   if (end >= ubl) end = ubl;
 
   /* TODO: Better simplify this. */
   if (beg < 0 || end < 0 || end < beg || beg > ubl || end > ubl ||
-      (ixnode->schar && beg >= ubl)) {
+      (schar && beg >= ubl)) {
     fprintf(stderr,
             "eval.c: invalid indexer bounds; beg -> [%g] & end -> [%g]\n", beg,
             end);
@@ -151,30 +156,51 @@ char *resolve_indx(const indx_node_t *ixnode, const symtbl_t *symtbl) {
   }
 
   /* This part here does the magic - slicing */
-  char *s = alloc(end - beg + 1);
-  void *ptr = arg->tk;
-  for (double i = 0; i < beg; i++) ptr++;
+  const unsigned long lo = beg, len = end - beg;
+  char *res = alloc(len + 1);
 
-  memcpy(s, ptr, (end - beg) * sizeof(char));
-  strcat(s, "\0");
+  memcpy(res, s + lo, len * sizeof(char));
+  res[len] = '\0';
 
-  return s;
+  return res;
 }
 
-token_t *resolve_var(const symtbl_t *symtbl, const char *sym) {
-  if (!symtbl) return NULL;
-  entry_t *e = get_symentry(symtbl, sym);
-  if (!e) return NULL;
+/**
+ * Returns arg[lb:ub] (or arg[lb] if schar is set) as a new string. lb and ub
+ * are NULL if they weren't specified.
+ */
+char *slice(const token_t *arg, const token_t *lb, const token_t *ub,
+            const unsigned int schar) {
+  if (arg->type != string) {
+    fprintf(stderr, "eval.c: indexer cannot be applied to non-string\n");
+    return NULL;
+  }
 
-  token_t *tk = alloc(sizeof(token_t));
-  tk->tk = e->val;
-  tk->type = e->vtype;
+  if ((lb && !is_num(lb->type)) || (ub && !is_num(ub->type))) {
+    fprintf(stderr, "eval.c: indexer bounds must be numeric\n");
+    return NULL;
+  }
 
-  return tk;
+  return cut(arg->tk, lb ? to_double(lb) : +0, ub ? to_double(ub) : HUGE_VAL,
+             schar);
+}
+
+char *slice_in_range(const char *arg, const unsigned long len,
+                     const value_t *lb, const value_t *ub,
+                     const unsigned int schar) {
+  const unsigned long lo = lb ? lb->as.i : 0;
+  unsigned long hi = schar ? lo + 1 : ub ? ub->as.i : len;
+  if (hi > len) hi = len;
+
+  char *s = alloc(hi - lo + 1);
+  memcpy(s, arg + lo, hi - lo);
+  s[hi - lo] = '\0';
+  return s;
 }
 
 int compare(const token_t *lhs, const token_t *rhs, const char *op) {
-  if (lhs->type != rhs->type && (lhs->type != none && rhs->type != none)) {
+  if (lhs->type != rhs->type && (lhs->type != none && rhs->type != none) &&
+      !(is_num(lhs->type) && is_num(rhs->type))) {
     fprintf(stderr,
             "eval.c: cannot compare for diff vals of [l/r]types in l[%d]\n",
             lno);
@@ -184,9 +210,28 @@ int compare(const token_t *lhs, const token_t *rhs, const char *op) {
   if (lhs->type == none) return rhs->tk == NULL;
   if (rhs->type == none) return lhs->tk == NULL;
 
-  if (lhs->type == numeric) {
-    double a = *(double *)lhs->tk;
-    double b = *(double *)rhs->tk;
+  /* Two integers compare exactly, anything else compares as doubles. */
+  if (lhs->type == integer && rhs->type == integer) {
+    long long a = *(long long *)lhs->tk;
+    long long b = *(long long *)rhs->tk;
+
+    if (!strcmp(op, "<"))
+      return a < b;
+    else if (!strcmp(op, "<="))
+      return a <= b;
+    else if (!strcmp(op, "=="))
+      return a == b;
+    else if (!strcmp(op, "!="))
+      return a != b;
+    else if (!strcmp(op, ">"))
+      return a > b;
+    else if (!strcmp(op, ">="))
+      return a >= b;
+  }
+
+  if (is_num(lhs->type)) {
+    double a = to_double(lhs);
+    double b = to_double(rhs);
 
     if (!strcmp(op, "<"))
       return a < b;
@@ -223,280 +268,809 @@ int compare(const token_t *lhs, const token_t *rhs, const char *op) {
   return -1;
 }
 
+/* What op says of lhs & rhs, given whether lhs is less than/equal to rhs. */
+static int test(const int lt, const int eq, const char *op) {
+  switch (op[0]) {
+    case '<':
+      return op[1] ? lt || eq : lt;
+    case '>':
+      return op[1] ? !lt : !lt && !eq;
+    case '=':
+      return eq;
+    case '!':
+      return !eq;
+  }
+
+  return -1;
+}
+
 int eval_cond(const ast_node_t *node, const eval_t *eval) {
   cnode_t *cnode = node->ch;
 
-  token_t *lhs = resolve(cnode->lhs, cnode->ltype, eval);
-  token_t *rhs = resolve(cnode->rhs, cnode->rtype, eval);
+  value_t l, r;
+  if (!resolve(cnode->lhs, cnode->ltype, eval, &l) ||
+      !resolve(cnode->rhs, cnode->rtype, eval, &r))
+    return -1;
 
-  if (!lhs || !rhs) return -1;
-  return compare(lhs, rhs, cnode->op);
+  /* types.c found both operands to have the type compare() would check. */
+  switch (cnode->type) {
+    case integer:
+      return test(l.as.i < r.as.i, l.as.i == r.as.i, cnode->op);
+    case numeric: {
+      const double a = value_double(&l), b = value_double(&r);
+      if (a != a || b != b) return cnode->op[0] == '!';
+      return test(a < b, a == b, cnode->op);
+    }
+    case string: {
+      const int c = strcmp(l.as.p, r.as.p);
+      return test(c < 0, c == 0, cnode->op);
+    }
+  }
+
+  const token_t lhs = value_token(&l), rhs = value_token(&r);
+  return compare(&lhs, &rhs, cnode->op);
 }
 
 int eval_decl(const ast_node_t *node, eval_t *eval) {
   decl_node_t *dnode = node->ch;
 
-  token_t *rhs = resolve(dnode->rhs, dnode->rtype, eval);
-  return register_sym(eval->tbl, dnode->lhs, rhs->tk, rhs->type,
+  value_t val;
+  if (!resolve(dnode->rhs, dnode->rtype, eval, &val)) return 0;
+
+  /* register_sym() copies numbers into the entry. */
+  const token_t rhs = value_token(&val);
+  return register_sym(eval->tbl, dnode->lhs, rhs.tk, rhs.type,
                       dnode->is_const);
 }
 
-int eval_func(eval_t *eval, const char *func, const func_node_t *fnode) {
-  if (!eval) return 0;
+/* Evaluates the args of fnode into args, fnode itself is left untouched. */
+int eval_args(const eval_t *eval, const func_node_t *fnode, value_t *args) {
+  unsigned int i = 0;
+  for (node_t *arg = fnode->args->head; arg; arg = arg->next, i++) {
+    token_t *tk = arg->data;
+    if (!resolve(tk->tk, tk->type, eval, &args[i])) return 0;
+  }
 
-  fsig_t *sig = get_fsig(eval->tbl, func);
-  if (!sig) {
-    if (fnode) return eval_builtin(fnode, eval->tbl);
+  return 1;
+}
 
-    /* At this point, sig is NULL and the func is not a builtin. */
-    fprintf(stderr, "eval.c: could not call %s()\n", func);
-    cleanup();
-    _Exit(1);
-  }
+/**
+ * The tree-walker doesn't recurse in C. A call pushes an activation onto acts
+ * and every if/for body that is entered pushes a block onto blocks. run() steps
+ * through the top activation until the one it was started with returns. Calls
+ * made by the operands of a statement (e.g, var x = f(a)) are made first, one
+ * at a time, and their results are kept on results until the statement runs.
+ */
+typedef struct block {
+  /* The if/for the block belongs to, NULL for the body of the function. */
+  const ast_node_t *owner;
+  const node_t *next;
+  /* Value of the var & the bound of a counted for (see cnode_t.step). */
+  long long *ctr, bound;
+} block_t;
+
+typedef struct result {
+  const func_node_t *fnode;
+  value_t val;
+} result_t;
+
+/* What the caller of an activation does with what it returns. */
+enum { cont_host, cont_operand, cont_discard };
+
+typedef struct act {
+  fsig_t *sig;
+  /* The call that pushed the activation, NULL if it was pushed by eval_call. */
+  const func_node_t *fnode;
+  unsigned int block_base, result_base;
+  /* discard is set once the activation is reused by a bare tail call. */
+  unsigned char cont, leaving, discard, has_ret;
+  value_t ret;
+  /* Where the args were saved if sig is memoized, see memo_enter(). */
+  unsigned int memo;
+} act_t;
+
+static act_t *acts = NULL;
+static unsigned int n_acts = 0, cap_acts = 0;
+
+static block_t *blocks = NULL;
+static unsigned int n_blocks = 0, cap_blocks = 0;
+
+static result_t *results = NULL;
+static unsigned int n_results = 0, cap_results = 0;
+
+/* Returns the result of fnode if it was called for the current statement. */
+static const value_t *result_of(const func_node_t *fnode) {
+  if (!n_acts) return NULL;
+
+  for (unsigned int i = acts[n_acts - 1].result_base; i < n_results; i++)
+    if (results[i].fnode == fnode) return &results[i].val;
+
+  return NULL;
+}
 
-  if (!strcmp(func, "main")) {
-    assert(init_frame(eval->tbl));
-    goto skipargs_init;
+/* Returns the first call in the operand buf that wasn't made yet, if any. */
+static const func_node_t *pending_call(const void *buf,
+                                       const unsigned int type) {
+  if (type == fretval) return result_of(buf) ? NULL : buf;
+  if (type != indx) return NULL;
+
+  const indx_node_t *ixnode = buf;
+  const func_node_t *fnode =
+      ixnode->beg ? pending_call(ixnode->beg, ixnode->ltype) : NULL;
+  if (fnode || !ixnode->end) return fnode;
+
+  return pending_call(ixnode->end, ixnode->rtype);
+}
+
+/* Same as pending_call(), for the operands of node in the order of eval. */
+static const func_node_t *pending_calls(const ast_node_t *node) {
+  switch (node->type) {
+    case cond:
+    case floop: {
+      const cnode_t *cnode = node->ch;
+      const func_node_t *fnode = pending_call(cnode->lhs, cnode->ltype);
+      return fnode ? fnode : pending_call(cnode->rhs, cnode->rtype);
+    }
+
+    case vdecl: {
+      const decl_node_t *dnode = node->ch;
+      return pending_call(dnode->rhs, dnode->rtype);
+    }
+
+    case cout: {
+      const print_node_t *pnode = node->ch;
+      return pending_call(pnode->arg, pnode->type);
+    }
+
+    case rettype: {
+      const return_node_t *rnode = node->ch;
+      return rnode->val ? pending_call(rnode->val, rnode->type) : NULL;
+    }
+
+    case pfloop: {
+      const pfor_node_t *pnode = node->ch;
+      const func_node_t *fnode = pending_call(pnode->beg, pnode->btype);
+      return fnode ? fnode : pending_call(pnode->end, pnode->etype);
+    }
   }
 
-  if (!fnode) goto skipargs_init;
-  const int k_required = sig->args->size;
-  const int k_have = fnode->args->size;
+  return NULL;
+}
+
+static int push_result(const func_node_t *fnode, const value_t *val) {
+  results = grow(results, &cap_results, n_results, sizeof(result_t));
+  results[n_results].fnode = fnode;
+  results[n_results++].val = *val;
+  return 1;
+}
+
+static int push_block(const ast_node_t *owner, const node_t *next) {
+  blocks = grow(blocks, &cap_blocks, n_blocks, sizeof(block_t));
+  blocks[n_blocks].owner = owner;
+  blocks[n_blocks].next = next;
+  blocks[n_blocks++].ctr = NULL;
+  return 1;
+}
+
+static int leave_scope(eval_t *eval) {
+  eval->depth--;
+  eval->tbl->depth = eval->depth;
+  return scope_cleanup(eval->tbl);
+}
+
+/* Pops the blocks of act, the scope of each if/for body ends with it. */
+static void leave_blocks(eval_t *eval, const act_t *act) {
+  while (n_blocks > act->block_base)
+    if (blocks[--n_blocks].owner) leave_scope(eval);
+}
 
-  if (k_required != k_have) {
-    fprintf(stderr, "eval.c: %s() requires [%d] args, got [%d]\n", func,
-            k_required, k_have);
+static int push_act(eval_t *eval, fsig_t *sig, const func_node_t *fnode,
+                    value_t *args, const unsigned int argc,
+                    const unsigned char cont) {
+  if (n_acts >= eval->max_depth) {
+    fprintf(stderr, "eval.c: stack depth exceeded at L[%d]\n", lno);
     return 0;
   }
 
-  if (!init_funcargs(eval->tbl, sig->args, fnode->args)) return 0;
-
-skipargs_init:;
-  /* TODO: move to global scope */
-  assert(init_globals(eval->tbl));
-
-  for (node_t *node = ((ast_node_t *)(sig->node))->lch->head; node;
-       node = node->next) {
-    const int ntype = ((ast_node_t *)(node->data))->type;
-    int res = eval_node(node->data, eval);
-
-    /**
-     * eval_xxx() return -
-     * +1 - all ok
-     * +0 - err, but if/for return 0 if condition fails, for return 0 is okay
-     *      because if we returned 1, we couldn't halt.
-     * -1 - err, for return.
-     */
-    if (res <= 0) {
-      if ((ntype == cond || ntype == floop || ntype == rettype) && res == 0) {
-        /* TODO: recursion fix (bug!) */
-        if (node->next && warns)
-          fprintf(stderr, "eval.c: unreachable code in %s()\n", func);
-        break;
-      } else
-        /* -ve return value, always an err */
-        return 0;
+  /* Calls were checked to pass as many args as sig takes when linked. */
+  if (!strcmp(sig->func, "main")) {
+    assert(init_frame(eval->tbl));
+  } else {
+    /* A memoized call made before returns right away. */
+    value_t val;
+    if (sig->memo && memo_get(sig->memo, args, argc, &val)) {
+      if (cont == cont_host) set_ret(eval->tbl, &val);
+      return cont == cont_operand ? push_result(fnode, &val) : 1;
     }
+
+    if (!init_funcargs(eval->tbl, sig->args, args)) return 0;
   }
 
-  /* Evaluate deferred functions. */
-  frame_t *lframe = peek_last(eval->tbl->frames);
-  func_node_t *dfnode =
-      lframe->defer_stack->size != 0 ? pop_last(lframe->defer_stack) : NULL;
-  while (dfnode) {
-    if (!eval_func(eval, dfnode->func, dfnode)) return 0;
+  acts = grow(acts, &cap_acts, n_acts, sizeof(act_t));
+  act_t *act = &acts[n_acts++];
+  act->sig = sig;
+  act->fnode = fnode;
+  act->block_base = n_blocks;
+  act->result_base = n_results;
+  act->cont = cont;
+  act->leaving = act->discard = act->has_ret = 0;
+  act->memo = sig->memo ? memo_enter(args, argc) : 0;
+
+  return push_block(NULL, ((ast_node_t *)sig->node)->lch->head);
+}
 
-    dfnode =
-        lframe->defer_stack->size != 0 ? pop_last(lframe->defer_stack) : NULL;
+/* A call failed before an activation was pushed for it. */
+static int call_failed(const func_node_t *fnode, const unsigned char cont) {
+  if (cont == cont_host) return 0;
+
+  fprintf(stderr, "eval.c: could not call %s()\n", fnode->func);
+  if (cont == cont_discard) {
+    cleanup();
+    _Exit(1);
   }
 
-  return pop_frame(eval->tbl);
+  return 0;
 }
 
-return_node_t *get_fretval(eval_t *eval, const func_node_t *fnode) {
-  const unsigned int before = eval->tbl->retstack->size;
-  if (!eval_func(eval, fnode->func, fnode)) {
-    fprintf(stderr, "eval.c: could not call %s()\n", fnode->func);
-    return 0;
+/**
+ * Makes the call fnode from the top activation. Builtins and functions that
+ * run on the other engines return right away, their result is handed over as
+ * cont says. Otherwise an activation is pushed for the callee.
+ */
+static int call(eval_t *eval, const func_node_t *fnode,
+                const unsigned char cont) {
+  fsig_t *sig = fnode->sig;
+  const unsigned int argc = fnode->args->size;
+
+  eval->tbl->has_ret = 0;
+  if (sig) {
+    if (!load_body(sig, eval->tbl)) {
+      lno = load_lno;
+      return 0;
+    }
+
+    int res = -1;
+    if (eval->engine == engine_vm) res = vm_call(eval, sig, fnode);
+    if (eval->engine == engine_closure) res = closure_call(eval, sig, fnode);
+
+    if (res < 0) {
+      value_t args[argc + 1];
+      if (!eval_args(eval, fnode, args)) return 0;
+
+      res = jit_call(eval, sig, args, argc);
+      if (res < 0) return push_act(eval, sig, fnode, args, argc, cont);
+    }
+
+    /* The engine that ran it has reported the error already. */
+    if (!res) return 0;
+  } else {
+    value_t args[argc + 1];
+    token_t tks[argc + 1];
+    const token_t *fargs[argc + 1];
+    if (!eval_args(eval, fnode, args)) return 0;
+
+    for (unsigned int i = 0; i < argc; i++) {
+      tks[i] = value_token(&args[i]);
+      fargs[i] = &tks[i];
+    }
+
+    /* types.c found the args to fit, the checks of call_builtin() can go. */
+    const builtin_t *builtin = fnode->builtin;
+    const int ok = fnode->typed ? builtin->fptr(fargs, eval->tbl, argc)
+                                : call_builtin(builtin, fargs, argc, eval->tbl);
+    if (!ok) return call_failed(fnode, cont);
   }
 
-  if (eval->tbl->retstack->size == before) {
+  value_t val;
+  const int has_ret = take_ret(eval->tbl, &val);
+  if (cont != cont_operand) return 1;
+
+  if (!has_ret) {
     fprintf(stderr, "eval.c: %s() did not return anything\n", fnode->func);
-    return NULL;
+    return 0;
   }
 
-  return pop_last(eval->tbl->retstack);
+  return push_result(fnode, &val);
 }
 
-int eval_print(const ast_node_t *node, eval_t *eval) {
-  print_node_t *pnode = node->ch;
-  token_t *arg = resolve(pnode->arg, pnode->type, eval);
-  if (!arg) return 0;
+/**
+ * Calls in tail position (see link_block()) reuse the activation and frame of
+ * the caller. Calls made while deferred calls are pending are made as usual,
+ * as those must run after the callee returns. Returns 1 if the call was made,
+ * 0 if it has to be made as usual and -1 on error.
+ */
+static int tail_call(eval_t *eval, const func_node_t *fnode, const int bare) {
+  fsig_t *sig = fnode->sig;
+  if (!fnode->tail || result_of(fnode)) return 0;
+
+  /* Callees that run on the other engines or natively are called as usual. */
+  if (sig->native) return 0;
+  if (eval->engine == engine_vm && !sig->no_chunk) return 0;
+  if (eval->engine == engine_closure && !sig->no_closure) return 0;
+
+  if (eval->tbl->frame->defer_stack->size != 0) return 0;
+  if (!load_body(sig, eval->tbl)) {
+    lno = load_lno;
+    return -1;
+  }
 
-  if (arg->type != numeric)
-    printf("'%s'\n", (char *)arg->tk);
-  else
-    printf("%g\n", *(double *)arg->tk);
+  /* So are memoized ones, their result is recorded once they return. */
+  if (sig->memo) return 0;
 
-  return 1;
+  const unsigned int argc = fnode->args->size;
+  value_t args[argc + 1];
+  if (!eval_args(eval, fnode, args)) return -1;
+
+  act_t *act = &acts[n_acts - 1];
+  leave_blocks(eval, act);
+  if (!reuse_frame(eval->tbl, sig->args, args)) return -1;
+
+  act->sig = sig;
+  act->discard |= bare;
+  n_results = act->result_base;
+  return push_block(NULL, ((ast_node_t *)sig->node)->lch->head);
 }
 
-int eval_read(const ast_node_t *node, eval_t *eval) {
-  read_node_t *rnode = node->ch;
-  char *buf = alloc(512);
-  memset(buf, 0, 512);
+/**
+ * A counted for whose var & bound are integers as it's entered keeps its count
+ * in b - the step adds to the entry of the var in place and the condition is
+ * tested on it directly. Anything else runs as usual.
+ */
+static void count(const eval_t *eval, block_t *b) {
+  const cnode_t *cnode = b->owner->ch;
+  entry_t *e = get_symentry(eval->tbl, cnode->lhs);
+  if (!e || e->is_const || e->vtype != integer) return;
 
-  scanf("%s", buf);
-  return register_sym(eval->tbl, rnode->arg, buf, string, 0);
+  value_t bound;
+  if (!resolve(cnode->rhs, cnode->rtype, eval, &bound)) return;
+  if (bound.type != integer) return;
+
+  b->ctr = e->val;
+  b->bound = bound.as.i;
 }
 
-int eval_return(const ast_node_t *node, eval_t *eval) {
-  return_node_t *rnode = node->ch;
-  if (!rnode->val) return 0;
+/* Evaluates the condition of an if/for and enters its body (or else). */
+static int enter_block(const ast_node_t *node, eval_t *eval) {
+  const cnode_t *cnode = node->ch;
+  const int res = eval_cond(node, eval);
+  if (res < 0) {
+    fprintf(stderr, "eval.c: could not eval if\n");
+    return 0;
+  }
 
-  token_t *arg = resolve(rnode->val, rnode->type, eval);
-  if (!arg) {
-    fprintf(stderr, "eval.c: could not execute return\n");
-    return -1;
+  if (!res && node->type == floop) return 1;
+
+  eval->depth++;
+  eval->tbl->depth = eval->depth;
+  if (!push_block(node, res ? node->lch->head : node->rch->head)) return 0;
+
+  if (node->type == floop && cnode->step) count(eval, &blocks[n_blocks - 1]);
+  return 1;
+}
+
+/**
+ * The end of a block - the body of a for runs again if its condition still
+ * holds, the end of the body of the function returns.
+ */
+static int end_block(eval_t *eval) {
+  act_t *act = &acts[n_acts - 1];
+  block_t *b = &blocks[n_blocks - 1];
+
+  if (!b->owner) {
+    act->leaving = 1;
+    return 1;
   }
 
-  rnode->val = arg->tk;
-  rnode->type = arg->type;
+  if (b->owner->type == floop && b->ctr) {
+    const char *op = ((cnode_t *)b->owner->ch)->op;
+    if (test(*b->ctr < b->bound, *b->ctr == b->bound, op) > 0) {
+      b->next = b->owner->lch->head;
+      return 1;
+    }
+  } else if (b->owner->type == floop) {
+    const func_node_t *fnode = pending_calls(b->owner);
+    if (fnode) return call(eval, fnode, cont_operand);
+
+    const int res = eval_cond(b->owner, eval);
+    n_results = act->result_base;
+    if (res < 0) {
+      fprintf(stderr, "eval.c: could not eval if\n");
+      return 0;
+    }
 
-  if (!add(eval->tbl->retstack, rnode)) return -1;
-  return 0;
+    if (res) {
+      b->next = b->owner->lch->head;
+      return 1;
+    }
+  }
+
+  n_blocks--;
+  return leave_scope(eval);
 }
 
-int eval_unary(const ast_node_t *node, eval_t *eval,
-               const unsigned int unary_type) {
-  unary_node_t *unode = node->ch;
-  entry_t *e = get_symentry(eval->tbl, unode->arg);
+/**
+ * break & continue - the blocks of the ifs they're in end, and so does the body
+ * of the innermost for, scopes included. continue goes on to the condition of
+ * the for, as if the end of its body had been reached.
+ */
+static int jump(eval_t *eval, const ast_node_t *node) {
+  block_t *b = &blocks[n_blocks - 1];
+  while (b->owner && b->owner->type == cond) {
+    n_blocks--;
+    if (!leave_scope(eval)) return 0;
+    b = &blocks[n_blocks - 1];
+  }
 
-  if (!e) {
-    fprintf(stderr, "eval.c: missing decl for sym [%s]\n", unode->arg);
+  if (!b->owner) {
+    fprintf(stderr, "eval.c: %s is invalid outside of a for\n", node->kwd);
     return 0;
   }
 
-  if (e->vtype != numeric) {
-    fprintf(stderr, "eval.c: unary cannot be used on non-numeric types [%s]\n",
-            unode->arg);
+  if (node->type == fcontinue) {
+    b->next = NULL;
+    return 1;
+  }
+
+  n_blocks--;
+  return leave_scope(eval);
+}
+
+/* Runs a pfor on the pool, see par.c. Its bounds are evaled once. */
+static int eval_pfor(const ast_node_t *node, const eval_t *eval) {
+  const pfor_node_t *pnode = node->ch;
+
+  value_t beg, end;
+  if (!resolve(pnode->beg, pnode->btype, eval, &beg) ||
+      !resolve(pnode->end, pnode->etype, eval, &end))
+    return 0;
+
+  if (beg.type != integer || end.type != integer) {
+    fprintf(stderr, "eval.c: pfor bounds must be integers\n");
     return 0;
   }
 
-  switch (unary_type) {
-    case post_dec:
-      (*(double *)e->val) -= 1;
+  return par_for(eval->tbl, node, beg.as.i, end.as.i);
+}
+
+/* Runs the statement node of the top activation. */
+static int step(eval_t *eval, const ast_node_t *node) {
+  const func_node_t *tail = NULL;
+  if (node->type == fcall) tail = node->ch;
+  if (node->type == rettype && ((return_node_t *)node->ch)->type == fretval)
+    tail = ((return_node_t *)node->ch)->val;
+
+  if (tail) {
+    const int res = tail_call(eval, tail, node->type == fcall);
+    if (res) return res > 0;
+  }
+
+  /* The statement runs once every call in its operands was made. */
+  const func_node_t *fnode = pending_calls(node);
+  if (fnode) return call(eval, fnode, cont_operand);
+
+  act_t *act = &acts[n_acts - 1];
+  block_t *b = &blocks[n_blocks - 1];
+  b->next = b->next->next;
+
+  int res = 0;
+  switch (node->type) {
+    case cond:
+    case floop:
+      res = enter_block(node, eval);
       break;
+
+    case vdecl:
+      res = eval_decl(node, eval);
+      break;
+
+    case cin:
+      res = eval_read(node, eval);
+      break;
+
+    case cout:
+      res = eval_print(node, eval);
+      break;
+
+    case fcall:
+      return call(eval, node->ch, cont_discard);
+
+    case fdefer:
+      res = add(eval->tbl->frame->defer_stack, node->ch);
+      break;
+
+    case post_dec:
     case post_inc:
-      (*(double *)e->val) += 1;
+      if (b->ctr && node == ((cnode_t *)b->owner->ch)->step) {
+        const int step = node->type == post_inc ? 1 : -1;
+        *b->ctr = (unsigned long long)*b->ctr + step;
+        res = 1;
+        break;
+      }
+
+      res = eval_unary(node, eval, node->type);
       break;
-    default: {
-      fprintf(stderr, "eval.c: eval_unary() fail, invalid unary_type\n");
+
+    case rettype:
+      res = eval_return(node, eval);
+      break;
+
+    case fbreak:
+    case fcontinue:
+      res = jump(eval, node);
+      break;
+
+    case pfloop:
+      res = eval_pfor(node, eval);
+      break;
+
+    default:
+      fprintf(stderr, "eval.c: could not eval [%s]\n", node->kwd);
       return 0;
-    }
   }
 
-  return register_sym(eval->tbl, unode->arg, e->val, e->vtype, 0);
+  n_results = act->result_base;
+  return res;
 }
 
-int eval_node(const ast_node_t *node, eval_t *eval) {
-  lno = node->lno;
-  const char *kwd = node->kwd;
-
-  switch (node->type) {
-    case floop:
-    case cond: {
-      eval->depth++;
-      eval->tbl->depth = eval->depth;
-
-      int ccvars = 0;
-      if (((cnode_t *)(node->ch))->ltype != exprtree &&
-          ((cnode_t *)(node->ch))->ltype != fretval &&
-          ((cnode_t *)(node->ch))->rtype != exprtree &&
-          ((cnode_t *)(node->ch))->rtype != fretval && warns) {
-        ccvars = 1;
-        puts(
-            "eval.c: condition depends on values that don't change at runtime");
-      }
+/**
+ * Runs the deferred calls of the top activation one at a time, then pops it
+ * and hands what it returned to its caller.
+ */
+static int leave(eval_t *eval) {
+  act_t *act = &acts[n_acts - 1];
+  leave_blocks(eval, act);
+
+  list_t *defer_stack = eval->tbl->frame->defer_stack;
+  if (defer_stack->size != 0)
+    return call(eval, pop_last(defer_stack), cont_discard);
+
+  const act_t done = *act;
+  n_acts--;
+  n_results = done.result_base;
+  if (!pop_frame(eval->tbl)) return 0;
+
+  if (done.sig->memo)
+    memo_leave(done.sig->memo, done.memo, done.sig->args->size,
+               done.has_ret ? &done.ret : NULL);
+
+  const int has_ret = done.has_ret && !done.discard;
+  if (done.cont == cont_host) {
+    if (has_ret) set_ret(eval->tbl, &done.ret);
+  } else if (done.cont == cont_operand) {
+    if (!has_ret) {
+      fprintf(stderr, "eval.c: %s() did not return anything\n",
+              done.fnode->func);
+      return 0;
+    }
 
-    eval:;
-      const int evalres = eval_cond(node, eval);
-      if (evalres < 0) {
-        fprintf(stderr, "eval.c: could not eval if\n");
-        return 0;
-      }
+    return push_result(done.fnode, &done.ret);
+  }
 
-      if (evalres && ccvars && !strcmp(kwd, "for")) {
-        fprintf(stderr, "eval.c: for loop results in infinite loop\n");
-        return 0;
-      }
+  return 1;
+}
 
-      if (evalres == 0 && !strcmp(kwd, "for")) goto gquit;
-      node_t *ch = evalres == 1 ? node->lch->head : node->rch->head;
+/**
+ * Pops the activations down to entry after an error. Only the innermost call
+ * is reported, the stack may be max_depth deep.
+ */
+static void unwind(eval_t *eval, const unsigned int entry) {
+  if (n_acts <= entry) return;
 
-      for (; ch; ch = ch->next) {
-        int res = eval_node(ch->data, eval);
+  const act_t *top = &acts[n_acts - 1];
+  if (top->cont != cont_host)
+    fprintf(stderr, "eval.c: could not call %s()\n", top->fnode->func);
 
-        /**
-         * Anything > than 0 is okay. 0 & -ve vals mean there might be something
-         * wrong.
-         */
-        if (res <= 0) return res;
-      }
+  while (n_acts > entry) {
+    const act_t *act = &acts[n_acts - 1];
+    leave_blocks(eval, act);
+    pop_frame(eval->tbl);
 
-      if (!strcmp(kwd, "for")) goto eval;
+    n_acts--;
+    n_results = act->result_base;
+  }
+}
 
-    gquit:;
-      eval->depth--;
-      eval->tbl->depth = eval->depth;
-      if (!scope_cleanup(eval->tbl)) return 0;
+/* Runs the activations above entry until the one at entry returns. */
+static int run(eval_t *eval, const unsigned int entry) {
+  while (n_acts > entry) {
+    int res;
+
+    if (acts[n_acts - 1].leaving) {
+      res = leave(eval);
+    } else if (!blocks[n_blocks - 1].next) {
+      res = end_block(eval);
+    } else {
+      const ast_node_t *node = blocks[n_blocks - 1].next->data;
+      lno = node->lno;
+      res = step(eval, node);
+    }
 
-      return 1;
+    if (!res) {
+      unwind(eval, entry);
+      return 0;
     }
+  }
 
-    case vdecl:
-      return eval_decl(node, eval);
+  return 1;
+}
 
-    case cin:
-      return eval_read(node, eval);
+int eval_func(eval_t *eval, const char *func, const func_node_t *fnode) {
+  if (!eval) return 0;
 
-    case cout:
-      return eval_print(node, eval);
+  fsig_t *sig = fnode && fnode->sig ? fnode->sig : get_fsig(eval->tbl, func);
+  const unsigned int argc = fnode ? fnode->args->size : 0;
 
-    case fcall: {
-      if (!eval_func(eval, kwd, node->ch)) {
-        fprintf(stderr, "eval.c: could not call %s()\n", kwd);
-        cleanup();
-        _Exit(1);
-      }
+  if (!sig) {
+    const builtin_t *builtin = !fnode          ? NULL
+                               : fnode->builtin ? fnode->builtin
+                                                : get_builtin(func);
 
-      return 1;
+    /* At this point, sig is NULL and the func is not a builtin. */
+    if (!builtin) {
+      fprintf(stderr, "eval.c: could not call %s()\n", func);
+      cleanup();
+      _Exit(1);
     }
 
-    case fdefer: {
-      frame_t *lframe = peek_last(eval->tbl->frames);
-      return add(lframe->defer_stack, node->ch);
+    value_t args[argc + 1];
+    token_t tks[argc + 1];
+    const token_t *fargs[argc + 1];
+    if (!eval_args(eval, fnode, args)) return 0;
+
+    for (unsigned int i = 0; i < argc; i++) {
+      tks[i] = value_token(&args[i]);
+      fargs[i] = &tks[i];
     }
 
-    case post_dec:
-    case post_inc:
-      return eval_unary(node, eval, node->type);
+    return call_builtin(builtin, fargs, argc, eval->tbl);
+  }
 
-    case rettype:
-      return eval_return(node, eval);
+  /* Bodies are loaded on the first call. */
+  if (!load_body(sig, eval->tbl)) {
+    lno = load_lno;
+    return 0;
+  }
+
+  if (eval->engine != engine_tree) {
+    const int res = eval->engine == engine_vm ? vm_call(eval, sig, fnode)
+                                              : closure_call(eval, sig, fnode);
+    if (res >= 0) return res;
+  }
+
+  value_t args[argc + 1];
+  if (argc && !eval_args(eval, fnode, args)) return 0;
+
+  return eval_call(eval, sig, args, argc);
+}
+
+/**
+ * Runs sig on the tree-walker. args have already been evaluated in the
+ * caller's frame, what sig returns is left in the return register.
+ */
+int eval_call(eval_t *eval, fsig_t *sig, value_t *args,
+              const unsigned int argc) {
+  if (!load_body(sig, eval->tbl)) {
+    lno = load_lno;
+    return 0;
+  }
+
+  const unsigned int entry = n_acts;
+  return push_act(eval, sig, NULL, args, argc, cont_host) && run(eval, entry);
+}
+
+/**
+ * Runs on an eval of its own, so that it can be called while the body of the
+ * caller is loaded, whatever engine the program runs on.
+ */
+int eval_const(symtbl_t *symtbl, fsig_t *sig, value_t *args,
+               const unsigned int argc, value_t *res) {
+  eval_t eval = {symtbl, symtbl->depth, engine_tree, DEFAULT_MAX_DEPTH, 0};
+  const value_t ret = symtbl->ret;
+  const int has_ret = symtbl->has_ret, at = lno;
+
+  symtbl->has_ret = 0;
+  int ok = eval_call(&eval, sig, args, argc);
+  if (ok && !take_ret(symtbl, res)) {
+    fprintf(stderr, "eval.c: %s() did not return anything\n", sig->func);
+    ok = 0;
+  }
+
+  symtbl->ret = ret;
+  symtbl->has_ret = has_ret;
+  lno = at;
+  return ok;
+}
+
+int eval_print(const ast_node_t *node, eval_t *eval) {
+  print_node_t *pnode = node->ch;
+  value_t val;
+  if (!resolve(pnode->arg, pnode->type, eval, &val)) return 0;
+
+  const token_t arg = value_token(&val);
+  print_token(&arg);
+  return 1;
+}
+
+void print_token(const token_t *arg) {
+  if (arg->type == integer) {
+    char buf[32];
+    fmt_int(*(long long *)arg->tk, buf, sizeof buf);
+    puts(buf);
+  } else if (arg->type == numeric) {
+    char buf[32];
+    fmt_num(*(double *)arg->tk, buf, sizeof buf);
+    puts(buf);
+  } else {
+    printf("'%s'\n", (char *)arg->tk);
+  }
+}
 
+int eval_read(const ast_node_t *node, eval_t *eval) {
+  read_node_t *rnode = node->ch;
+  char *buf = alloc(512);
+  memset(buf, 0, 512);
+
+  scanf("%s", buf);
+  return register_sym(eval->tbl, rnode->arg, buf, string, 0);
+}
+
+int eval_return(const ast_node_t *node, eval_t *eval) {
+  return_node_t *rnode = node->ch;
+  act_t *act = &acts[n_acts - 1];
+
+  act->leaving = 1;
+  if (!rnode->val) return 1;
+
+  if (!resolve(rnode->val, rnode->type, eval, &act->ret)) {
+    fprintf(stderr, "eval.c: could not execute return\n");
+    return 0;
+  }
+
+  act->has_ret = 1;
+  return 1;
+}
+
+int eval_unary(const ast_node_t *node, eval_t *eval,
+               const unsigned int unary_type) {
+  unary_node_t *unode = node->ch;
+  entry_t *e = get_symentry(eval->tbl, unode->arg);
+
+  if (!e) {
+    fprintf(stderr, "eval.c: missing decl for sym [%s]\n", unode->arg);
+    return 0;
+  }
+
+  if (!is_num(e->vtype)) {
+    fprintf(stderr, "eval.c: unary cannot be used on non-numeric types [%s]\n",
+            unode->arg);
+    return 0;
+  }
+
+  const int step = unary_type == post_inc ? 1 : -1;
+  switch (unary_type) {
+    case post_dec:
+    case post_inc:
+      if (e->vtype == integer)
+        *(long long *)e->val = (unsigned long long)*(long long *)e->val + step;
+      else
+        *(double *)e->val += step;
+      break;
     default: {
-      fprintf(stderr, "eval.c: could not eval [%s]\n", kwd);
+      fprintf(stderr, "eval.c: eval_unary() fail, invalid unary_type\n");
       return 0;
     }
   }
 
-  return 1;
+  return register_sym(eval->tbl, unode->arg, e->val, e->vtype, 0);
 }
 
 int eval_prog(ast_t *ast, eval_t *eval) {
   if (!ast) return 0;
-  if (eval_func(eval, "main", NULL) == 0) {
+
+  /* Top-level decls are run once, before main. */
+  fsig_t *init = eval->tbl->init;
+  if ((init && !eval_call(eval, init, NULL, 0)) ||
+      eval_func(eval, "main", NULL) == 0) {
     fprintf(stderr, "main.c: error in line %d, program halted\n", lno);
     return 0;
   }
@@ -2,11 +2,47 @@
 
 #include "ast.h"
 #include "symtbl.h"
+#include "value.h"
+
+/* Calls deeper than this fail, unless raised with --max-depth. */
+#define DEFAULT_MAX_DEPTH 10000
+
+/* Calls after which a function is JIT compiled, unless set with --jit=. */
+#define DEFAULT_JIT_CALLS 1
+
+/* Execution engines, selected with --engine. */
+enum { engine_tree, engine_vm, engine_closure };
 
 typedef struct eval {
   symtbl_t *tbl;
-  unsigned int depth;
+  unsigned int depth, engine, max_depth;
+  /* Calls after which functions run natively (see jit.c), 0 if off. */
+  unsigned int jit;
 } eval_t;
 
+/* Line being run, each thread has its own (see par.c). */
+extern _Thread_local int lno;
+
 eval_t *init_eval(void);
-int eval_prog(ast_t *ast, eval_t *eval);
\ No newline at end of file
+int compare(const token_t *lhs, const token_t *rhs, const char *op);
+int eval_args(const eval_t *eval, const func_node_t *fnode, value_t *args);
+int eval_call(eval_t *eval, fsig_t *sig, value_t *args,
+              const unsigned int argc);
+/**
+ * Calls sig with args on the tree-walker, with what it returned in res. Used to
+ * run calls to const defs when the caller is loaded (see opt.c).
+ */
+int eval_const(symtbl_t *symtbl, fsig_t *sig, value_t *args,
+               const unsigned int argc, value_t *res);
+int eval_func(eval_t *eval, const char *func, const func_node_t *fnode);
+int eval_prog(ast_t *ast, eval_t *eval);
+void print_token(const token_t *arg);
+char *slice(const token_t *arg, const token_t *lb, const token_t *ub,
+            const unsigned int schar);
+/**
+ * slice() without checks, for a literal arg of length len whose integer
+ * bounds opt.c proved to be within it (see indx_node_t.in_range).
+ */
+char *slice_in_range(const char *arg, const unsigned long len,
+                     const value_t *lb, const value_t *ub,
+                     const unsigned int schar);
\ No newline at end of file
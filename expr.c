@@ -1,65 +1,186 @@
 #include "expr.h"
 
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "eval.h"
 #include "node.h"
+#include "par.h"
 #include "token.h"
 
-token_t *eval_expr(const token_t *lhs, const token_t *rhs, const char *op) {
-  token_t *t = alloc(sizeof(token_t));
-  t->tk = alloc(sizeof(double));
-  t->type = numeric;
+void expr_fail(const char *msg, const char *op) {
+  fflush(stdout);
+  fprintf(stderr, "expr.c: %s [%s]\n", msg, op);
+  fprintf(stderr, "expr.c: error in line %d, program halted\n", lno);
+  if (!in_pfor) cleanup();
+  _Exit(1);
+}
+
+/**
+ * Integer arithmetic is done on unsigned operands so that overflow wraps
+ * around (two's complement) instead of being undefined.
+ */
+long long eval_int(const long long l, const long long r, const char *op) {
+  const unsigned long long a = l, b = r;
+
+  switch (op[0]) {
+    case '+':
+      return a + b;
+    case '-':
+      return a - b;
+    case '*':
+      return a * b;
+    case '/':
+    case '%':
+      if (r == 0) expr_fail("integer division by zero", op);
+      if (r == -1) return op[0] == '/' ? -a : 0;
+      return op[0] == '/' ? l / r : l % r;
+    case '<':
+      return a << (b & 63);
+    case '>':
+      return l >> (b & 63);
+    case '&':
+      return a & b;
+    case '|':
+      return a | b;
+    case '^':
+      return a ^ b;
+    case 'u':
+      return op[1] == '-' ? -b : b;
+    case '~':
+      return ~b;
+  }
+
+  assert(1 != 1);
+}
+
+double eval_double(const double l, const double r, const char *op) {
+  switch (op[0]) {
+    case '+':
+      return l + r;
+    case '-':
+      return l - r;
+    case '*':
+      return l * r;
+    case '/':
+      return l / r;
+    case '%':
+      return fmod(l, r);
+    case 'u':
+      return op[1] == '-' ? -r : r;
+  }
+
+  expr_fail("operator requires integer operands", op);
+  return 0;
+}
+
+/**
+ * Integer operands give an integer result. If either operand is a double, the
+ * other one is promoted and the result is a double. Unary operators (u+, u-
+ * and ~) only look at rhs. out may alias lhs or rhs.
+ */
+void eval_expr(const value_t *lhs, const value_t *rhs, const char *op,
+               value_t *out) {
+  if (!is_num(lhs->type) || !is_num(rhs->type))
+    expr_fail("non-numeric in exprtree", op);
+
+  const int unary = op[0] == 'u' || op[0] == '~';
+
+  if ((unary || lhs->type == integer) && rhs->type == integer) {
+    const long long res = eval_int(unary ? 0 : lhs->as.i, rhs->as.i, op);
+    out->type = integer;
+    out->as.i = res;
+    return;
+  }
 
-  if ((lhs && lhs->type != numeric) || (rhs && rhs->type != numeric)) {
-    fprintf(stderr, "expr.c: non-numeric in exprtree\n");
+  const double res =
+      eval_double(unary ? 0 : value_double(lhs), value_double(rhs), op);
+  out->type = numeric;
+  out->as.d = res;
+}
+
+/* Where the value of a leaf is, a literal or the entry of a sym. */
+static const void *leaf_val(const token_t *tk, const symtbl_t *symtbl,
+                            unsigned int *type) {
+  if (tk->type != identifier) {
+    *type = tk->type;
+    return tk->tk;
+  }
+
+  entry_t *e = get_symentry(symtbl, (char *)tk->tk);
+  if (!e) {
+    fprintf(stderr, "expr.c: missing decl for sym in exprtree [%s]\n",
+            (char *)tk->tk);
     cleanup();
     _Exit(1);
   }
 
-  double l = lhs ? *(double *)lhs->tk : 0;
-  double r = rhs ? *(double *)rhs->tk : 0;
-
-  if (!strcmp(op, "+"))
-    *(double *)t->tk = l + r;
-  else if (!strcmp(op, "-"))
-    *(double *)t->tk = l - r;
-  else if (!strcmp(op, "*"))
-    *(double *)t->tk = l * r;
-  else if (!strcmp(op, "/"))
-    *(double *)t->tk = l / r;
-  else
-    assert(1 != 1);
-
-  return t;
+  *type = e->vtype;
+  return e->val;
+}
+
+/**
+ * Trees that types.c found to always eval to an integer (or a double) only
+ * hold numbers of that type (or either type), they're evaled without checks.
+ */
+static long long eval_int_tree(const binary_node_t *node,
+                               const symtbl_t *symtbl) {
+  unsigned int type;
+  if (!node->lhs && !node->rhs)
+    return *(const long long *)leaf_val(node->val, symtbl, &type);
+
+  /* The lhs of a unary operator is a 0 placeholder, see to_exprtree(). */
+  const long long l = eval_int_tree(node->lhs, symtbl);
+  return eval_int(l, eval_int_tree(node->rhs, symtbl), node->val->tk);
 }
 
-token_t *eval_exprtree(binary_node_t *node, const symtbl_t *symtbl) {
-  if (!node) return 0;
+static double eval_num_tree(const binary_node_t *node,
+                            const symtbl_t *symtbl) {
+  unsigned int type;
+  if (node->type == integer) return eval_int_tree(node, symtbl);
 
   if (!node->lhs && !node->rhs) {
-    if (node->val->type == identifier) {
-      entry_t *e = get_symentry(symtbl, (char *)node->val->tk);
-      if (!e) {
-        fprintf(stderr, "expr.c: missing decl for sym in exprtree [%s]\n",
-                (char *)node->val->tk);
-        cleanup();
-        _Exit(1);
-      }
+    const void *val = leaf_val(node->val, symtbl, &type);
+    return type == integer ? *(const long long *)val : *(const double *)val;
+  }
 
-      node->val->tk = e->val;
-      node->val->type = e->vtype;
-    }
+  const double l = eval_num_tree(node->lhs, symtbl);
+  return eval_double(l, eval_num_tree(node->rhs, symtbl), node->val->tk);
+}
 
-    return node->val;
+/**
+ * Evaluates the tree into out. Identifiers are looked up in symtbl, the tree
+ * itself is never modified and nothing is allocated.
+ */
+void eval_exprtree(const binary_node_t *node, const symtbl_t *symtbl,
+                   value_t *out) {
+  if (node->type == integer) {
+    out->type = integer;
+    out->as.i = eval_int_tree(node, symtbl);
+    return;
   }
 
-  token_t *l = eval_exprtree(node->lhs, symtbl);
-  token_t *r = eval_exprtree(node->rhs, symtbl);
+  if (node->type == numeric) {
+    out->type = numeric;
+    out->as.d = eval_num_tree(node, symtbl);
+    return;
+  }
 
-  return eval_expr(l, r, (char *)node->val->tk);
+  if (!node->lhs && !node->rhs) {
+    unsigned int type;
+    const void *v = leaf_val(node->val, symtbl, &type);
+    const token_t val = {(void *)v, type};
+    *out = to_value(&val);
+    return;
+  }
+
+  value_t l, r;
+  eval_exprtree(node->lhs, symtbl, &l);
+  eval_exprtree(node->rhs, symtbl, &r);
+  eval_expr(&l, &r, (char *)node->val->tk, out);
 }
 
 binary_node_t *init_bnode(list_t *operands, const token_t *top) {
@@ -74,21 +195,35 @@ binary_node_t *init_bnode(list_t *operands, const token_t *top) {
   bnode->lhs = lhs;
   bnode->rhs = rhs;
   bnode->val = (token_t *)top;
+  bnode->type = unknown;
 
   return bnode;
 }
 
+static const char *k_operators[] = {"|",  "^", "&", "<<", ">>", "+", "-",
+                                    "*",  "/", "%", "u+", "u-", "~"};
+
+/* Precedence of each entry in k_operators, higher binds tighter. */
+static const int k_precedence[] = {1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 7, 7, 7};
+
 int is_operator(const token_t *tk) {
-  if (tk->type == numeric) return 0;
+  if (is_num(tk->type)) return 0;
 
   const char *t = tk->tk;
-  return !strcmp(t, "+") || !strcmp(t, "-") || !strcmp(t, "*") ||
-         !strcmp(t, "/");
+  for (unsigned int i = 0; i < sizeof k_operators / sizeof(char *); i++)
+    if (!strcmp(t, k_operators[i])) return 1;
+
+  return 0;
+}
+
+int is_prefix(const token_t *tk) {
+  return match_token(tk, "+") || match_token(tk, "-") || match_token(tk, "~");
 }
 
 int operator_assoc(const char *tk) {
-  if (!strcmp(tk, "+") || !strcmp(tk, "-")) return 1;
-  if (!strcmp(tk, "*") || !strcmp(tk, "/")) return 2;
+  for (unsigned int i = 0; i < sizeof k_operators / sizeof(char *); i++)
+    if (!strcmp(tk, k_operators[i])) return k_precedence[i];
+
   assert(1 != 1);
 }
 
@@ -100,14 +235,7 @@ int to_exprtree(list_t *expr, void **buf, unsigned int *type) {
   list_t *operators = init_list();
 
   token_t *peek = peek_front(expr);
-
-  if (match_token(peek, "+") || match_token(peek, "-")) {
-    double t = 0;
-    token_t *itk = ptr_to_token(numeric, &t);
-
-    assert(add_front(expr, itk));
-    peek = peek_front(expr);
-  }
+  int want_operand = 1;
 
   while (peek) {
     token_t *tk = peek;
@@ -117,24 +245,48 @@ int to_exprtree(list_t *expr, void **buf, unsigned int *type) {
       assert(add(operators, tk));
 
       /* Operand, add to operands. */
-    } else if (tk->type == string || tk->type == numeric ||
+    } else if (tk->type == string || is_num(tk->type) ||
                tk->type == identifier) {
+      if (!want_operand) break;
       if (tk->type == identifier) idf_seen = 1;
 
       binary_node_t *bnode = alloc(sizeof(binary_node_t));
       bnode->val = tk;
       bnode->lhs = NULL;
       bnode->rhs = NULL;
+      bnode->type = unknown;
 
       assert(add(operands, bnode));
+      want_operand = 0;
+
+      /**
+       * Prefix operator (+, - or ~ where an operand is expected). It only uses
+       * its rhs, a placeholder operand keeps the tree binary.
+       */
+    } else if (want_operand && is_prefix(tk)) {
+      long long zero = 0;
+      binary_node_t *bnode = alloc(sizeof(binary_node_t));
+      bnode->val = ptr_to_token(integer, &zero);
+      bnode->lhs = NULL;
+      bnode->rhs = NULL;
+      bnode->type = unknown;
+
+      char op[3] = {'u', ((char *)tk->tk)[0], '\0'};
+      assert(add(operands, bnode));
+      assert(add(operators, init_token(op[1] == '~' ? "~" : op, operator)));
 
       /* Operator */
-    } else if (is_operator(tk)) {
-      if (operators->size > 0) {
+    } else if (!want_operand && is_operator(tk) && !match_token(tk, "~")) {
+      want_operand = 1;
+
+      while (operators->size > 0) {
         token_t *top = peek_last(operators);
 
-        /* Current operator is of lower associativity than top of the stack. */
-        if (top->type != numeric && is_operator(top) &&
+        /**
+         * Current operator is of lower or same precedence than the top of the
+         * stack, so the top must be reduced first.
+         */
+        if (!is_num(top->type) && is_operator(top) &&
             operator_assoc(tk->tk) <= operator_assoc(top->tk)) {
           /**
            * Binary expression
@@ -150,6 +302,8 @@ int to_exprtree(list_t *expr, void **buf, unsigned int *type) {
 
           assert(add(operands, bnode));
           pop_last(operators);
+        } else {
+          break;
         }
       }
 
@@ -158,6 +312,7 @@ int to_exprtree(list_t *expr, void **buf, unsigned int *type) {
       /* Closing pr */
     } else if (match_token(tk, ")")) {
       if (operators->size == 0) return 0;
+      want_operand = 0;
 
       token_t *top = peek_last(operators);
 
@@ -227,10 +382,14 @@ int to_exprtree(list_t *expr, void **buf, unsigned int *type) {
   }
 
   /* Apply constant folding */
-  token_t *evalres = eval_exprtree(root, NULL);
-  if (!evalres) return 0;
+  value_t val;
+  eval_exprtree(root, NULL, &val);
+
+  token_t res = value_token(&val);
+  token_t *folded = ptr_to_token(res.type, res.tk);
+  if (!folded) return 0;
 
-  *buf = evalres->tk;
-  *type = evalres->type;
+  *buf = folded->tk;
+  *type = folded->type;
   return 1;
 }
\ No newline at end of file
@@ -3,6 +3,12 @@
 #include "symtbl.h"
 #include "token.h"
 #include "util.h"
+#include "value.h"
 
-token_t *eval_exprtree(binary_node_t *node, const symtbl_t *symtbl);
+double eval_double(const double l, const double r, const char *op);
+long long eval_int(const long long l, const long long r, const char *op);
+void eval_expr(const value_t *lhs, const value_t *rhs, const char *op,
+               value_t *out);
+void eval_exprtree(const binary_node_t *node, const symtbl_t *symtbl,
+                   value_t *out);
 int to_exprtree(list_t *expr, void **buf, unsigned int *type);
\ No newline at end of file
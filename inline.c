@@ -0,0 +1,561 @@
+/**
+ * inline.c
+ * Inlining of small functions into their callers.
+ *
+ * A callee can be inlined if its body is small (see max_cost), holds no for,
+ * defers nothing, only returns at its end and calls nothing but builtins, so
+ * it can't be recursive. A loop is left in a function of its own, where the
+ * JIT can compile it - it never sees the body of main or of a function that
+ * is only called once. Callees are prepared before their callers, so a
+ * function whose calls were all inlined into it can be inlined in turn.
+ *
+ * A callee whose body is a single return of a value without side effects (e.g,
+ * def sq(x) return x * x end) is inlined as an expression: the value takes the
+ * place of the call, with the args in place of the params. The body of any
+ * other callee is copied in front of the statement making the call, with every
+ * sym renamed to a temp (see temp_sym()), a var declared for every param and
+ * one for the value returned, which takes the place of the call. That's only
+ * done if the call is the one thing in the statement with side effects, and
+ * never in the condition of a for, which is evaled on every iteration.
+ */
+
+#include "inline.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ast.h"
+#include "compile.h"
+#include "memo.h"
+#include "node.h"
+#include "opt.h"
+#include "token.h"
+#include "util.h"
+
+int no_inline = 0;
+
+/**
+ * Largest body inlined, in statements & operators. A body that hasn't been
+ * compiled yet is only compiled early if its source is at most max_src bytes.
+ */
+enum { max_cost = 12, max_src = 512 };
+
+/* What a sym of the callee is in the caller. */
+typedef struct rename {
+  const char *sym;
+  token_t to;
+} rename_t;
+
+typedef struct inliner {
+  fsig_t *sig;
+  symtbl_t *symtbl;
+  rename_t *map;
+  unsigned int n, cap;
+  /* Set when inlining an expression, only params are replaced then. */
+  int expr, ok;
+} inliner_t;
+
+static void report(const inliner_t *in, const int lno, const char *func) {
+  if (opt_report)
+    fprintf(stderr, "inline.c: %s() L[%d] %s() inlined\n", in->sig->func, lno,
+            func);
+}
+
+static const token_t *map_sym(inliner_t *in, const char *sym, void *to,
+                              const unsigned int type) {
+  in->map = grow(in->map, &in->cap, in->n, sizeof(rename_t));
+  rename_t *r = &in->map[in->n++];
+  r->sym = sym;
+  r->to.tk = to;
+  r->to.type = type;
+  return &r->to;
+}
+
+/* What sym is in the caller, NULL if it's left as it is (a global). */
+static const token_t *rename_sym(inliner_t *in, const char *sym) {
+  for (unsigned int i = 0; i < in->n; i++)
+    if (!strcmp(in->map[i].sym, sym)) return &in->map[i].to;
+
+  if (get_global(in->symtbl, sym)) {
+    if (is_arg(in->sig, sym)) in->ok = 0;
+    return NULL;
+  }
+  if (in->expr) {
+    in->ok = 0;
+    return NULL;
+  }
+
+  return map_sym(in, sym, temp_sym(sym), identifier);
+}
+
+/* A sym the callee assigns, globals can't be. */
+static char *rename_target(inliner_t *in, char *sym) {
+  const token_t *to = rename_sym(in, sym);
+  if (to) return to->tk;
+
+  in->ok = 0;
+  return sym;
+}
+
+static token_t *copy_token(inliner_t *in, token_t *tk) {
+  const token_t *to = tk->type == identifier ? rename_sym(in, tk->tk) : NULL;
+  if (!to) return tk;
+
+  token_t *copy = alloc(sizeof(token_t));
+  *copy = *to;
+  return copy;
+}
+
+static binary_node_t *copy_tree(inliner_t *in, const binary_node_t *node) {
+  binary_node_t *copy = alloc(sizeof(binary_node_t));
+  copy->val = node->lhs ? node->val : copy_token(in, node->val);
+  copy->lhs = node->lhs ? copy_tree(in, node->lhs) : NULL;
+  copy->rhs = node->rhs ? copy_tree(in, node->rhs) : NULL;
+  copy->type = unknown;
+  return copy;
+}
+
+/* The copy is linked again along with the rest of the caller. */
+static func_node_t *copy_call(inliner_t *in, const func_node_t *fnode) {
+  func_node_t *copy = alloc(sizeof(func_node_t));
+  copy->defer = fnode->defer;
+  copy->tail = 0;
+  copy->pure = copy->is_const = 0;
+  copy->func = fnode->func;
+  copy->args = init_list();
+  copy->sig = NULL;
+  copy->builtin = NULL;
+  copy->typed = 0;
+
+  for (node_t *arg = fnode->args->head; arg; arg = arg->next)
+    add(copy->args, copy_token(in, arg->data));
+
+  return copy;
+}
+
+static void copy_operand(inliner_t *in, void *buf, const unsigned int type,
+                         void **nbuf, unsigned int *ntype);
+
+static indx_node_t *copy_indx(inliner_t *in, const indx_node_t *ixnode) {
+  indx_node_t *copy = alloc(sizeof(indx_node_t));
+  *copy = *ixnode;
+  copy->arg = copy_token(in, ixnode->arg);
+  copy->typed = 0;
+  copy->in_range = 0;
+  if (ixnode->beg)
+    copy_operand(in, ixnode->beg, ixnode->ltype, &copy->beg, &copy->ltype);
+  if (ixnode->end)
+    copy_operand(in, ixnode->end, ixnode->rtype, &copy->end, &copy->rtype);
+
+  return copy;
+}
+
+/* Literals are never modified in place, they're shared. */
+static void copy_operand(inliner_t *in, void *buf, const unsigned int type,
+                         void **nbuf, unsigned int *ntype) {
+  *nbuf = buf;
+  *ntype = type;
+
+  switch (type) {
+    case identifier: {
+      const token_t *to = rename_sym(in, buf);
+      if (to) {
+        *nbuf = to->tk;
+        *ntype = to->type;
+      }
+      break;
+    }
+
+    case exprtree:
+      *nbuf = copy_tree(in, buf);
+      break;
+
+    case fretval:
+      *nbuf = copy_call(in, buf);
+      break;
+
+    case indx:
+      *nbuf = copy_indx(in, buf);
+      break;
+  }
+}
+
+static list_t *copy_block(inliner_t *in, const list_t *nodes);
+
+static ast_node_t *copy_node(inliner_t *in, const ast_node_t *node) {
+  ast_node_t *copy = alloc(sizeof(ast_node_t));
+  *copy = *node;
+  copy->tokens = init_list();
+  copy->lch = copy_block(in, node->lch);
+  copy->rch = copy_block(in, node->rch);
+
+  switch (node->type) {
+    case vdecl: {
+      const decl_node_t *dnode = node->ch;
+      decl_node_t *d = alloc(sizeof(decl_node_t));
+      *d = *dnode;
+      d->lhs = rename_target(in, dnode->lhs);
+      copy_operand(in, dnode->rhs, dnode->rtype, &d->rhs, &d->rtype);
+      copy->ch = d;
+      break;
+    }
+
+    case cin: {
+      read_node_t *r = alloc(sizeof(read_node_t));
+      r->arg = rename_target(in, ((read_node_t *)node->ch)->arg);
+      copy->ch = r;
+      break;
+    }
+
+    case post_dec:
+    case post_inc: {
+      unary_node_t *u = alloc(sizeof(unary_node_t));
+      u->arg = rename_target(in, ((unary_node_t *)node->ch)->arg);
+      copy->ch = u;
+      break;
+    }
+
+    case cout: {
+      const print_node_t *pnode = node->ch;
+      print_node_t *p = alloc(sizeof(print_node_t));
+      copy_operand(in, pnode->arg, pnode->type, &p->arg, &p->type);
+      copy->ch = p;
+      break;
+    }
+
+    case fcall:
+      copy->ch = copy_call(in, node->ch);
+      break;
+
+    case fbreak:
+    case fcontinue:
+      break;
+
+    case cond:
+    case floop: {
+      const cnode_t *cnode = node->ch;
+      cnode_t *c = alloc(sizeof(cnode_t));
+      c->op = cnode->op;
+      c->type = unknown;
+      c->step = NULL;
+      copy_operand(in, cnode->lhs, cnode->ltype, &c->lhs, &c->ltype);
+      copy_operand(in, cnode->rhs, cnode->rtype, &c->rhs, &c->rtype);
+      copy->ch = c;
+      break;
+    }
+
+    default:
+      in->ok = 0;
+  }
+
+  return copy;
+}
+
+static list_t *copy_block(inliner_t *in, const list_t *nodes) {
+  list_t *copy = init_list();
+  for (node_t *n = nodes->head; n; n = n->next)
+    add(copy, copy_node(in, n->data));
+
+  return copy;
+}
+
+/* Operators & calls in the operand, -1 if it calls a function. */
+static int operand_cost(const inliner_t *in, const void *buf,
+                        const unsigned int type) {
+  switch (type) {
+    case exprtree: {
+      const binary_node_t *node = buf;
+      if (!node->lhs) return 0;
+      return 1 + operand_cost(in, node->lhs, exprtree) +
+             operand_cost(in, node->rhs, exprtree);
+    }
+
+    case fretval:
+      return get_fsig(in->symtbl, ((func_node_t *)buf)->func) ? -1 : 1;
+
+    case indx: {
+      const indx_node_t *ixnode = buf;
+      const int l = ixnode->beg ? operand_cost(in, ixnode->beg, ixnode->ltype)
+                                : 0;
+      const int r = ixnode->end ? operand_cost(in, ixnode->end, ixnode->rtype)
+                                : 0;
+      return l < 0 || r < 0 ? -1 : 1 + l + r;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Statements, operators & calls in nodes, -1 if they can't be inlined: they
+ * loop, defer, call a function or return anywhere but at the end of the body
+ * (top).
+ */
+static int body_cost(const inliner_t *in, const list_t *nodes, const int top) {
+  int cost = 0;
+
+  for (node_t *n = nodes->head; n; n = n->next) {
+    ast_node_t *node = n->data;
+    switch (node->type) {
+      case fdefer:
+      case floop:
+      case pfloop:
+        return -1;
+
+      case fcall:
+        if (get_fsig(in->symtbl, ((func_node_t *)node->ch)->func)) return -1;
+        break;
+
+      case rettype:
+        if (!top || n->next) return -1;
+        break;
+
+      case cond: {
+        const int l = body_cost(in, node->lch, 0);
+        const int r = body_cost(in, node->rch, 0);
+        if (l < 0 || r < 0) return -1;
+        cost += l + r;
+        break;
+      }
+    }
+
+    void **bufs[2];
+    unsigned int *types[2];
+    const unsigned int argc = node_operands(node, bufs, types);
+    for (unsigned int i = 0; i < argc; i++) {
+      const int c = operand_cost(in, *bufs[i], *types[i]);
+      if (c < 0) return -1;
+      cost += c;
+    }
+
+    cost++;
+  }
+
+  return cost;
+}
+
+/* The function fnode calls if it can be inlined, NULL otherwise. */
+static fsig_t *inlinable(inliner_t *in, const func_node_t *fnode) {
+  fsig_t *callee = get_fsig(in->symtbl, fnode->func);
+  if (!callee || !strcmp(callee->func, "main") ||
+      callee->args->size != fnode->args->size)
+    return NULL;
+
+  if (callee->lazy && callee->body_end - callee->body_beg > max_src)
+    return NULL;
+
+  /* Calls to const defs are left for optimize() to run, see opt.c. */
+  if (callee->decl_const) return NULL;
+
+  /* Fails for the functions being prepared, i.e, recursive calls. */
+  if (!prepare_body(callee, in->symtbl)) return NULL;
+
+  const int cost = body_cost(in, ((ast_node_t *)callee->node)->lch, 1);
+  if (cost < 0 || cost > max_cost) return NULL;
+
+  /* A pure def that isn't is left to fail once it's called, see memo_func(). */
+  if (callee->decl_pure && !pure_func(callee, in->symtbl)) return NULL;
+  return callee;
+}
+
+/* Whether evaling the operand only calls builtins without side effects. */
+static int pure_operand(const inliner_t *in, const void *buf,
+                        const unsigned int type) {
+  if (type == fretval) return pure_call(buf, in->symtbl);
+  if (type != indx) return 1;
+
+  const indx_node_t *ixnode = buf;
+  return (!ixnode->beg || pure_operand(in, ixnode->beg, ixnode->ltype)) &&
+         (!ixnode->end || pure_operand(in, ixnode->end, ixnode->rtype));
+}
+
+/* Replaces the call in the operand with the value its callee returns. */
+static int inline_expr(inliner_t *in, void **buf, unsigned int *type,
+                       const int lno) {
+  const func_node_t *fnode = *buf;
+  fsig_t *callee = inlinable(in, fnode);
+  if (!callee) return 0;
+
+  const list_t *body = ((ast_node_t *)callee->node)->lch;
+  if (body->size != 1) return 0;
+
+  const ast_node_t *node = body->head->data;
+  const return_node_t *rnode = node->ch;
+  if (node->type != rettype || !rnode->val ||
+      !pure_operand(in, rnode->val, rnode->type))
+    return 0;
+
+  in->n = 0;
+  in->expr = 1;
+  in->ok = 1;
+
+  node_t *arg = fnode->args->head;
+  for (node_t *p = callee->args->head; p; p = p->next, arg = arg->next) {
+    const token_t *param = p->data, *tk = arg->data;
+    map_sym(in, param->tk, tk->tk, tk->type);
+  }
+
+  void *val;
+  unsigned int vtype;
+  copy_operand(in, rnode->val, rnode->type, &val, &vtype);
+  if (!in->ok) return 0;
+
+  report(in, lno, callee->func);
+  *buf = val;
+  *type = vtype;
+  return 1;
+}
+
+/**
+ * Adds the body of callee to pre, with fnode's args in vars of its own. buf is
+ * the operand that holds the call, it's replaced with a var holding the value
+ * returned. NULL for a bare call, the value is still evaled then.
+ */
+static int inline_body(inliner_t *in, fsig_t *callee, const func_node_t *fnode,
+                       list_t *pre, void **buf, unsigned int *type,
+                       const int lno) {
+  const list_t *body = ((ast_node_t *)callee->node)->lch;
+  const ast_node_t *last = body->size ? peek_last(body) : NULL;
+  if (buf && (!last || last->type != rettype ||
+              !((return_node_t *)last->ch)->val))
+    return 0;
+
+  in->n = 0;
+  in->expr = 0;
+  in->ok = 1;
+
+  list_t *nodes = init_list();
+  node_t *arg = fnode->args->head;
+  for (node_t *p = callee->args->head; p; p = p->next, arg = arg->next) {
+    const token_t *param = p->data, *tk = arg->data;
+    char *sym = temp_sym(param->tk);
+    map_sym(in, param->tk, sym, identifier);
+    add(nodes, init_decl(sym, tk->tk, tk->type, lno));
+  }
+
+  char *ret = NULL;
+  for (node_t *n = body->head; n; n = n->next) {
+    const ast_node_t *node = n->data;
+    const return_node_t *rnode = node->ch;
+    if (node->type != rettype) {
+      add(nodes, copy_node(in, node));
+    } else if (rnode->val) {
+      void *val;
+      unsigned int vtype;
+      copy_operand(in, rnode->val, rnode->type, &val, &vtype);
+
+      ret = temp_sym(NULL);
+      add(nodes, init_decl(ret, val, vtype, node->lno));
+    }
+  }
+
+  if (!in->ok) return 0;
+
+  report(in, lno, callee->func);
+  for (node_t *n = nodes->head; n; n = n->next) add(pre, n->data);
+  if (buf) {
+    *buf = ret;
+    *type = identifier;
+  }
+
+  return 1;
+}
+
+static void inline_exprs(inliner_t *in, void **buf, unsigned int *type,
+                         const int lno) {
+  if (*type == fretval) {
+    inline_expr(in, buf, type, lno);
+  } else if (*type == indx) {
+    indx_node_t *ixnode = *buf;
+    if (ixnode->beg) inline_exprs(in, &ixnode->beg, &ixnode->ltype, lno);
+    if (ixnode->end) inline_exprs(in, &ixnode->end, &ixnode->rtype, lno);
+  }
+}
+
+/* Counts the calls in the operand that may have side effects, into call. */
+static void find_calls(inliner_t *in, void **buf, unsigned int *type,
+                       void ***call, unsigned int **ctype, int *n) {
+  if (*type == fretval && !pure_call(*buf, in->symtbl)) {
+    *call = buf;
+    *ctype = type;
+    (*n)++;
+  } else if (*type == indx) {
+    indx_node_t *ixnode = *buf;
+    if (ixnode->beg)
+      find_calls(in, &ixnode->beg, &ixnode->ltype, call, ctype, n);
+    if (ixnode->end)
+      find_calls(in, &ixnode->end, &ixnode->rtype, call, ctype, n);
+  }
+}
+
+/* Inlines the calls in the operands of node, bodies go to pre unless NULL. */
+static void inline_operands(inliner_t *in, ast_node_t *node, list_t *pre) {
+  void **bufs[2];
+  unsigned int *types[2];
+  const unsigned int argc = node_operands(node, bufs, types);
+  for (unsigned int i = 0; i < argc; i++)
+    inline_exprs(in, bufs[i], types[i], node->lno);
+
+  if (!pre) return;
+
+  void **call = NULL;
+  unsigned int *ctype = NULL;
+  int n = 0;
+  for (unsigned int i = 0; i < argc; i++)
+    find_calls(in, bufs[i], types[i], &call, &ctype, &n);
+
+  fsig_t *callee = n == 1 ? inlinable(in, *call) : NULL;
+  if (callee) inline_body(in, callee, *call, pre, call, ctype, node->lno);
+}
+
+static void inline_block(inliner_t *in, list_t *nodes) {
+  node_t **link = &nodes->head;
+
+  while (*link) {
+    node_t *n = *link;
+    ast_node_t *node = n->data;
+    list_t *pre = init_list();
+    int keep = 1;
+
+    if (node->type == cond || node->type == floop) {
+      inline_block(in, node->lch);
+      inline_block(in, node->rch);
+    }
+
+    if (node->type == fcall) {
+      fsig_t *callee = inlinable(in, node->ch);
+      keep = !callee ||
+             !inline_body(in, callee, node->ch, pre, NULL, NULL, node->lno);
+    } else {
+      inline_operands(in, node, node->type == floop ? NULL : pre);
+    }
+
+    /* What's inlined goes in front of the node. */
+    if (pre->size) {
+      node_t *tail = pre->head;
+      while (tail->next) tail = tail->next;
+
+      *link = pre->head;
+      tail->next = n;
+      link = &tail->next;
+      nodes->size += pre->size;
+    }
+
+    if (keep) {
+      link = &n->next;
+    } else {
+      *link = n->next;
+      nodes->size--;
+    }
+  }
+}
+
+void inline_calls(fsig_t *sig, symtbl_t *symtbl) {
+  if (no_inline) return;
+
+  inliner_t in;
+  memset(&in, 0, sizeof in);
+  in.sig = sig;
+  in.symtbl = symtbl;
+  inline_block(&in, ((ast_node_t *)sig->node)->lch);
+}
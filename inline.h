@@ -0,0 +1,12 @@
+#pragma once
+
+#include "symtbl.h"
+
+/* Set by --no-inline. */
+extern int no_inline;
+
+/**
+ * Substitutes the bodies of small functions for the calls to them in the body
+ * of sig. Runs once, before the body is optimized (see prepare_body()).
+ */
+void inline_calls(fsig_t *sig, symtbl_t *symtbl);
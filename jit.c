@@ -0,0 +1,756 @@
+/**
+ * jit.c
+ * Template JIT (--jit) for functions that only compute on integers.
+ *
+ * A function is compiled from its bytecode (see compile.c) once it has been
+ * called eval->jit times. Every instruction expands into a fixed sequence of
+ * x86-64 code working on the slots & operand stack of the function, which live
+ * in its native stack frame. The operand stack is always empty at a jump, so
+ * every operand has a fixed offset from rbp.
+ *
+ * A function is only compiled along with every function it calls, and only if
+ * none of them use anything but integers. Anything else (strings, doubles,
+ * builtins, deferred calls) keeps running on the interpreters. Args are checked
+ * to be integers on the way in, so every value in native code is an integer.
+ */
+
+#include "jit.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if HAS_JIT
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+#include "compile.h"
+#include "expr.h"
+#include "num.h"
+#include "util.h"
+
+#if HAS_JIT
+
+/**
+ * Native functions are called as code(args, res, discard) and return one of
+ * these, leaving what they return in *res. If discard is set the result is
+ * dropped (see emit_call()). jit_deep means that the call failed the depth or
+ * C stack limit and that it hasn't been reported yet.
+ */
+enum { jit_deep = -1, jit_fail, jit_void, jit_value };
+
+typedef int (*native_t)(const long long *args, long long *res,
+                        long long discard);
+
+typedef struct jit_func {
+  native_t code;
+  unsigned int n_args;
+} jit_func_t;
+
+/* Registers as encoded in ModRM. */
+enum { rax = 0, rcx = 1, rdx = 2, rsi = 6, rdi = 7 };
+
+/* Condition codes of jcc & setcc, cc ^ 1 is the inverse of cc. */
+enum {
+  cc_b = 0x2,
+  cc_ae = 0x3,
+  cc_e = 0x4,
+  cc_ne = 0x5,
+  cc_l = 0xC,
+  cc_ge = 0xD,
+  cc_le = 0xE,
+  cc_g = 0xF
+};
+
+/* Jump targets, instructions are >= 0 & stub k is to_stub - k. */
+enum { to_exit = -1, to_deep = -2, to_body = -3, to_stub = -4 };
+
+/* Out of line paths, emitted after the body. */
+enum { stub_fail, stub_noret, stub_divzero };
+
+typedef struct stub {
+  unsigned char kind;
+  int line;
+  const char *str;
+} stub_t;
+
+typedef struct fixup {
+  unsigned int at;
+  int target;
+} fixup_t;
+
+/* Functions compiled together, see collect(). */
+typedef struct jit_set {
+  fsig_t **sigs;
+  jit_func_t *funcs;
+  unsigned int n, cap;
+} jit_set_t;
+
+typedef struct jit {
+  const eval_t *eval;
+  const jit_set_t *set;
+  const fsig_t *sig;
+  const chunk_t *chunk;
+  /* Operand stack depth before each instruction & jump targets. */
+  int *depth;
+  unsigned char *target;
+  unsigned int n_vals;
+  unsigned char *buf;
+  unsigned int n, cap;
+  /* Offset of each instruction in buf. */
+  unsigned int *at;
+  unsigned int exit, deep, body;
+  fixup_t *fixups;
+  unsigned int n_fixups, cap_fixups;
+  stub_t *stubs;
+  unsigned int n_stubs, cap_stubs;
+} jit_t;
+
+/* Native calls on the C stack, and the lowest rsp they may run at. */
+static unsigned int depth = 0;
+static unsigned long stack_limit = 0;
+
+/* Args of a tail call, until the callee copies them into its frame. */
+enum { max_tail_args = 64 };
+static long long tail_args[max_tail_args];
+
+/* Code is copied in here once it's been emitted, see place(). */
+static unsigned char *arena = NULL;
+static unsigned long arena_used = 0, arena_size = 0;
+
+/* Helpers called from native code. */
+static int failed(const int status, const int line) {
+  if (status == jit_deep) {
+    lno = line;
+    fprintf(stderr, "jit.c: stack depth exceeded at L[%d]\n", line);
+  }
+
+  return jit_fail;
+}
+
+static int noret(const char *func, const int line) {
+  lno = line;
+  fprintf(stderr, "jit.c: %s() did not return anything\n", func);
+  return jit_fail;
+}
+
+/* Fails exactly like the interpreters do. */
+static void div_zero(const char *op, const int line) {
+  lno = line;
+  eval_int(1, 0, op);
+}
+
+static void print_int(const long long i) {
+  char buf[32];
+  fmt_int(i, buf, sizeof buf);
+  puts(buf);
+}
+
+static void byte(jit_t *j, const unsigned char b) {
+  j->buf = grow(j->buf, &j->cap, j->n, 1);
+  j->buf[j->n++] = b;
+}
+
+static void put(jit_t *j, const char *s, const unsigned int len) {
+  for (unsigned int i = 0; i < len; i++) byte(j, s[i]);
+}
+
+static void imm32(jit_t *j, const int v) {
+  for (int i = 0; i < 4; i++) byte(j, (unsigned int)v >> 8 * i);
+}
+
+static void imm64(jit_t *j, const unsigned long v) {
+  for (int i = 0; i < 8; i++) byte(j, v >> 8 * i);
+}
+
+/* Offset of value v from rbp - the slots come first, then the stack. */
+static int disp(const jit_t *j, const unsigned int v) {
+  return -16 - 8 * (int)j->n_vals + 8 * (int)v;
+}
+
+/* op reg, [rbp + off] with REX.W. reg is the /digit of some opcodes. */
+static void mem(jit_t *j, const unsigned char op, const int reg,
+                const int off) {
+  byte(j, 0x48);
+  byte(j, op);
+  byte(j, 0x80 | reg << 3 | 5);
+  imm32(j, off);
+}
+
+/* mov reg, imm64 */
+static void movabs(jit_t *j, const int reg, const void *ptr) {
+  byte(j, 0x48);
+  byte(j, 0xB8 + reg);
+  imm64(j, (unsigned long)ptr);
+}
+
+/* call fptr, through rax. */
+static void call_abs(jit_t *j, const void *fptr) {
+  movabs(j, rax, fptr);
+  put(j, "\xFF\xD0", 2);
+}
+
+/* jmp if cc < 0, jcc otherwise. */
+static void jump(jit_t *j, const int cc, const int target) {
+  if (cc < 0) {
+    byte(j, 0xE9);
+  } else {
+    byte(j, 0x0F);
+    byte(j, 0x80 | cc);
+  }
+
+  j->fixups =
+      grow(j->fixups, &j->cap_fixups, j->n_fixups, sizeof(fixup_t));
+  j->fixups[j->n_fixups++] = (fixup_t){j->n, target};
+  imm32(j, 0);
+}
+
+static int stub(jit_t *j, const unsigned char kind, const int line,
+                const char *str) {
+  j->stubs = grow(j->stubs, &j->cap_stubs, j->n_stubs, sizeof(stub_t));
+  j->stubs[j->n_stubs] = (stub_t){kind, line, str};
+  return to_stub - (int)j->n_stubs++;
+}
+
+/**
+ * Checks that chunk only uses what the JIT supports. Returns the deepest the
+ * operand stack gets, or -1.
+ */
+static int check_chunk(jit_t *j) {
+  const chunk_t *chunk = j->chunk;
+
+  for (unsigned int i = 0; i < chunk->n_code; i++) {
+    const instr_t *ins = &chunk->code[i];
+
+    switch (ins->op) {
+      case op_slice:
+      case op_read:
+      case op_defer:
+        return -1;
+      case op_const:
+        if (chunk->consts[ins->a].type != integer) return -1;
+        break;
+      case op_call:
+      case op_tailcall: {
+        const callsite_t *cs = &chunk->calls[ins->a];
+        const chunk_t *callee = cs->sig ? cs->sig->chunk : NULL;
+        if (!callee || cs->argc != callee->n_args) return -1;
+        if (cs->argc > max_tail_args) return -1;
+        break;
+      }
+    }
+  }
+
+  return chunk_depths(chunk, j->depth, j->target);
+}
+
+static const jit_func_t *get_func(const jit_t *j, const fsig_t *sig) {
+  for (unsigned int i = 0; i < j->set->n; i++)
+    if (j->set->sigs[i] == sig) return &j->set->funcs[i];
+
+  return sig->native;
+}
+
+static void emit_call(jit_t *j, const instr_t *ins, const unsigned int top,
+                      const int line) {
+  const callsite_t *cs = &j->chunk->calls[ins->a];
+  const unsigned int argv = top - cs->argc;
+
+  /**
+   * Tail calls to the function itself become a jump back to its body, after
+   * the args are moved into the first slots. A bare call discards the result.
+   */
+  if (ins->op == op_tailcall && cs->sig == j->sig) {
+    for (unsigned int i = 0; i < cs->argc; i++) {
+      mem(j, 0x8B, rax, disp(j, argv + i));
+      mem(j, 0x89, rax, disp(j, i));
+    }
+
+    if (!ins->b) {
+      mem(j, 0xC7, 0, -16);
+      imm32(j, 1);
+    }
+
+    jump(j, -1, to_body);
+    return;
+  }
+
+  /**
+   * Tail calls to other functions pop the frame and jump to the callee, which
+   * returns straight to the caller. The args can't stay in the frame.
+   */
+  if (ins->op == op_tailcall) {
+    movabs(j, rcx, tail_args);
+    for (unsigned int i = 0; i < cs->argc; i++) {
+      mem(j, 0x8B, rax, disp(j, argv + i));
+      put(j, "\x48\x89\x81", 3);
+      imm32(j, 8 * i);
+    }
+
+    mem(j, 0x8B, rsi, -8);
+    mem(j, 0x8B, rdx, -16);
+    if (!ins->b) {
+      byte(j, 0xBA);
+      imm32(j, 1);
+    }
+
+    movabs(j, rcx, &depth);
+    put(j, "\x83\x29\x01\xC9", 4);
+    movabs(j, rdi, tail_args);
+    movabs(j, rax, &get_func(j, cs->sig)->code);
+    put(j, "\xFF\x20", 2);
+    return;
+  }
+
+  /* The result overwrites the first arg. */
+  mem(j, 0x8D, rdi, disp(j, argv));
+  mem(j, 0x8D, rsi, disp(j, argv));
+  put(j, "\x31\xD2", 2);
+  movabs(j, rax, &get_func(j, cs->sig)->code);
+  put(j, "\xFF\x10", 2);
+
+  put(j, "\x85\xC0", 2);
+  jump(j, cc_le, stub(j, stub_fail, line, NULL));
+
+  if (ins->b) {
+    put(j, "\x83\xF8\x02", 3);
+    jump(j, cc_ne, stub(j, stub_noret, line, cs->func));
+  }
+}
+
+static void emit_div(jit_t *j, const unsigned char op, const unsigned int top,
+                     const int line) {
+  mem(j, 0x8B, rax, disp(j, top - 2));
+  mem(j, 0x8B, rcx, disp(j, top - 1));
+
+  put(j, "\x48\x85\xC9", 3);
+  jump(j, cc_e, stub(j, stub_divzero, line, op == op_div ? "/" : "%"));
+
+  /* idiv traps on LLONG_MIN / -1, eval_int() wraps. */
+  put(j, "\x48\x83\xF9\xFF", 4);
+  if (op == op_div)
+    put(j, "\x75\x05\x48\xF7\xD8\xEB\x05\x48\x99\x48\xF7\xF9", 12);
+  else
+    put(j, "\x75\x04\x31\xC0\xEB\x08\x48\x99\x48\xF7\xF9\x48\x89\xD0", 14);
+
+  mem(j, 0x89, rax, disp(j, top - 2));
+}
+
+static void emit_instr(jit_t *j, unsigned int *i) {
+  static const unsigned char alu[] = {
+      [op_add] = 0x03, [op_sub] = 0x2B, [op_band] = 0x23,
+      [op_bor] = 0x0B, [op_bxor] = 0x33};
+  static const unsigned char ccs[] = {cc_l, cc_le, cc_e, cc_ne, cc_g, cc_ge};
+
+  const chunk_t *chunk = j->chunk;
+  const instr_t *ins = &chunk->code[*i];
+  const unsigned int top = chunk->n_slots + j->depth[*i];
+  const int line = chunk->lines[*i];
+
+  switch (ins->op) {
+    case op_const: {
+      const long long k = chunk->consts[ins->a].as.i;
+      if (k == (int)k) {
+        mem(j, 0xC7, 0, disp(j, top));
+        imm32(j, k);
+      } else {
+        movabs(j, rax, (const void *)k);
+        mem(j, 0x89, rax, disp(j, top));
+      }
+      return;
+    }
+
+    case op_load:
+      mem(j, 0x8B, rax, disp(j, ins->a));
+      mem(j, 0x89, rax, disp(j, top));
+      return;
+
+    case op_store:
+      mem(j, 0x8B, rax, disp(j, top - 1));
+      mem(j, 0x89, rax, disp(j, ins->a));
+      return;
+
+    case op_pop:
+    case op_pos:
+      return;
+
+    case op_add:
+    case op_sub:
+    case op_band:
+    case op_bor:
+    case op_bxor:
+      mem(j, 0x8B, rax, disp(j, top - 2));
+      mem(j, alu[ins->op], rax, disp(j, top - 1));
+      mem(j, 0x89, rax, disp(j, top - 2));
+      return;
+
+    case op_mul:
+      mem(j, 0x8B, rax, disp(j, top - 2));
+      put(j, "\x48\x0F\xAF\x85", 4);
+      imm32(j, disp(j, top - 1));
+      mem(j, 0x89, rax, disp(j, top - 2));
+      return;
+
+    case op_div:
+    case op_mod:
+      emit_div(j, ins->op, top, line);
+      return;
+
+    /* The shift count is masked to 6 bits, like eval_int() does. */
+    case op_shl:
+    case op_shr:
+      mem(j, 0x8B, rax, disp(j, top - 2));
+      mem(j, 0x8B, rcx, disp(j, top - 1));
+      put(j, ins->op == op_shl ? "\x48\xD3\xE0" : "\x48\xD3\xF8", 3);
+      mem(j, 0x89, rax, disp(j, top - 2));
+      return;
+
+    case op_neg:
+      mem(j, 0xF7, 3, disp(j, top - 1));
+      return;
+
+    case op_bnot:
+      mem(j, 0xF7, 2, disp(j, top - 1));
+      return;
+
+    /* A condition followed by its jz becomes a single jcc. */
+    case op_lt:
+    case op_le:
+    case op_eq:
+    case op_ne:
+    case op_gt:
+    case op_ge: {
+      const unsigned char cc = ccs[ins->op - op_lt];
+      mem(j, 0x8B, rax, disp(j, top - 2));
+      mem(j, 0x3B, rax, disp(j, top - 1));
+
+      if (*i + 1 < chunk->n_code && ins[1].op == op_jz && !j->target[*i + 1]) {
+        j->at[++*i] = j->n;
+        jump(j, cc ^ 1, ins[1].a);
+        return;
+      }
+
+      byte(j, 0x0F);
+      byte(j, 0x90 | cc);
+      put(j, "\xC0\x0F\xB6\xC0", 4);
+      mem(j, 0x89, rax, disp(j, top - 2));
+      return;
+    }
+
+    case op_jmp:
+      jump(j, -1, ins->a);
+      return;
+
+    case op_jz:
+      mem(j, 0x8B, rax, disp(j, top - 1));
+      put(j, "\x48\x85\xC0", 3);
+      jump(j, cc_e, ins->a);
+      return;
+
+    case op_inc:
+    case op_dec:
+      mem(j, 0x83, ins->op == op_inc ? 0 : 5, disp(j, ins->a));
+      byte(j, 1);
+      return;
+
+    case op_print:
+      mem(j, 0x8B, rdi, disp(j, top - 1));
+      call_abs(j, print_int);
+      return;
+
+    case op_call:
+    case op_tailcall:
+      emit_call(j, ins, top, line);
+      return;
+
+    /* A value returned after a bare tail call is discarded, see emit_call(). */
+    case op_ret:
+      if (ins->b) {
+        mem(j, 0x8B, rax, disp(j, top - 1));
+        mem(j, 0x8B, rcx, -8);
+        put(j, "\x48\x89\x01", 3);
+        byte(j, 0xB8);
+        imm32(j, jit_value);
+        put(j, "\x2B\x85", 2);
+        imm32(j, -16);
+      } else {
+        byte(j, 0xB8);
+        imm32(j, jit_void);
+      }
+      jump(j, -1, to_exit);
+      return;
+
+    case op_leave:
+      byte(j, 0xB8);
+      imm32(j, jit_void);
+      jump(j, -1, to_exit);
+      return;
+  }
+}
+
+static void emit_stubs(jit_t *j, unsigned int *at) {
+  for (unsigned int k = 0; k < j->n_stubs; k++) {
+    const stub_t *s = &j->stubs[k];
+    at[k] = j->n;
+
+    switch (s->kind) {
+      case stub_fail:
+        put(j, "\x89\xC7", 2);
+        byte(j, 0xBE);
+        imm32(j, s->line);
+        call_abs(j, failed);
+        jump(j, -1, to_exit);
+        break;
+      case stub_noret:
+        movabs(j, rdi, s->str);
+        byte(j, 0xBE);
+        imm32(j, s->line);
+        call_abs(j, noret);
+        jump(j, -1, to_exit);
+        break;
+      case stub_divzero:
+        movabs(j, rdi, s->str);
+        byte(j, 0xBE);
+        imm32(j, s->line);
+        call_abs(j, div_zero);
+        break;
+    }
+  }
+}
+
+/**
+ * Emits the code of the function j->sig into j->buf. Frame layout, from rbp -
+ * the res pointer, whether the result is discarded, then the values.
+ */
+static int emit_func(jit_t *j) {
+  const chunk_t *chunk = j->chunk;
+  j->depth = alloc((chunk->n_code + 1) * sizeof(int));
+  j->target = alloc(chunk->n_code + 1);
+  j->at = alloc((chunk->n_code + 1) * sizeof(unsigned int));
+
+  const int max = check_chunk(j);
+  if (max < 0) return 0;
+
+  j->n_vals = chunk->n_slots + max;
+  const int frame = (16 + 8 * j->n_vals + 15) & ~15;
+
+  /* push rbp; mov rbp, rsp; sub rsp, frame */
+  put(j, "\x55\x48\x89\xE5\x48\x81\xEC", 7);
+  imm32(j, frame);
+
+  /* cmp rsp, [stack_limit]; cmp dword [depth], max_depth */
+  movabs(j, rax, &stack_limit);
+  put(j, "\x48\x3B\x20", 3);
+  jump(j, cc_b, to_deep);
+  movabs(j, rax, &depth);
+  put(j, "\x81\x38", 2);
+  imm32(j, j->eval->max_depth);
+  jump(j, cc_ae, to_deep);
+  put(j, "\x83\x00\x01", 3);
+
+  mem(j, 0x89, rsi, -8);
+  mem(j, 0x89, rdx, -16);
+
+  for (unsigned int i = 0; i < chunk->n_args; i++) {
+    put(j, "\x48\x8B\x87", 3);
+    imm32(j, 8 * i);
+    mem(j, 0x89, rax, disp(j, i));
+  }
+
+  j->body = j->n;
+  for (unsigned int i = 0; i < chunk->n_code; i++) {
+    j->at[i] = j->n;
+    emit_instr(j, &i);
+  }
+
+  /* Status is in eax. */
+  j->exit = j->n;
+  movabs(j, rcx, &depth);
+  put(j, "\x83\x29\x01\xC9\xC3", 5);
+
+  j->deep = j->n;
+  byte(j, 0xB8);
+  imm32(j, jit_deep);
+  put(j, "\xC9\xC3", 2);
+
+  unsigned int stubs[j->n_stubs + 1];
+  emit_stubs(j, stubs);
+
+  for (unsigned int k = 0; k < j->n_fixups; k++) {
+    const fixup_t *f = &j->fixups[k];
+    unsigned int to;
+
+    if (f->target >= 0)
+      to = j->at[f->target];
+    else if (f->target == to_exit)
+      to = j->exit;
+    else if (f->target == to_deep)
+      to = j->deep;
+    else if (f->target == to_body)
+      to = j->body;
+    else
+      to = stubs[to_stub - f->target];
+
+    const int rel = (int)to - (int)(f->at + 4);
+    memcpy(&j->buf[f->at], &rel, 4);
+  }
+
+  return 1;
+}
+
+/**
+ * Copies code into executable memory. Pages are only ever writable or
+ * executable, never both.
+ */
+static void *place(const unsigned char *code, const unsigned long len) {
+  if (!arena || arena_used + len > arena_size) {
+    arena_size = len > (1 << 20) ? len : 1 << 20;
+    arena = mmap(NULL, arena_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    arena_used = 0;
+
+    if (arena == MAP_FAILED) {
+      arena = NULL;
+      return NULL;
+    }
+  } else if (mprotect(arena, arena_size, PROT_READ | PROT_WRITE)) {
+    return NULL;
+  }
+
+  unsigned char *fptr = arena + arena_used;
+  memcpy(fptr, code, len);
+  arena_used += (len + 15) & ~15ul;
+
+  return mprotect(arena, arena_size, PROT_READ | PROT_EXEC) ? NULL : fptr;
+}
+
+/**
+ * Native calls fail before rsp goes below this, so that max_depth can be raised
+ * past what the C stack holds. The stack grows down from the end of [stack].
+ */
+static void init_stack_limit(void) {
+  char line[512];
+  unsigned long beg, end;
+  struct rlimit rl;
+
+  stack_limit = 1;
+  FILE *maps = fopen("/proc/self/maps", "r");
+  if (!maps) return;
+
+  while (fgets(line, sizeof line, maps)) {
+    if (!strstr(line, "[stack]") || sscanf(line, "%lx-%lx", &beg, &end) != 2)
+      continue;
+
+    if (!getrlimit(RLIMIT_STACK, &rl) && rl.rlim_cur != RLIM_INFINITY)
+      stack_limit = end - (rl.rlim_cur - rl.rlim_cur / 8);
+    break;
+  }
+
+  fclose(maps);
+}
+
+/**
+ * Adds every function that sig calls (directly or not) and isn't native yet to
+ * set. Returns 0 if any of them can't run natively, -1 if one hasn't been
+ * linked yet - it may be once it has been called.
+ */
+static int collect(eval_t *eval, fsig_t *sig, jit_set_t *set) {
+  set->sigs = grow(set->sigs, &set->cap, set->n, sizeof(fsig_t *));
+  set->sigs[set->n++] = sig;
+
+  for (unsigned int i = 0; i < set->n; i++) {
+    if (!set->sigs[i]->linked) return -1;
+
+    const chunk_t *chunk = compile_func(set->sigs[i], eval->tbl);
+    if (!chunk) return 0;
+
+    for (unsigned int k = 0; k < chunk->n_calls; k++) {
+      fsig_t *callee = chunk->calls[k].sig;
+      if (!callee || callee->no_native) return 0;
+      if (callee->native) continue;
+
+      unsigned int at = 0;
+      while (at < set->n && set->sigs[at] != callee) at++;
+      if (at < set->n) continue;
+
+      set->sigs = grow(set->sigs, &set->cap, set->n, sizeof(fsig_t *));
+      set->sigs[set->n++] = callee;
+    }
+  }
+
+  return 1;
+}
+
+static int compile(eval_t *eval, fsig_t *sig) {
+  if (!stack_limit) init_stack_limit();
+
+  jit_set_t set = {NULL, NULL, 0, 0};
+  const int res = collect(eval, sig, &set);
+  if (res <= 0) {
+    sig->no_native = !res;
+    return 0;
+  }
+
+  set.funcs = alloc(set.n * sizeof(jit_func_t));
+  jit_t jits[set.n];
+
+  for (unsigned int i = 0; i < set.n; i++) {
+    memset(&jits[i], 0, sizeof(jit_t));
+    jits[i].eval = eval;
+    jits[i].set = &set;
+    jits[i].sig = set.sigs[i];
+    jits[i].chunk = set.sigs[i]->chunk;
+    set.funcs[i].n_args = jits[i].chunk->n_args;
+
+    if (!emit_func(&jits[i])) {
+      sig->no_native = 1;
+      return 0;
+    }
+  }
+
+  for (unsigned int i = 0; i < set.n; i++) {
+    void *code = place(jits[i].buf, jits[i].n);
+    if (!code) {
+      sig->no_native = 1;
+      return 0;
+    }
+
+    set.funcs[i].code = (native_t)code;
+  }
+
+  for (unsigned int i = 0; i < set.n; i++) set.sigs[i]->native = &set.funcs[i];
+  return 1;
+}
+
+#endif
+
+int jit_call(eval_t *eval, fsig_t *sig, const value_t *args,
+             const unsigned int argc) {
+#if HAS_JIT
+  if (!eval->jit || sig->no_native) return -1;
+  if (!sig->native && (++sig->hits < eval->jit || !compile(eval, sig)))
+    return -1;
+
+  const jit_func_t *fn = sig->native;
+  if (argc != fn->n_args) return -1;
+
+  long long iargs[argc + 1], res = 0;
+  for (unsigned int i = 0; i < argc; i++) {
+    if (args[i].type != integer) return -1;
+    iargs[i] = args[i].as.i;
+  }
+
+  eval->tbl->has_ret = 0;
+  const int status = fn->code(iargs, &res, 0);
+  if (status <= jit_fail) return failed(status, lno);
+
+  if (status == jit_value) {
+    const value_t val = {integer, {.i = res}};
+    set_ret(eval->tbl, &val);
+  }
+
+  return 1;
+#else
+  return -1;
+#endif
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "eval.h"
+#include "symtbl.h"
+#include "value.h"
+
+/* Machine code is only emitted for x86-64 (System V ABI) on Linux. */
+#if defined(__x86_64__) && defined(__linux__)
+#define HAS_JIT 1
+#else
+#define HAS_JIT 0
+#endif
+
+/**
+ * Runs sig natively once it has been called eval->jit times, with args already
+ * evaluated. What it returns is left in the return register. Returns -1 if sig
+ * must run on an interpreter instead.
+ */
+int jit_call(eval_t *eval, fsig_t *sig, const value_t *args,
+             const unsigned int argc);
@@ -29,7 +29,9 @@ char *trimstr(char *s) {
   return nstr;
 }
 
-int is_bitwise(const char c) { return c == '^' || c == '~'; }
+int is_bitwise(const char c) {
+  return c == '^' || c == '~' || c == '&' || c == '|';
+}
 
 int is_br(const char c) { return c == '{' || c == '}'; }
 
@@ -176,8 +178,8 @@ list_t *lex(char *l) {
       type = string;
       idx = extract_literal(l, buf, sizeof buf);
     } else if (isdigit(l[0])) {
-      type = numeric;
       idx = extract_numeric(l, buf, sizeof buf);
+      type = strchr(buf, '.') ? numeric : integer;
     } else {
       type = identifier;
       idx = extract(l, buf, sizeof buf);
@@ -3,12 +3,22 @@
  * Entry point for the interpreter (Cherry).
  */
 
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "ast.h"
+#include "emit.h"
 #include "eval.h"
+#include "inline.h"
+#include "jit.h"
 #include "lex.h"
+#include "memo.h"
 #include "node.h"
+#include "opt.h"
+#include "par.h"
+#include "sema.h"
 #include "token.h"
 #include "util.h"
 
@@ -16,6 +26,7 @@
 
 FILE *fd = NULL;
 int is_repl = 0;
+int emit = 0;
 
 int get_srcline(char *buf, unsigned long buflen) {
   if (is_repl) {
@@ -26,13 +37,164 @@ int get_srcline(char *buf, unsigned long buflen) {
   return fgets(buf, buflen, fd) != NULL;
 }
 
+/**
+ * Reads the first word of a source line (skipping indentation) into buf. This
+ * is all the front end needs to know about a line inside a function body.
+ */
+void scan_kwd(const char *l, char *buf, const unsigned long buflen) {
+  unsigned long i = 0;
+  while (isspace(*l)) l++;
+  while (i + 1 < buflen && (isalnum(l[i]) || l[i] == '_')) {
+    buf[i] = l[i];
+    i++;
+  }
+
+  buf[i] = '\0';
+}
+
+/**
+ * Skips the body of the function that was just declared and records its byte
+ * range in sig, so that it can be compiled on the first call. Only the first
+ * word of every line is looked at to match blocks with their end. The stream is
+ * left at the matching end so that it goes through add_node() like any other
+ * line.
+ */
+int skip_body(fsig_t *sig, int *lno) {
+  char buf[512], kwd[16];
+  int depth = 1;
+
+  sig->src = fd;
+  sig->body_beg = ftell(fd);
+  sig->body_lno = *lno;
+
+  for (;;) {
+    const long pos = ftell(fd);
+    if (!fgets(buf, sizeof buf, fd)) break;
+
+    (*lno)++;
+
+    /* The rest of a longer line would be taken for the start of the next. */
+    if (!strchr(buf, '\n') && !feof(fd)) {
+      fprintf(stderr, "main.c: line is longer than %d chars L[%d]\n",
+              (int)sizeof buf - 2, *lno);
+      return 0;
+    }
+
+    scan_kwd(buf, kwd, sizeof kwd);
+
+    /* pure def & const def are defs too. */
+    if (!strcmp(kwd, "pure") || !strcmp(kwd, "const"))
+      scan_kwd(strstr(buf, kwd) + strlen(kwd), kwd, sizeof kwd);
+
+    if (!strcmp(kwd, "def")) {
+      fprintf(stderr,
+              "main.c: unexpected def, did you forget to place end? L[%d]\n",
+              *lno);
+      return 0;
+    }
+
+    if (!strcmp(kwd, "if") || !strcmp(kwd, "for") || !strcmp(kwd, "pfor"))
+      depth++;
+    if (!strcmp(kwd, "end") && --depth == 0) {
+      (*lno)--;
+      sig->body_end = pos;
+      sig->lazy = 1;
+      return !fseek(fd, pos, SEEK_SET);
+    }
+  }
+
+  fprintf(stderr, "main.c: missing end for %s()\n", sig->func);
+  return 0;
+}
+
+/**
+ * Handles a single --option. Returns 0 if the option is not recognized.
+ */
+int set_option(eval_t *eval, const char *opt) {
+  if (!strcmp(opt, "--engine=tree")) {
+    eval->engine = engine_tree;
+  } else if (!strcmp(opt, "--engine=vm")) {
+    eval->engine = engine_vm;
+  } else if (!strcmp(opt, "--engine=closure")) {
+    eval->engine = engine_closure;
+  } else if (!strncmp(opt, "--max-depth=", 12)) {
+    char *end;
+    const long depth = strtol(opt + 12, &end, 10);
+    if (*end || depth <= 0) {
+      fprintf(stderr, "main.c: invalid max depth [%s]\n", opt + 12);
+      return 0;
+    }
+
+    eval->max_depth = depth;
+  } else if (!strncmp(opt, "--threads=", 10)) {
+    char *end;
+    const long threads = strtol(opt + 10, &end, 10);
+    if (*end || threads <= 0) {
+      fprintf(stderr, "main.c: invalid thread count [%s]\n", opt + 10);
+      return 0;
+    }
+
+    par_threads = threads;
+  } else if (!strcmp(opt, "--jit") || !strncmp(opt, "--jit=", 6)) {
+    char *end = NULL;
+    const long calls = opt[5] ? strtol(opt + 6, &end, 10) : DEFAULT_JIT_CALLS;
+    if (!HAS_JIT) {
+      fprintf(stderr, "main.c: --jit is only supported on Linux x86-64\n");
+      return 0;
+    }
+
+    if ((end && *end) || calls <= 0) {
+      fprintf(stderr, "main.c: invalid jit threshold [%s]\n", opt + 6);
+      return 0;
+    }
+
+    eval->jit = calls;
+  } else if (!strcmp(opt, "--opt-report")) {
+    opt_report = 1;
+  } else if (!strcmp(opt, "--no-inline")) {
+    no_inline = 1;
+  } else if (!strcmp(opt, "--memoize")) {
+    memoize = 1;
+  } else if (!strcmp(opt, "--warn")) {
+    warns = 1;
+  } else if (!strcmp(opt, "--emit-c")) {
+    emit = 1;
+    quiet_cleanup();
+  } else {
+    fprintf(stderr, "main.c: unknown option [%s]\n", opt);
+    return 0;
+  }
+
+  return 1;
+}
+
 int main(int argc, char **argv) {
-  is_repl = argc == 1;
+  const char *path = NULL;
+  eval_t *eval = init_eval();
+
+  for (int i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "--", 2)) {
+      if (!set_option(eval, argv[i])) {
+        cleanup();
+        return 1;
+      }
+    } else if (!path) {
+      path = argv[i];
+    }
+  }
+
+  is_repl = path == NULL;
+  if (is_repl && emit) {
+    fprintf(stderr, "main.c: --emit-c needs a source file\n");
+    cleanup();
+    return 1;
+  }
 
   if (!is_repl) {
-    fd = fopen(argv[1], "r");
+    fd = fopen(path, "r");
     if (!fd) {
-      fprintf(stderr, "main.c: could not open [%s]\n", argv[1]);
+      fprintf(stderr, "main.c: could not open [%s]\n", path);
+      cleanup();
       return 1;
     }
   } else {
@@ -44,7 +206,6 @@ int main(int argc, char **argv) {
   int ret = 0, lno = 0, blanks = 0;
 
   ast_t *ast = init_ast();
-  eval_t *eval = init_eval();
 
   while (get_srcline(buf, sizeof buf)) {
     lno++;
@@ -100,6 +261,15 @@ int main(int argc, char **argv) {
       ret = 1;
       goto cleanup;
     }
+
+    /* The REPL reads from stdin which can't be rewound, so compile eagerly. */
+    if (!is_repl && node->type == fdecl) {
+      fsig_t *sig = get_fsig(eval->tbl, ((func_node_t *)node->ch)->func);
+      if (!sig || !skip_body(sig, &lno)) {
+        ret = 1;
+        goto cleanup;
+      }
+    }
   }
 
   /* Verify that the AST is valid */
@@ -110,8 +280,13 @@ int main(int argc, char **argv) {
     goto cleanup;
   }
 
-  /* exec */
-  if (!eval_prog(ast, eval)) ret = 1;
+  /* exec, or translate */
+  if (emit) {
+    if (!emit_c(eval->tbl, path, stdout)) ret = 1;
+  } else if (!eval_prog(ast, eval)) {
+    ret = 1;
+  }
+
   if (fd) fclose(fd);
 
 /* Clean up all the heap allocs and return the error code set by the program. */
@@ -0,0 +1,343 @@
+/**
+ * memo.c
+ * Memoization of calls to pure functions.
+ *
+ * A function is pure if its result only depends on its args: it doesn't print
+ * or read, it neither reads nor assigns global vars (global consts are fine),
+ * and every call it makes (deferred or not) is to a builtin without side
+ * effects or to another pure function. Functions calling each other are
+ * assumed pure while their bodies are looked at, a function is only known to
+ * be pure once every function it relied on is.
+ *
+ * Calls to memoized functions whose args are all numbers or strings are
+ * looked up in its memo table before the function is run, and what it
+ * returned is recorded once it has. Memoized functions never make tail calls,
+ * nor do they run natively - the engines record the result where the function
+ * returns. So --memoize skips functions that make tail calls, a pure def is
+ * memoized regardless.
+ */
+
+#include "memo.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ast.h"
+#include "compile.h"
+#include "node.h"
+#include "opt.h"
+#include "util.h"
+
+int memoize = 0;
+
+/* Slots in a memo table, a power of 2. */
+enum { memo_slots = 4096 };
+
+/* What is known about a function, see fsig_t.purity. */
+enum { purity_unknown, purity_pending, purity_pure, purity_impure };
+
+typedef struct walk {
+  symtbl_t *symtbl;
+  /* Function whose body is being looked at. */
+  const fsig_t *sig;
+  /* Lowest index in pending of a function that was assumed pure. */
+  unsigned int low;
+  /* Line of the statement that has side effects. */
+  int lno;
+  /* Set if a function couldn't be looked at, its body is being prepared. */
+  int busy;
+} walk_t;
+
+/* Functions whose bodies are being looked at, innermost last. */
+static fsig_t **pending = NULL;
+static unsigned int n_pending = 0, cap_pending = 0;
+
+static value_t *saved = NULL;
+static unsigned int n_saved = 0, cap_saved = 0;
+
+static int walk_func(walk_t *w, fsig_t *sig);
+
+static int pure_target(walk_t *w, const func_node_t *fnode) {
+  if (pure_call(fnode, w->symtbl)) return 1;
+
+  fsig_t *sig = get_fsig(w->symtbl, fnode->func);
+  return sig && walk_func(w, sig);
+}
+
+/* A global var the function sees under sym, rather than one of its locals. */
+static int global_var(const walk_t *w, const char *sym) {
+  value_t val;
+  return get_global(w->symtbl, sym) && !is_arg(w->sig, sym) &&
+         !global_const(w->symtbl, sym, &val);
+}
+
+static int pure_operand(walk_t *w, const void *buf, const unsigned int type) {
+  switch (type) {
+    case identifier:
+      return !global_var(w, buf);
+
+    case exprtree: {
+      const binary_node_t *node = buf;
+      if (!node->lhs && !node->rhs)
+        return pure_operand(w, node->val->tk, node->val->type);
+      return pure_operand(w, node->lhs, exprtree) &&
+             pure_operand(w, node->rhs, exprtree);
+    }
+
+    case fretval: {
+      const func_node_t *fnode = buf;
+      for (node_t *arg = fnode->args->head; arg; arg = arg->next) {
+        const token_t *tk = arg->data;
+        if (!pure_operand(w, tk->tk, tk->type)) return 0;
+      }
+
+      return pure_target(w, fnode);
+    }
+
+    case indx: {
+      const indx_node_t *ixnode = buf;
+      return pure_operand(w, ixnode->arg->tk, ixnode->arg->type) &&
+             (!ixnode->beg || pure_operand(w, ixnode->beg, ixnode->ltype)) &&
+             (!ixnode->end || pure_operand(w, ixnode->end, ixnode->rtype));
+    }
+  }
+
+  return 1;
+}
+
+static int pure_block(walk_t *w, const list_t *nodes);
+
+static int pure_node(walk_t *w, ast_node_t *node) {
+  switch (node->type) {
+    case post_dec:
+    case post_inc:
+      return !global_var(w, ((unary_node_t *)node->ch)->arg);
+
+    case fbreak:
+    case fcontinue:
+      return 1;
+
+    case fcall:
+    case fdefer:
+      return pure_operand(w, node->ch, fretval);
+
+    case vdecl:
+    case rettype:
+    case cond:
+    case floop:
+    case pfloop: {
+      if (node->type == vdecl && global_var(w, ((decl_node_t *)node->ch)->lhs))
+        return 0;
+
+      void **bufs[2];
+      unsigned int *types[2];
+      const unsigned int n = node_operands(node, bufs, types);
+      for (unsigned int i = 0; i < n; i++)
+        if (!pure_operand(w, *bufs[i], *types[i])) return 0;
+
+      return pure_block(w, node->lch) && pure_block(w, node->rch);
+    }
+  }
+
+  return 0;
+}
+
+static int pure_block(walk_t *w, const list_t *nodes) {
+  for (node_t *n = nodes->head; n; n = n->next) {
+    ast_node_t *node = n->data;
+    if (!pure_node(w, node)) {
+      w->lno = node->lno;
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int walk_func(walk_t *w, fsig_t *sig) {
+  if (sig->purity == purity_pure) return 1;
+  if (sig->purity == purity_impure) return 0;
+
+  if (sig->purity == purity_pending) {
+    unsigned int at = 0;
+    while (pending[at] != sig) at++;
+    if (at < w->low) w->low = at;
+    return 1;
+  }
+
+  /* Nothing is known about it until it's prepared, see opt.c. */
+  if (sig->prepared < 0) {
+    w->busy = 1;
+    return 0;
+  }
+
+  if (!prepare_body(sig, w->symtbl)) return 0;
+
+  const unsigned int at = n_pending, low = w->low;
+  pending = grow(pending, &cap_pending, n_pending, sizeof(fsig_t *));
+  pending[n_pending++] = sig;
+  sig->purity = purity_pending;
+
+  const fsig_t *outer = w->sig;
+  w->low = at;
+  w->sig = sig;
+  const int res = pure_block(w, ((ast_node_t *)sig->node)->lch);
+  w->sig = outer;
+  n_pending--;
+
+  /* Pure only holds once the functions assumed pure on the way are too. */
+  if (!res)
+    sig->purity = w->busy ? purity_unknown : purity_impure;
+  else
+    sig->purity = w->low >= at ? purity_pure : purity_unknown;
+
+  if (low < w->low) w->low = low;
+  return res;
+}
+
+/**
+ * Whether nodes make a call to a function that link_block() would make a tail
+ * call, which memoizing the function would take away.
+ */
+static int tail_calls(const symtbl_t *symtbl, const list_t *nodes,
+                      const int tail) {
+  for (node_t *n = nodes->head; n; n = n->next) {
+    const ast_node_t *node = n->data;
+    const int last = tail && !n->next;
+    const func_node_t *fnode = NULL;
+
+    if (node->type == cond || node->type == floop) {
+      const int btail = last && node->type == cond;
+      if (tail_calls(symtbl, node->lch, btail) ||
+          tail_calls(symtbl, node->rch, btail))
+        return 1;
+    } else if (node->type == rettype) {
+      const return_node_t *rnode = node->ch;
+      if (rnode->val && rnode->type == fretval) fnode = rnode->val;
+    } else if (node->type == fcall && last) {
+      fnode = node->ch;
+    }
+
+    if (fnode && get_fsig(symtbl, fnode->func)) return 1;
+  }
+
+  return 0;
+}
+
+int pure_func(fsig_t *sig, symtbl_t *symtbl) {
+  walk_t w = {symtbl, sig, (unsigned int)-1, 0, 0};
+  return walk_func(&w, sig);
+}
+
+int memo_func(fsig_t *sig, symtbl_t *symtbl) {
+  if (!sig->decl_pure && !memoize) return 1;
+  if (!strcmp(sig->func, "main")) return 1;
+
+  /* --memoize leaves the loops written as tail calls alone. */
+  const list_t *body = ((ast_node_t *)sig->node)->lch;
+  if (!sig->decl_pure && tail_calls(symtbl, body, 1)) return 1;
+
+  walk_t w = {symtbl, sig, (unsigned int)-1, ((ast_node_t *)sig->node)->lno,
+              0};
+  if (!walk_func(&w, sig)) {
+    /* It calls a function that is being prepared, see const calls in opt.c. */
+    if (!sig->decl_pure || w.busy) return 1;
+
+    fprintf(stderr, "memo.c: %s %s() has side effects L[%d]\n",
+            sig->decl_const ? "const" : "pure", sig->func, w.lno);
+    load_lno = w.lno;
+    return 0;
+  }
+
+  memo_t *memo = alloc(sizeof(memo_t));
+  memo->n_slots = 0;
+  memo->keys = memo->vals = NULL;
+  memo->used = NULL;
+
+  sig->memo = memo;
+  sig->no_native = 1;
+  return 1;
+}
+
+static int keyable(const value_t *val) {
+  return val->type == integer || val->type == numeric || val->type == string;
+}
+
+/* Numbers match on their bits, so that 0 and -0 aren't the same key. */
+static int same_key(const value_t *a, const value_t *b) {
+  if (a->type != b->type) return 0;
+  if (a->type == string) return !strcmp(a->as.p, b->as.p);
+  return a->as.i == b->as.i;
+}
+
+/* Returns the slot of args, or -1 if they can't be a key. */
+static long slot_of(const value_t *args, const unsigned int argc) {
+  unsigned long long h = 14695981039346656037ull;
+  for (unsigned int i = 0; i < argc; i++) {
+    const value_t *arg = &args[i];
+    if (!keyable(arg)) return -1;
+
+    unsigned long long k = arg->type;
+    if (arg->type == string) {
+      for (const char *s = arg->as.p; *s; s++) k = k * 31 + (unsigned char)*s;
+    } else {
+      k ^= (unsigned long long)arg->as.i;
+    }
+
+    h = (h ^ k) * 1099511628211ull;
+  }
+
+  return (long)((h ^ h >> 29) & (memo_slots - 1));
+}
+
+int memo_get(const memo_t *memo, const value_t *args, const unsigned int argc,
+             value_t *res) {
+  if (!memo->n_slots) return 0;
+
+  const long slot = slot_of(args, argc);
+  if (slot < 0 || !memo->used[slot]) return 0;
+
+  const value_t *key = &memo->keys[slot * argc];
+  for (unsigned int i = 0; i < argc; i++)
+    if (!same_key(&key[i], &args[i])) return 0;
+
+  *res = memo->vals[slot];
+  return 1;
+}
+
+void memo_put(memo_t *memo, const value_t *args, const unsigned int argc,
+              const value_t *res) {
+  if (!keyable(res)) return;
+
+  const long slot = slot_of(args, argc);
+  if (slot < 0) return;
+
+  if (!memo->n_slots) {
+    memo->keys = alloc(memo_slots * (argc + 1UL) * sizeof(value_t));
+    memo->vals = alloc(memo_slots * sizeof(value_t));
+    memo->used = alloc(memo_slots);
+    memset(memo->used, 0, memo_slots);
+    memo->n_slots = memo_slots;
+  }
+
+  memcpy(&memo->keys[slot * argc], args, argc * sizeof(value_t));
+  memo->vals[slot] = *res;
+  memo->used[slot] = 1;
+}
+
+unsigned int memo_enter(const value_t *args, const unsigned int argc) {
+  const unsigned int mark = n_saved;
+  for (unsigned int i = 0; i < argc; i++) {
+    saved = grow(saved, &cap_saved, n_saved, sizeof(value_t));
+    saved[n_saved++] = args[i];
+  }
+
+  return mark;
+}
+
+/* Whatever a failed call left above mark goes with it. */
+void memo_leave(memo_t *memo, const unsigned int mark, const unsigned int argc,
+                const value_t *res) {
+  if (res) memo_put(memo, &saved[mark], argc, res);
+  n_saved = mark;
+}
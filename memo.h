@@ -0,0 +1,48 @@
+#pragma once
+
+#include "symtbl.h"
+#include "value.h"
+
+/* Set by --memoize, every pure function is memoized, not only pure def ones. */
+extern int memoize;
+
+/**
+ * Results of the last calls to a function, keyed on the values of their args.
+ * The table has a fixed number of slots, a call whose args hash to a slot in
+ * use takes it over. A zeroed memo_t is empty, the translated C declares them
+ * static (see emit.c).
+ */
+typedef struct memo {
+  unsigned int n_slots;
+  /* argc keys per slot. */
+  value_t *keys, *vals;
+  unsigned char *used;
+} memo_t;
+
+/**
+ * Whether the result of sig only depends on its args, i.e, it has no side
+ * effects and only calls functions that don't either.
+ */
+int pure_func(fsig_t *sig, symtbl_t *symtbl);
+
+/**
+ * Decides whether calls to sig are memoized, i.e, sets sig->memo if it's pure
+ * and was declared with pure def or --memoize is set. Fails if a pure def
+ * isn't. Called once the body is prepared, before it's linked.
+ */
+int memo_func(fsig_t *sig, symtbl_t *symtbl);
+
+/* Returns 1 with the result in res if the function was called with args. */
+int memo_get(const memo_t *memo, const value_t *args, const unsigned int argc,
+             value_t *res);
+/* Records res as the result of the call with args. */
+void memo_put(memo_t *memo, const value_t *args, const unsigned int argc,
+              const value_t *res);
+
+/**
+ * For engines whose frames reuse the args as locals: saves args until the call
+ * returns and memo_leave() records what it returned (NULL for nothing).
+ */
+unsigned int memo_enter(const value_t *args, const unsigned int argc);
+void memo_leave(memo_t *memo, const unsigned int mark, const unsigned int argc,
+                const value_t *res);
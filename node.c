@@ -19,6 +19,9 @@ ast_node_t *init_node(list_t *list) {
   node->tokens = list;
   node->type = parse(&node->ch, list);
 
+  /* pure def is a def like any other. */
+  if (node->type == fdecl) node->kwd = "def";
+
   ast_node_t *res = node->type < 0 ? NULL : node;
   if (res && list->size) {
     fprintf(stderr, "node.c: excess tokens at the end for [%s]\n", node->kwd);
@@ -27,3 +30,70 @@ ast_node_t *init_node(list_t *list) {
 
   return res;
 }
+
+ast_node_t *init_decl(char *sym, void *rhs, const unsigned int rtype,
+                      const int lno) {
+  decl_node_t *dnode = alloc(sizeof(decl_node_t));
+  dnode->lhs = sym;
+  dnode->rhs = rhs;
+  dnode->ltype = identifier;
+  dnode->rtype = rtype;
+  dnode->is_const = 0;
+
+  ast_node_t *node = alloc(sizeof(ast_node_t));
+  node->kwd = "var";
+  node->ch = dnode;
+  node->type = vdecl;
+  node->lno = lno;
+  node->tokens = init_list();
+  node->lch = init_list();
+  node->rch = init_list();
+  return node;
+}
+
+unsigned int node_operands(ast_node_t *node, void **bufs[2],
+                          unsigned int *types[2]) {
+  switch (node->type) {
+    case vdecl: {
+      decl_node_t *dnode = node->ch;
+      bufs[0] = &dnode->rhs;
+      types[0] = &dnode->rtype;
+      return 1;
+    }
+
+    case cout: {
+      print_node_t *pnode = node->ch;
+      bufs[0] = &pnode->arg;
+      types[0] = &pnode->type;
+      return 1;
+    }
+
+    case rettype: {
+      return_node_t *rnode = node->ch;
+      bufs[0] = &rnode->val;
+      types[0] = &rnode->type;
+      return rnode->val != NULL;
+    }
+
+    case cond:
+    case floop: {
+      cnode_t *cnode = node->ch;
+      bufs[0] = &cnode->lhs;
+      types[0] = &cnode->ltype;
+      bufs[1] = &cnode->rhs;
+      types[1] = &cnode->rtype;
+      return 2;
+    }
+
+    case pfloop: {
+      pfor_node_t *pnode = node->ch;
+      bufs[0] = &pnode->beg;
+      types[0] = &pnode->btype;
+      bufs[1] = &pnode->end;
+      types[1] = &pnode->etype;
+      return 2;
+    }
+  }
+
+  return 0;
+}
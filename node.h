@@ -16,6 +16,9 @@ enum {
   post_dec,
   post_inc,
   rettype,
+  fbreak,
+  fcontinue,
+  pfloop,
   nreq,
   cbd
 };
@@ -25,14 +28,49 @@ typedef struct token token_t;
 typedef struct bnode {
   token_t *val;
   void *lhs, *rhs;
+  /**
+   * Set by types.c: integer or numeric if the tree always evals to one (and
+   * its leaves are numbers), unknown otherwise.
+   */
+  unsigned int type;
 } binary_node_t;
 
 typedef struct cnode {
   char *op;
   void *lhs, *rhs;
   unsigned int ltype, rtype;
+  /**
+   * Set by types.c: integer if both operands are always integers, numeric if
+   * they're numbers, string if they're strings and unknown otherwise.
+   */
+  unsigned int type;
+  /**
+   * Set by opt.c on the condition of a counted for - lhs is a var that nothing
+   * in the body assigns but step, a ++/-- of it at the top of the body, and
+   * rhs is an integer or a var the body doesn't assign.
+   */
+  struct ast_node *step;
 } cnode_t;
 
+/* An accumulator of a pfor, reduced with op ('+' or '*'), see par.c. */
+typedef struct reduce {
+  const char *sym;
+  char op;
+} reduce_t;
+
+/**
+ * pfor var = beg, end. reads & accs are set by check_par() - the vars declared
+ * outside of the pfor that its body reads, and those it reduces into.
+ */
+typedef struct pfor_node {
+  char *var;
+  void *beg, *end;
+  unsigned int btype, etype;
+  list_t *reads, *accs;
+  /* Closures of the body, compiled on its first run. */
+  struct par_body *body;
+} pfor_node_t;
+
 typedef struct decl_node {
   char *lhs;
   void *rhs;
@@ -41,14 +79,42 @@ typedef struct decl_node {
 
 typedef struct func_node {
   int defer;
+  /**
+   * Set by link_block() if the call is in tail position - a bare call that
+   * ends the function or the value of a return. Tail calls reuse the frame of
+   * the caller instead of pushing a new one.
+   */
+  int tail;
+  /**
+   * Set on the def of a function declared with pure def (see memo.c), is_const
+   * too if it was declared with const def (see opt.c).
+   */
+  int pure, is_const;
   char *func;
   list_t *args;
+  /**
+   * Target of the call, linked once when the function containing the call is
+   * loaded (see link_body()). sig for user defined functions, builtin for
+   * builtins.
+   */
+  struct fsig *sig;
+  const struct builtin *builtin;
+  /* Set by types.c on calls to builtins whose args are known to fit. */
+  int typed;
 } func_node_t;
 
 typedef struct {
   token_t *arg;
   void *beg, *end;
   unsigned int schar, ltype, rtype;
+  /* Set by types.c if arg is known to be a string and the bounds numbers. */
+  int typed;
+  /**
+   * Set by opt.c if arg is a literal of length len, and the bounds are always
+   * integers within it (see slice_in_range()).
+   */
+  int in_range;
+  unsigned long len;
 } indx_node_t;
 
 typedef struct print_node {
@@ -76,4 +142,13 @@ typedef struct ast_node {
   list_t *tokens, *lch, *rch;
 } ast_node_t;
 
-ast_node_t *init_node(list_t *list);
\ No newline at end of file
+ast_node_t *init_node(list_t *list);
+/* var sym = rhs, for decls that weren't parsed from a line (see opt.c). */
+ast_node_t *init_decl(char *sym, void *rhs, const unsigned int rtype,
+                      const int lno);
+/**
+ * Points bufs & types at the operands node evals before anything else (e.g, the
+ * condition of an if), returns how many.
+ */
+unsigned int node_operands(ast_node_t *node, void **bufs[2],
+                           unsigned int *types[2]);
@@ -0,0 +1,380 @@
+#include "num.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Every power of 10 up to 1e22 is exactly representable as a double. */
+static const double k_pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                 1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/**
+ * Parses a decimal integer literal. Returns 0 if s is not an integer or does
+ * not fit into 64 bits, in which case the literal is read as a double.
+ */
+int parse_int(const char *s, long long *num) {
+  uint64_t v = 0;
+  const char *p = s;
+
+  if (*p < '0' || *p > '9') return 0;
+
+  for (; *p >= '0' && *p <= '9'; p++) {
+    if (v > (INT64_MAX - (*p - '0')) / 10) return 0;
+    v = v * 10 + (*p - '0');
+  }
+
+  if (*p != '\0') return 0;
+
+  *num = v;
+  return 1;
+}
+
+/**
+ * Parses a decimal literal - digits, an optional fraction and an optional
+ * exponent. Returns 0 if s is not a valid number.
+ *
+ * Literals in scripts are almost always short, so the digits are accumulated
+ * into a 64 bit mantissa. If the mantissa fits into 53 bits and the decimal
+ * exponent is within [-22, 22], both the mantissa and the power of ten are
+ * exact doubles and a single multiplication or division rounds correctly
+ * (Clinger's fast path). Everything else falls back to strtod().
+ */
+int parse_num(const char *s, double *num) {
+  const char *p = s;
+  uint64_t mant = 0;
+  int digits = 0, exp = 0, seen = 0;
+
+  while (*p >= '0' && *p <= '9') {
+    if (digits < 19) {
+      mant = mant * 10 + (*p - '0');
+      if (mant) digits++;
+    } else {
+      exp++;
+    }
+
+    seen = 1;
+    p++;
+  }
+
+  if (*p == '.') {
+    p++;
+    while (*p >= '0' && *p <= '9') {
+      if (digits < 19) {
+        mant = mant * 10 + (*p - '0');
+        if (mant) digits++;
+        exp--;
+      }
+
+      seen = 1;
+      p++;
+    }
+  }
+
+  if (!seen) return 0;
+
+  if (*p == 'e' || *p == 'E') {
+    int neg = 0, e = 0;
+    p++;
+
+    if (*p == '+' || *p == '-') neg = *p++ == '-';
+    if (*p < '0' || *p > '9') return 0;
+
+    while (*p >= '0' && *p <= '9') {
+      if (e < 10000) e = e * 10 + (*p - '0');
+      p++;
+    }
+
+    exp += neg ? -e : e;
+  }
+
+  if (*p != '\0') return 0;
+
+  if (mant <= (1ULL << 53) && exp >= -22 && exp <= 22) {
+    *num = exp < 0 ? (double)mant / k_pow10[-exp] : (double)mant * k_pow10[exp];
+    return 1;
+  }
+
+  char *endptr;
+  *num = strtod(s, &endptr);
+  return *endptr == '\0';
+}
+
+/* Writes out the decimal digits of num without going through printf(). */
+int fmt_int(const long long num, char *buf, const unsigned long buflen) {
+  char tmp[24];
+  uint64_t u = num < 0 ? -(uint64_t)num : (uint64_t)num;
+  int i = sizeof tmp;
+
+  tmp[--i] = '\0';
+  do {
+    tmp[--i] = '0' + u % 10;
+    u /= 10;
+  } while (u);
+
+  if (num < 0) tmp[--i] = '-';
+  return snprintf(buf, buflen, "%s", &tmp[i]);
+}
+
+/**
+ * Shortest digits, the Grisu3 algorithm (Loitsch, "Printing Floating-Point
+ * Numbers Quickly and Accurately with Integers"). The boundaries of the
+ * interval of reals that read back as num are scaled by a cached power of ten,
+ * so that the digits come out of 64 bit integer arithmetic alone. The scaling
+ * isn't exact, Grisu3 gives up on the few numbers (about 0.5%) whose digits
+ * it can't prove to be the shortest & closest, those go through printf().
+ */
+
+typedef struct fp {
+  uint64_t f;
+  int e;
+} fp_t;
+
+/* 10^k for k = -348, -340, ..., 340, normalized to 64 bit significands. */
+static const fp_t k_cached[] = {
+    {0xfa8fd5a0081c0288ull, -1220}, {0xbaaee17fa23ebf76ull, -1193},
+    {0x8b16fb203055ac76ull, -1166}, {0xcf42894a5dce35eaull, -1140},
+    {0x9a6bb0aa55653b2dull, -1113}, {0xe61acf033d1a45dfull, -1087},
+    {0xab70fe17c79ac6caull, -1060}, {0xff77b1fcbebcdc4full, -1034},
+    {0xbe5691ef416bd60cull, -1007}, {0x8dd01fad907ffc3cull, -980},
+    {0xd3515c2831559a83ull, -954}, {0x9d71ac8fada6c9b5ull, -927},
+    {0xea9c227723ee8bcbull, -901}, {0xaecc49914078536dull, -874},
+    {0x823c12795db6ce57ull, -847}, {0xc21094364dfb5637ull, -821},
+    {0x9096ea6f3848984full, -794}, {0xd77485cb25823ac7ull, -768},
+    {0xa086cfcd97bf97f4ull, -741}, {0xef340a98172aace5ull, -715},
+    {0xb23867fb2a35b28eull, -688}, {0x84c8d4dfd2c63f3bull, -661},
+    {0xc5dd44271ad3cdbaull, -635}, {0x936b9fcebb25c996ull, -608},
+    {0xdbac6c247d62a584ull, -582}, {0xa3ab66580d5fdaf6ull, -555},
+    {0xf3e2f893dec3f126ull, -529}, {0xb5b5ada8aaff80b8ull, -502},
+    {0x87625f056c7c4a8bull, -475}, {0xc9bcff6034c13053ull, -449},
+    {0x964e858c91ba2655ull, -422}, {0xdff9772470297ebdull, -396},
+    {0xa6dfbd9fb8e5b88full, -369}, {0xf8a95fcf88747d94ull, -343},
+    {0xb94470938fa89bcfull, -316}, {0x8a08f0f8bf0f156bull, -289},
+    {0xcdb02555653131b6ull, -263}, {0x993fe2c6d07b7facull, -236},
+    {0xe45c10c42a2b3b06ull, -210}, {0xaa242499697392d3ull, -183},
+    {0xfd87b5f28300ca0eull, -157}, {0xbce5086492111aebull, -130},
+    {0x8cbccc096f5088ccull, -103}, {0xd1b71758e219652cull, -77},
+    {0x9c40000000000000ull, -50}, {0xe8d4a51000000000ull, -24},
+    {0xad78ebc5ac620000ull, 3}, {0x813f3978f8940984ull, 30},
+    {0xc097ce7bc90715b3ull, 56}, {0x8f7e32ce7bea5c70ull, 83},
+    {0xd5d238a4abe98068ull, 109}, {0x9f4f2726179a2245ull, 136},
+    {0xed63a231d4c4fb27ull, 162}, {0xb0de65388cc8ada8ull, 189},
+    {0x83c7088e1aab65dbull, 216}, {0xc45d1df942711d9aull, 242},
+    {0x924d692ca61be758ull, 269}, {0xda01ee641a708deaull, 295},
+    {0xa26da3999aef774aull, 322}, {0xf209787bb47d6b85ull, 348},
+    {0xb454e4a179dd1877ull, 375}, {0x865b86925b9bc5c2ull, 402},
+    {0xc83553c5c8965d3dull, 428}, {0x952ab45cfa97a0b3ull, 455},
+    {0xde469fbd99a05fe3ull, 481}, {0xa59bc234db398c25ull, 508},
+    {0xf6c69a72a3989f5cull, 534}, {0xb7dcbf5354e9beceull, 561},
+    {0x88fcf317f22241e2ull, 588}, {0xcc20ce9bd35c78a5ull, 614},
+    {0x98165af37b2153dfull, 641}, {0xe2a0b5dc971f303aull, 667},
+    {0xa8d9d1535ce3b396ull, 694}, {0xfb9b7cd9a4a7443cull, 720},
+    {0xbb764c4ca7a44410ull, 747}, {0x8bab8eefb6409c1aull, 774},
+    {0xd01fef10a657842cull, 800}, {0x9b10a4e5e9913129ull, 827},
+    {0xe7109bfba19c0c9dull, 853}, {0xac2820d9623bf429ull, 880},
+    {0x80444b5e7aa7cf85ull, 907}, {0xbf21e44003acdd2dull, 933},
+    {0x8e679c2f5e44ff8full, 960}, {0xd433179d9c8cb841ull, 986},
+    {0x9e19db92b4e31ba9ull, 1013}, {0xeb96bf6ebadf77d9ull, 1039},
+    {0xaf87023b9bf0ee6bull, 1066}};
+
+enum { k_first_cached = -348, k_cached_step = 8 };
+
+static const uint64_t k_hidden = 1ull << 52;
+
+/* The 64 most significant bits of a * b, rounded. */
+static fp_t fp_mul(const fp_t a, const fp_t b) {
+  const uint64_t lo = 0xffffffffull;
+  const uint64_t ah_bl = (a.f >> 32) * (b.f & lo);
+  const uint64_t al_bh = (a.f & lo) * (b.f >> 32);
+  const uint64_t al_bl = (a.f & lo) * (b.f & lo);
+  const uint64_t ah_bh = (a.f >> 32) * (b.f >> 32);
+  const uint64_t mid =
+      (ah_bl & lo) + (al_bh & lo) + (al_bl >> 32) + (1ull << 31);
+
+  const fp_t r = {ah_bh + (ah_bl >> 32) + (al_bh >> 32) + (mid >> 32),
+                  a.e + b.e + 64};
+  return r;
+}
+
+static fp_t fp_normalize(fp_t x) {
+  while (!(x.f >> 63)) {
+    x.f <<= 1;
+    x.e--;
+  }
+
+  return x;
+}
+
+/* Cached power c with -60 <= e + c.e + 64 <= -32, sets k so that c ~ 10^k. */
+static fp_t cached_pow10(const int e, int *k) {
+  const double log10_2 = 0.30102999566398114;
+  int i = ((int)ceil((-61 - e) * log10_2) - k_first_cached) / k_cached_step;
+  for (;;) {
+    const int at = e + k_cached[i].e + 64;
+    if (at < -60) {
+      i++;
+    } else if (at > -32) {
+      i--;
+    } else {
+      *k = k_first_cached + i * k_cached_step;
+      return k_cached[i];
+    }
+  }
+}
+
+/**
+ * Moves the last digit down while that gets it closer to w, 0 if the digits
+ * can't be proven to be the closest ones inside the interval.
+ */
+static int round_weed(char *digits, const int n, const uint64_t dist,
+                      const uint64_t unsafe, uint64_t rest,
+                      const uint64_t ten_kappa, const uint64_t unit) {
+  const uint64_t small = dist - unit, big = dist + unit;
+  while (rest < small && unsafe - rest >= ten_kappa &&
+         (rest + ten_kappa < small ||
+          small - rest >= rest + ten_kappa - small)) {
+    digits[n - 1]--;
+    rest += ten_kappa;
+  }
+
+  if (rest < big && unsafe - rest >= ten_kappa &&
+      (rest + ten_kappa < big || big - rest > rest + ten_kappa - big))
+    return 0;
+
+  return 2 * unit <= rest && rest <= unsafe - 4 * unit;
+}
+
+/**
+ * Writes the shortest digits of num (finite, positive) into digits, num is
+ * digits * 10^*exp. Returns how many there are, 0 if they can't be proven.
+ */
+static int shortest(const double num, char *digits, int *exp) {
+  static const uint64_t tens[] = {1000000000, 100000000, 10000000, 1000000,
+                                  100000,     10000,     1000,     100,
+                                  10,         1};
+  uint64_t bits;
+  memcpy(&bits, &num, sizeof bits);
+
+  fp_t v = {bits & (k_hidden - 1), (int)(bits >> 52 & 0x7ff)};
+  if (v.e) {
+    v.f += k_hidden;
+    v.e -= 1075;
+  } else {
+    v.e = -1074;
+  }
+
+  /* The interval is halfway to the neighbours of num, narrower below 2^e. */
+  fp_t upper = {(v.f << 1) + 1, v.e - 1};
+  upper = fp_normalize(upper);
+  const int below = v.f == k_hidden ? 2 : 1;
+  fp_t lower = {(v.f << below) - 1, v.e - below};
+  lower.f <<= lower.e - upper.e;
+  lower.e = upper.e;
+
+  int k;
+  const fp_t c = cached_pow10(upper.e, &k);
+  const fp_t w = fp_mul(fp_normalize(v), c);
+  upper = fp_mul(upper, c);
+  lower = fp_mul(lower, c);
+
+  /* Each product is off by up to one unit, the interval is widened by it. */
+  uint64_t unit = 1;
+  const uint64_t too_high = upper.f + unit;
+  uint64_t unsafe = too_high - (lower.f - unit);
+
+  /* too_high is split at the point, the integral part fits into 32 bits. */
+  const int shift = -upper.e;
+  const uint64_t one = 1ull << shift, mask = one - 1;
+  uint64_t hi = too_high >> shift, lo = too_high & mask;
+  unsigned int i = 0;
+  int n = 0;
+  while (tens[i] > hi) i++;
+  *exp = -k + 10 - (int)i;
+
+  for (; i < 10; i++) {
+    digits[n++] = (char)('0' + hi / tens[i]);
+    hi %= tens[i];
+    --*exp;
+
+    const uint64_t rest = (hi << shift) + lo;
+    if (rest < unsafe)
+      return round_weed(digits, n, too_high - w.f, unsafe, rest,
+                        tens[i] << shift, unit)
+                 ? n
+                 : 0;
+  }
+
+  for (;;) {
+    lo *= 10;
+    unit *= 10;
+    unsafe *= 10;
+    digits[n++] = (char)('0' + (lo >> shift));
+    lo &= mask;
+    --*exp;
+
+    if (lo < unsafe)
+      return round_weed(digits, n, (too_high - w.f) * unit, unsafe, lo, one,
+                        unit)
+                 ? n
+                 : 0;
+  }
+}
+
+/**
+ * Formats num with the fewest significant digits that read back as the same
+ * double, laid out the way printf() lays out %.<p>g with p the larger of 15
+ * and that number of digits. Integral values are written out directly.
+ */
+int fmt_num(const double num, char *buf, const unsigned long buflen) {
+  if (num == 0) return snprintf(buf, buflen, signbit(num) ? "-0" : "0");
+  if (!isfinite(num)) return snprintf(buf, buflen, "%g", num);
+
+  if (fabs(num) < 9007199254740992.0 && num == (double)(int64_t)num)
+    return fmt_int(num, buf, buflen);
+
+  char digits[24], out[40];
+  int exp, len = 0;
+  const int n = shortest(fabs(num), digits, &exp);
+  if (!n) {
+    /* 17 significant digits always round-trip, 15 are exact for most input. */
+    for (int prec = 15; prec <= 17; prec++) {
+      len = snprintf(buf, buflen, "%.*g", prec, num);
+      if (strtod(buf, NULL) == num) break;
+    }
+
+    return len;
+  }
+
+  /* The exponent of num in scientific notation. */
+  const int x = n + exp - 1, p = n > 15 ? n : 15;
+
+  if (num < 0) out[len++] = '-';
+  if (x < -4 || x >= p) {
+    out[len++] = digits[0];
+    if (n > 1) out[len++] = '.';
+    for (int i = 1; i < n; i++) out[len++] = digits[i];
+
+    out[len++] = 'e';
+    out[len++] = x < 0 ? '-' : '+';
+    const int ax = x < 0 ? -x : x;
+    if (ax >= 100) out[len++] = (char)('0' + ax / 100);
+    out[len++] = (char)('0' + ax / 10 % 10);
+    out[len++] = (char)('0' + ax % 10);
+  } else if (x < 0) {
+    out[len++] = '0';
+    out[len++] = '.';
+    for (int i = -1; i > x; i--) out[len++] = '0';
+    for (int i = 0; i < n; i++) out[len++] = digits[i];
+  } else {
+    for (int i = 0; i <= x || i < n; i++) {
+      if (i == x + 1) out[len++] = '.';
+      out[len++] = i < n ? digits[i] : '0';
+    }
+  }
+
+  out[len] = '\0';
+  return snprintf(buf, buflen, "%s", out);
+}
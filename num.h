@@ -0,0 +1,6 @@
+#pragma once
+
+int parse_int(const char *s, long long *num);
+int parse_num(const char *s, double *num);
+int fmt_int(const long long num, char *buf, const unsigned long buflen);
+int fmt_num(const double num, char *buf, const unsigned long buflen);
@@ -0,0 +1,1366 @@
+/**
+ * opt.c
+ * Constant propagation & dead code elimination on the AST of a function.
+ *
+ * Syms are resolved to slots with the same block scopes the compilers use (see
+ * compile.h), and the value of every slot is tracked while the body is walked
+ * in order. A slot is known as long as every path to the statement at hand
+ * left the same number or string in it. Operands that only depend on known
+ * slots are folded into literals, so are comparisons and calls to builtins
+ * without side effects. Branches that can never run, and statements that come
+ * after a return, break or continue, are removed.
+ *
+ * Nothing that would fail at runtime (e.g, an integer division by zero) is
+ * folded, it's left to fail where it is. The pass stops at anything the scopes
+ * can't follow, e.g, a write to a const.
+ *
+ * Then subexpressions without side effects (exprtrees, slices and calls to
+ * pure builtins) that a for evals the same way on every iteration are hoisted
+ * out of it, and those a statement repeats are evaled once before it. Both
+ * are stored in temps (see temp_sym()).
+ *
+ * Last, a for that steps a var with ++/-- until it reaches a bound that doesn't
+ * change is marked as counted, the tree-walker keeps its count natively.
+ *
+ * Calls to a const def whose args are all known are run right away, on the
+ * tree-walker, and replaced with what they return. A const def is a pure def
+ * (see memo.c) that is trusted to return on such args: if the call fails, so
+ * does the load of the caller, whether or not the call would have been reached.
+ */
+
+#include "opt.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "args.h"
+#include "ast.h"
+#include "builtin.h"
+#include "compile.h"
+#include "eval.h"
+#include "expr.h"
+#include "memo.h"
+#include "node.h"
+#include "token.h"
+#include "util.h"
+
+int opt_report = 0;
+
+/**
+ * A subexpression, and what holds it: the operand buf, or the exprtree it's a
+ * subtree of if buf is NULL.
+ */
+typedef struct site {
+  void *expr;
+  unsigned int type;
+  void **buf;
+  unsigned int *btype;
+  int lno;
+} site_t;
+
+typedef struct sites {
+  site_t *arr;
+  unsigned int n, cap;
+} sites_t;
+
+typedef struct opt {
+  fsig_t *sig;
+  symtbl_t *symtbl;
+  scope_t scope;
+  /* Value of every slot, only valid where known is set. */
+  value_t *vals;
+  unsigned char *known;
+  unsigned int cap;
+  int ok, folds;
+  /* Line of the statement at hand, set if a const call failed. */
+  int lno, failed;
+  /* Scratch space of licm() & cse(), kept across functions. */
+  sites_t sites;
+} opt_t;
+
+/* What opt_block() does with a node once it's been optimized. */
+enum { keep_node, drop_node, splice_lch, splice_rch };
+
+/* Builtins without side effects. */
+static const char *pure[] = {"cmp", "len", "idx", "rev", "type"};
+
+char *temp_sym(const char *sym) {
+  static unsigned int n = 0;
+  const unsigned long len = (sym ? strlen(sym) : 0) + 16;
+  char *temp = alloc(len);
+  snprintf(temp, len, "%s$%u", sym ? sym : "", n++);
+  return temp;
+}
+
+static void report(const opt_t *o, const int lno, const char *what) {
+  if (opt_report)
+    fprintf(stderr, "opt.c: %s() L[%d] %s\n", o->sig->func, lno, what);
+}
+
+static int is_literal(const unsigned int type) {
+  return type == string || is_num(type);
+}
+
+/* Makes room for every slot declared so far, new slots aren't known. */
+static void track(opt_t *o) {
+  while (o->cap < o->scope.n_slots) {
+    const unsigned int n = o->cap;
+    unsigned int cap = n;
+    o->known = grow(o->known, &cap, n, sizeof(unsigned char));
+    o->vals = grow(o->vals, &o->cap, n, sizeof(value_t));
+    memset(o->known + n, 0, o->cap - n);
+  }
+}
+
+/* val is NULL if the value of slot isn't known. */
+static void set_slot(opt_t *o, const int slot, const value_t *val) {
+  track(o);
+  o->known[slot] = val && is_literal(val->type);
+  if (o->known[slot]) o->vals[slot] = *val;
+}
+
+static int same_value(const value_t *a, const value_t *b) {
+  if (a->type != b->type) return 0;
+  if (a->type == integer) return a->as.i == b->as.i;
+  if (a->type == numeric) return !memcmp(&a->as.d, &b->as.d, sizeof(double));
+  return !strcmp(a->as.p, b->as.p);
+}
+
+/* Reads sym into val if its value is known at this point. */
+static int lookup(const opt_t *o, const char *sym, value_t *val) {
+  const cvar_t *v = resolve_sym(&o->scope, sym);
+  if (v) {
+    if ((unsigned int)v->slot >= o->cap || !o->known[v->slot]) return 0;
+
+    *val = o->vals[v->slot];
+    return 1;
+  }
+
+  return global_const(o->symtbl, sym, val);
+}
+
+/* Points buf at a copy of val, the way the parser stores literals. */
+static void set_literal(void **buf, unsigned int *type, const value_t *val) {
+  *type = val->type;
+  if (val->type == integer) {
+    long long *i = alloc(sizeof(long long));
+    *i = val->as.i;
+    *buf = i;
+  } else if (val->type == numeric) {
+    double *d = alloc(sizeof(double));
+    *d = val->as.d;
+    *buf = d;
+  } else {
+    /* Strings are never modified in place, they can be shared. */
+    *buf = val->as.p;
+  }
+}
+
+/* Replaces the token *tk with a literal if it's a sym with a known value. */
+static int fold_token(opt_t *o, token_t **tk, value_t *val) {
+  if (is_literal((*tk)->type)) {
+    *val = to_value(*tk);
+    return 1;
+  }
+
+  if ((*tk)->type != identifier || !lookup(o, (*tk)->tk, val)) return 0;
+
+  token_t *lit = alloc(sizeof(token_t));
+  set_literal(&lit->tk, &lit->type, val);
+  *tk = lit;
+  o->folds++;
+  return 1;
+}
+
+/* Whether eval_expr() can eval op on lhs & rhs, it exits on failure. */
+static int can_eval(const value_t *lhs, const value_t *rhs, const char *op) {
+  if (!is_num(lhs->type) || !is_num(rhs->type)) return 0;
+
+  const int unary = op[0] == 'u' || op[0] == '~';
+  if ((unary || lhs->type == integer) && rhs->type == integer)
+    return (op[0] != '/' && op[0] != '%') || rhs->as.i != 0;
+
+  return strchr("+-*/%u", op[0]) != NULL;
+}
+
+/**
+ * Folds every subtree of node that only depends on known values into a leaf.
+ * Returns 1 if node itself was, with its value in val.
+ */
+static int fold_tree(opt_t *o, binary_node_t *node, value_t *val) {
+  if (!node->lhs && !node->rhs) return fold_token(o, &node->val, val);
+
+  value_t l, r;
+  const int lc = fold_tree(o, node->lhs, &l);
+  const int rc = fold_tree(o, node->rhs, &r);
+  if (!lc || !rc || !can_eval(&l, &r, node->val->tk)) return 0;
+
+  eval_expr(&l, &r, node->val->tk, val);
+
+  token_t *lit = alloc(sizeof(token_t));
+  set_literal(&lit->tk, &lit->type, val);
+  node->val = lit;
+  node->lhs = node->rhs = NULL;
+  o->folds++;
+  return 1;
+}
+
+int pure_call(const func_node_t *fnode, const symtbl_t *symtbl) {
+  for (unsigned int i = 0; i < sizeof pure / sizeof(char *); i++)
+    if (!strcmp(fnode->func, pure[i])) return !get_fsig(symtbl, fnode->func);
+
+  return 0;
+}
+
+static int is_pure_call(const opt_t *o, const func_node_t *fnode) {
+  return pure_call(fnode, o->symtbl);
+}
+
+static const builtin_t *pure_builtin(const opt_t *o, const func_node_t *fnode,
+                                     const value_t *args) {
+  if (!is_pure_call(o, fnode)) return NULL;
+
+  const builtin_t *builtin = get_builtin(fnode->func);
+  if (!builtin || builtin->n_args != (int)fnode->args->size) return NULL;
+
+  for (unsigned int i = 0; i < fnode->args->size; i++)
+    if (builtin->argtypes[i] != -1 &&
+        !type_fits(args[i].type, builtin->argtypes[i]))
+      return NULL;
+
+  return builtin;
+}
+
+/* Runs a call to a const def, see above. Returns 1 if val can be folded. */
+static int fold_const(opt_t *o, const func_node_t *fnode, value_t *args,
+                      value_t *val) {
+  fsig_t *callee = get_fsig(o->symtbl, fnode->func);
+  if (!callee || !callee->decl_const) return 0;
+  if (callee->args->size != fnode->args->size) return 0;
+
+  /* One that isn't pure fails once it's loaded, see memo_func(). */
+  if (!pure_func(callee, o->symtbl)) return 0;
+
+  if (!eval_const(o->symtbl, callee, args, fnode->args->size, val)) {
+    fprintf(stderr, "opt.c: could not run const %s() L[%d]\n", fnode->func,
+            o->lno);
+    load_lno = o->lno;
+    o->ok = 0;
+    o->failed = 1;
+    return 0;
+  }
+
+  if (!is_literal(val->type)) return 0;
+
+  char buf[64];
+  snprintf(buf, sizeof buf, "call to %s() run at load time", fnode->func);
+  report(o, o->lno, buf);
+  return 1;
+}
+
+/**
+ * Folds the args of fnode. Returns 1 if it's a call to a pure builtin or a
+ * const def whose args are all known, with its result in val unless val is
+ * NULL (calls to const defs are only run for their result).
+ */
+static int fold_call(opt_t *o, func_node_t *fnode, value_t *val) {
+  const unsigned int argc = fnode->args->size;
+  value_t args[argc + 1];
+  int known = 1;
+
+  unsigned int i = 0;
+  for (node_t *arg = fnode->args->head; arg; arg = arg->next, i++)
+    known &= fold_token(o, (token_t **)&arg->data, &args[i]);
+
+  if (known && val && get_fsig(o->symtbl, fnode->func))
+    return fold_const(o, fnode, args, val);
+
+  const builtin_t *builtin = known ? pure_builtin(o, fnode, args) : NULL;
+  if (!builtin) return 0;
+  if (!val) return 1;
+
+  /* The result is taken out of the return register of a symtbl of our own. */
+  static symtbl_t *tbl = NULL;
+  if (!tbl) tbl = init_symtbl();
+
+  token_t tks[argc + 1];
+  const token_t *fargs[argc + 1];
+  for (i = 0; i < argc; i++) {
+    tks[i] = value_token(&args[i]);
+    fargs[i] = &tks[i];
+  }
+
+  return call_builtin(builtin, fargs, argc, tbl) && take_ret(tbl, val);
+}
+
+/* Values the var of a counted for has in (part of) its body. */
+typedef struct range {
+  const char *sym;
+  long long lo, hi;
+} range_t;
+
+/* Bigger coefficients & values aren't looked at, nothing can overflow. */
+enum { max_linear = 1 << 30 };
+
+/**
+ * Reads the operand as lin[0] * sym + lin[1], sym being the var of r (NULL if
+ * there's none). Fails unless it only holds integers, sym, +, - and products
+ * with an integer.
+ */
+static int linear(const range_t *r, const void *buf, const unsigned int type,
+                  long long lin[2]) {
+  long long a[2], b[2];
+
+  if (type == integer) {
+    lin[0] = 0;
+    lin[1] = *(const long long *)buf;
+  } else if (type == identifier) {
+    if (!r || strcmp(buf, r->sym)) return 0;
+    lin[0] = 1;
+    lin[1] = 0;
+  } else if (type == exprtree) {
+    const binary_node_t *node = buf;
+    if (!node->lhs) return linear(r, node->val->tk, node->val->type, lin);
+    if (!linear(r, node->lhs, exprtree, a) ||
+        !linear(r, node->rhs, exprtree, b))
+      return 0;
+
+    const char *op = node->val->tk;
+    switch (op[0]) {
+      case '+':
+        lin[0] = a[0] + b[0];
+        lin[1] = a[1] + b[1];
+        break;
+      case '-':
+        lin[0] = a[0] - b[0];
+        lin[1] = a[1] - b[1];
+        break;
+      case 'u':
+        lin[0] = op[1] == '-' ? -b[0] : b[0];
+        lin[1] = op[1] == '-' ? -b[1] : b[1];
+        break;
+      case '*':
+        if (a[0] && b[0]) return 0;
+        lin[0] = a[0] * b[1] + b[0] * a[1];
+        lin[1] = a[1] * b[1];
+        break;
+      default:
+        return 0;
+    }
+  } else {
+    return 0;
+  }
+
+  return lin[0] > -max_linear && lin[0] < max_linear &&
+         lin[1] > -max_linear && lin[1] < max_linear;
+}
+
+/* Whether lin is within [min, max] for every value the var of r takes. */
+static int within(const range_t *r, const long long lin[2],
+                  const long long min, const long long max) {
+  const long long lo = lin[1] + (r ? lin[0] * r->lo : 0);
+  const long long hi = lin[1] + (r ? lin[0] * r->hi : 0);
+  return lo >= min && lo <= max && hi >= min && hi <= max;
+}
+
+/**
+ * Marks a slice of a literal as in range if its bounds are linear in the var
+ * of r and slice() can't fail on them: 0 <= lb <= len (< len for a single
+ * char) and lb <= ub. Returns 1 if it wasn't marked before.
+ */
+static int check_slice(const range_t *r, indx_node_t *ixnode) {
+  if (ixnode->in_range || ixnode->arg->type != string) return 0;
+
+  const long long len = strlen(ixnode->arg->tk);
+  long long lb[2] = {0, 0}, ub[2];
+  if (ixnode->beg && !linear(r, ixnode->beg, ixnode->ltype, lb)) return 0;
+  if (!within(r, lb, 0, ixnode->schar ? len - 1 : len)) return 0;
+
+  if (!ixnode->schar && ixnode->end) {
+    if (!linear(r, ixnode->end, ixnode->rtype, ub)) return 0;
+
+    const long long diff[2] = {ub[0] - lb[0], ub[1] - lb[1]};
+    if (!within(r, diff, 0, LLONG_MAX)) return 0;
+  }
+
+  ixnode->in_range = 1;
+  ixnode->len = len;
+  return 1;
+}
+
+static int fold_operand(opt_t *o, void **buf, unsigned int *type,
+                        value_t *val);
+
+static void fold_indx(opt_t *o, indx_node_t *ixnode) {
+  value_t val;
+  fold_token(o, &ixnode->arg, &val);
+  if (ixnode->beg) fold_operand(o, &ixnode->beg, &ixnode->ltype, &val);
+  if (ixnode->end) fold_operand(o, &ixnode->end, &ixnode->rtype, &val);
+  check_slice(NULL, ixnode);
+}
+
+/* Replaces the operand with a literal if its value is known, into val. */
+static int fold_operand(opt_t *o, void **buf, unsigned int *type,
+                        value_t *val) {
+  switch (*type) {
+    case string:
+    case numeric:
+    case integer: {
+      const token_t tk = {*buf, *type};
+      *val = to_value(&tk);
+      return 1;
+    }
+
+    case identifier:
+      if (!lookup(o, *buf, val)) return 0;
+      o->folds++;
+      break;
+
+    case exprtree:
+      if (!fold_tree(o, *buf, val)) return 0;
+      break;
+
+    case fretval:
+      if (!fold_call(o, *buf, val)) return 0;
+      o->folds++;
+      break;
+
+    case indx:
+      fold_indx(o, *buf);
+      return 0;
+
+    default:
+      return 0;
+  }
+
+  set_literal(buf, type, val);
+  return 1;
+}
+
+/* Returns what the condition evals to if it's known, -1 otherwise. */
+static int fold_cond(opt_t *o, cnode_t *cnode) {
+  value_t l, r;
+  const int lc = fold_operand(o, &cnode->lhs, &cnode->ltype, &l);
+  const int rc = fold_operand(o, &cnode->rhs, &cnode->rtype, &r);
+  if (!lc || !rc) return -1;
+
+  /* compare() fails on anything else. */
+  if (!(is_num(l.type) && is_num(r.type)) &&
+      !(l.type == string && r.type == string))
+    return -1;
+
+  const token_t lhs = value_token(&l), rhs = value_token(&r);
+  return compare(&lhs, &rhs, cnode->op);
+}
+
+/* The sym node assigns, if any. */
+static const char *target(const ast_node_t *node) {
+  switch (node->type) {
+    case vdecl:
+      return ((decl_node_t *)node->ch)->lhs;
+    case cin:
+      return ((read_node_t *)node->ch)->arg;
+    case post_dec:
+    case post_inc:
+      return ((unary_node_t *)node->ch)->arg;
+  }
+
+  return NULL;
+}
+
+/* Forgets the value of every sym that nodes may assign. */
+static void kill(opt_t *o, const list_t *nodes) {
+  for (node_t *n = nodes->head; n; n = n->next) {
+    const ast_node_t *node = n->data;
+    if (node->type == cond || node->type == floop || node->type == pfloop) {
+      kill(o, node->lch);
+      kill(o, node->rch);
+      continue;
+    }
+
+    const char *sym = target(node);
+    const cvar_t *v = sym ? resolve_sym(&o->scope, sym) : NULL;
+    if (v) set_slot(o, v->slot, NULL);
+  }
+}
+
+/* Adds every sym nodes may assign to syms. */
+static void assigned(const list_t *nodes, list_t *syms) {
+  for (node_t *n = nodes->head; n; n = n->next) {
+    const ast_node_t *node = n->data;
+    const char *sym = target(node);
+    if (sym) add(syms, sym);
+
+    assigned(node->lch, syms);
+    assigned(node->rch, syms);
+  }
+}
+
+static int has_sym(const list_t *syms, const char *sym) {
+  for (node_t *n = syms->head; n; n = n->next)
+    if (!strcmp(n->data, sym)) return 1;
+
+  return 0;
+}
+
+/* Whether evaling the operand calls nothing but builtins without effects. */
+static int pure_operand(const opt_t *o, const void *buf,
+                        const unsigned int type) {
+  if (type == fretval) return is_pure_call(o, buf);
+  if (type != indx) return 1;
+
+  const indx_node_t *ixnode = buf;
+  return (!ixnode->beg || pure_operand(o, ixnode->beg, ixnode->ltype)) &&
+         (!ixnode->end || pure_operand(o, ixnode->end, ixnode->rtype));
+}
+
+/* Whether evaling the operands of node can't have side effects. */
+static int pure_operands(const opt_t *o, ast_node_t *node) {
+  void **bufs[2];
+  unsigned int *types[2];
+  const unsigned int n = node_operands(node, bufs, types);
+  for (unsigned int i = 0; i < n; i++)
+    if (!pure_operand(o, *bufs[i], *types[i])) return 0;
+
+  return 1;
+}
+
+static int pure_block(const opt_t *o, const list_t *nodes);
+
+/* Whether node can't leave the function, i.e, it doesn't call or return. */
+static int pure_node(const opt_t *o, ast_node_t *node) {
+  switch (node->type) {
+    case cin:
+    case post_dec:
+    case post_inc:
+      return 1;
+
+    case fcall:
+      return is_pure_call(o, node->ch);
+
+    case vdecl:
+    case cout:
+      return pure_operands(o, node);
+
+    case cond:
+    case floop:
+      return pure_operands(o, node) && pure_block(o, node->lch) &&
+             pure_block(o, node->rch);
+  }
+
+  return 0;
+}
+
+static int pure_block(const opt_t *o, const list_t *nodes) {
+  for (node_t *n = nodes->head; n; n = n->next)
+    if (!pure_node(o, n->data)) return 0;
+
+  return 1;
+}
+
+static int same_token(const token_t *a, const token_t *b) {
+  if (a->type != b->type) return 0;
+  if (a->type == identifier) return !strcmp(a->tk, b->tk);
+  if (!is_literal(a->type)) return 0;
+
+  const value_t l = to_value(a), r = to_value(b);
+  return same_value(&l, &r);
+}
+
+/* Whether two operands always eval to the same value at the same point. */
+static int same_expr(const void *a, const unsigned int atype, const void *b,
+                     const unsigned int btype) {
+  if (atype != btype) return 0;
+
+  switch (atype) {
+    case exprtree: {
+      const binary_node_t *l = a, *r = b;
+      if (!l->lhs || !r->lhs)
+        return !l->lhs && !r->lhs && same_token(l->val, r->val);
+
+      return !strcmp(l->val->tk, r->val->tk) &&
+             same_expr(l->lhs, exprtree, r->lhs, exprtree) &&
+             same_expr(l->rhs, exprtree, r->rhs, exprtree);
+    }
+
+    case fretval: {
+      const func_node_t *l = a, *r = b;
+      if (strcmp(l->func, r->func) || l->args->size != r->args->size) return 0;
+
+      for (node_t *x = l->args->head, *y = r->args->head; x;
+           x = x->next, y = y->next)
+        if (!same_token(x->data, y->data)) return 0;
+
+      return 1;
+    }
+
+    case indx: {
+      const indx_node_t *l = a, *r = b;
+      return l->schar == r->schar && same_token(l->arg, r->arg) &&
+             !l->beg == !r->beg && !l->end == !r->end &&
+             (!l->beg || same_expr(l->beg, l->ltype, r->beg, r->ltype)) &&
+             (!l->end || same_expr(l->end, l->rtype, r->end, r->rtype));
+    }
+  }
+
+  const token_t l = {(void *)a, atype}, r = {(void *)b, btype};
+  return same_token(&l, &r);
+}
+
+/* Roughly what evaling the operand takes, a call or a slice counts twice. */
+static int cost(const void *buf, const unsigned int type) {
+  if (type == fretval) return 2;
+
+  if (type == exprtree) {
+    const binary_node_t *node = buf;
+    if (!node->lhs) return 0;
+    return 1 + cost(node->lhs, exprtree) + cost(node->rhs, exprtree);
+  }
+
+  if (type != indx) return 0;
+
+  const indx_node_t *ixnode = buf;
+  return 2 + (ixnode->beg ? cost(ixnode->beg, ixnode->ltype) : 0) +
+         (ixnode->end ? cost(ixnode->end, ixnode->rtype) : 0);
+}
+
+/* Whether tk evals the same on every iteration of a loop that assigns syms. */
+static int invariant_token(const opt_t *o, const list_t *syms,
+                           const token_t *tk) {
+  value_t val;
+  if (tk->type != identifier) return is_literal(tk->type);
+
+  return !has_sym(syms, tk->tk) &&
+         (resolve_sym(&o->scope, tk->tk) ||
+          global_const(o->symtbl, tk->tk, &val));
+}
+
+static int invariant(const opt_t *o, const list_t *syms, const void *buf,
+                     const unsigned int type) {
+  switch (type) {
+    case exprtree: {
+      const binary_node_t *node = buf;
+      if (!node->lhs) return invariant_token(o, syms, node->val);
+
+      return invariant(o, syms, node->lhs, exprtree) &&
+             invariant(o, syms, node->rhs, exprtree);
+    }
+
+    case fretval: {
+      const func_node_t *fnode = buf;
+      if (!is_pure_call(o, fnode)) return 0;
+
+      for (node_t *arg = fnode->args->head; arg; arg = arg->next)
+        if (!invariant_token(o, syms, arg->data)) return 0;
+
+      return 1;
+    }
+
+    case indx: {
+      const indx_node_t *ixnode = buf;
+      return invariant_token(o, syms, ixnode->arg) &&
+             (!ixnode->beg || invariant(o, syms, ixnode->beg, ixnode->ltype)) &&
+             (!ixnode->end || invariant(o, syms, ixnode->end, ixnode->rtype));
+    }
+  }
+
+  const token_t tk = {(void *)buf, type};
+  return invariant_token(o, syms, &tk);
+}
+
+static void add_site(opt_t *o, void *expr, const unsigned int type,
+                     void **buf, unsigned int *btype, const int lno) {
+  sites_t *s = &o->sites;
+  if (s->n == s->cap) s->arr = grow(s->arr, &s->cap, s->n, sizeof(site_t));
+
+  const site_t site = {expr, type, buf, btype, lno};
+  s->arr[s->n++] = site;
+}
+
+static void visit_operand(opt_t *o, const list_t *syms, void **buf,
+                          unsigned int *type, const int lno);
+
+/**
+ * Adds the subexpressions of expr to o->sites, in the order they're evaled.
+ * With syms, only the largest ones that are invariant in a loop assigning
+ * syms. buf is the operand that holds expr, NULL for a subtree.
+ */
+static void visit(opt_t *o, const list_t *syms, void *expr,
+                  const unsigned int type, void **buf, unsigned int *btype,
+                  const int lno) {
+  if (syms && invariant(o, syms, expr, type)) {
+    add_site(o, expr, type, buf, btype, lno);
+    return;
+  }
+
+  if (type == exprtree) {
+    const binary_node_t *node = expr;
+    if (((binary_node_t *)node->lhs)->lhs)
+      visit(o, syms, node->lhs, exprtree, NULL, NULL, lno);
+    if (((binary_node_t *)node->rhs)->lhs)
+      visit(o, syms, node->rhs, exprtree, NULL, NULL, lno);
+  } else if (type == indx) {
+    indx_node_t *ixnode = expr;
+    if (ixnode->beg) visit_operand(o, syms, &ixnode->beg, &ixnode->ltype, lno);
+    if (ixnode->end) visit_operand(o, syms, &ixnode->end, &ixnode->rtype, lno);
+  }
+
+  /* Subtrees are evaled first, it makes no difference to the order here. */
+  if (!syms && (type != fretval || is_pure_call(o, expr)))
+    add_site(o, expr, type, buf, btype, lno);
+}
+
+static void visit_operand(opt_t *o, const list_t *syms, void **buf,
+                          unsigned int *type, const int lno) {
+  if (*type == exprtree && !((binary_node_t *)*buf)->lhs) return;
+  if (*type == exprtree || *type == fretval || *type == indx)
+    visit(o, syms, *buf, *type, buf, type, lno);
+}
+
+/**
+ * Declares a temp initialized with the subexpression at site, and makes every
+ * site from the given one on that evals to the same read the temp instead.
+ */
+static ast_node_t *hoist(opt_t *o, const unsigned int from) {
+  site_t *site = &o->sites.arr[from];
+  const unsigned int type = site->type;
+  char *sym = temp_sym(NULL);
+
+  /* A subtree is replaced in place, the temp gets a copy of it. */
+  void *rhs = site->expr;
+  if (!site->buf) {
+    binary_node_t *copy = alloc(sizeof(binary_node_t));
+    *copy = *(binary_node_t *)site->expr;
+    rhs = copy;
+  }
+
+  ast_node_t *node = init_decl(sym, rhs, type, site->lno);
+
+  token_t *tk = alloc(sizeof(token_t));
+  tk->tk = sym;
+  tk->type = identifier;
+
+  for (unsigned int i = from; i < o->sites.n; i++) {
+    site = &o->sites.arr[i];
+    if (!site->expr || !same_expr(site->expr, site->type, rhs, type))
+      continue;
+
+    if (site->buf) {
+      *site->buf = sym;
+      *site->btype = identifier;
+    } else {
+      binary_node_t *leaf = site->expr;
+      leaf->val = tk;
+      leaf->lhs = leaf->rhs = NULL;
+    }
+
+    site->expr = NULL;
+  }
+
+  return node;
+}
+
+/**
+ * Evals every subexpression that node repeats once, in temps declared before
+ * it, which are added to temps.
+ */
+static void cse(opt_t *o, ast_node_t *node, list_t *temps) {
+  void **bufs[2];
+  unsigned int *types[2];
+
+  for (;;) {
+    o->sites.n = 0;
+    const unsigned int n = node_operands(node, bufs, types);
+    for (unsigned int i = 0; i < n; i++)
+      visit_operand(o, NULL, bufs[i], types[i], node->lno);
+
+    /* The costliest first, a single operator isn't worth a temp. */
+    int best = -1, best_cost = 1;
+    for (unsigned int i = 0; i < o->sites.n; i++) {
+      const site_t *a = &o->sites.arr[i];
+      const int c = cost(a->expr, a->type);
+      if (c <= best_cost) continue;
+
+      for (unsigned int j = i + 1; j < o->sites.n; j++) {
+        const site_t *b = &o->sites.arr[j];
+        if (same_expr(a->expr, a->type, b->expr, b->type)) {
+          best = i;
+          best_cost = c;
+          break;
+        }
+      }
+    }
+
+    if (best < 0) return;
+
+    ast_node_t *temp = hoist(o, best);
+    cse(o, temp, temps);
+    add(temps, temp);
+  }
+}
+
+/**
+ * Moves what the loop in node evals the same way on every iteration out of it,
+ * into temps declared before it. Replaces node with a list of them followed by
+ * the loop, in lch.
+ *
+ * Anything hoisted out of the body was sure to be evaled on the first iteration
+ * before anything with a side effect other than a print, and the loop is
+ * guarded by an if with the same condition, so it's only ever evaled when it
+ * would have been. Nothing is hoisted if the condition calls a function.
+ */
+static int licm(opt_t *o, ast_node_t *node) {
+  if (!pure_operands(o, node)) return keep_node;
+
+  list_t *syms = init_list();
+  assigned(node->lch, syms);
+
+  void **bufs[2];
+  unsigned int *types[2];
+  o->sites.n = 0;
+  unsigned int argc = node_operands(node, bufs, types);
+  for (unsigned int i = 0; i < argc; i++)
+    visit_operand(o, syms, bufs[i], types[i], node->lno);
+
+  const unsigned int n_cond = o->sites.n;
+  for (node_t *n = node->lch->head; n; n = n->next) {
+    ast_node_t *stmt = n->data;
+    if (!pure_operands(o, stmt)) break;
+
+    argc = node_operands(stmt, bufs, types);
+    for (unsigned int i = 0; i < argc; i++)
+      visit_operand(o, syms, bufs[i], types[i], stmt->lno);
+
+    if (!pure_node(o, stmt)) break;
+  }
+
+  const unsigned int n = o->sites.n;
+  if (!n) return keep_node;
+
+  ast_node_t *temps[n];
+  int guarded[n];
+  unsigned int n_temps = 0;
+  for (unsigned int i = 0; i < n; i++) {
+    if (!o->sites.arr[i].expr) continue;
+
+    guarded[n_temps] = i >= n_cond;
+    temps[n_temps++] = hoist(o, i);
+  }
+
+  list_t *pre = init_list(), *body = init_list();
+  for (unsigned int i = 0; i < n_temps; i++) {
+    /* What's hoisted may repeat subexpressions of its own. */
+    list_t *dst = guarded[i] ? body : pre;
+    cse(o, temps[i], dst);
+    add(dst, temps[i]);
+  }
+
+  ast_node_t *loop = alloc(sizeof(ast_node_t));
+  *loop = *node;
+
+  if (body->size) {
+    ast_node_t *guard = alloc(sizeof(ast_node_t));
+    *guard = *node;
+    guard->kwd = "if";
+    guard->type = cond;
+    guard->tokens = init_list();
+    guard->lch = body;
+    guard->rch = init_list();
+    add(body, loop);
+    add(pre, guard);
+  } else {
+    add(pre, loop);
+  }
+
+  char buf[64];
+  snprintf(buf, sizeof buf, "%d invariant(s) hoisted out of for", n_temps);
+  report(o, node->lno, buf);
+
+  node->lch = pre;
+  return splice_lch;
+}
+
+/* Takes the temps of the operands of node out of it, in lch. */
+static int opt_cse(opt_t *o, ast_node_t *node) {
+  if (node->type == floop || !pure_operands(o, node)) return keep_node;
+
+  list_t *temps = init_list();
+  cse(o, node, temps);
+  if (!temps->size) return keep_node;
+
+  char buf[64];
+  snprintf(buf, sizeof buf, "%d common subexpression(s) eliminated",
+           temps->size);
+  report(o, node->lno, buf);
+
+  ast_node_t *stmt = alloc(sizeof(ast_node_t));
+  *stmt = *node;
+  add(temps, stmt);
+  node->lch = temps;
+  return splice_lch;
+}
+
+static int opt_block(opt_t *o, list_t *nodes);
+
+/**
+ * The body of an if/for. flat is set if it declares no syms of its own, i.e,
+ * it can take the place of the if without changing any scope.
+ */
+static int opt_branch(opt_t *o, list_t *nodes, int *flat) {
+  const unsigned int n_vars = o->scope.n_vars;
+
+  open_scope(&o->scope);
+  const int ret = opt_block(o, nodes);
+  *flat = o->scope.n_vars == n_vars;
+  close_scope(&o->scope);
+  return ret;
+}
+
+static void clear_list(list_t *list) {
+  list->head = NULL;
+  list->size = 0;
+}
+
+static int opt_if(opt_t *o, ast_node_t *node, int *ret) {
+  const int res = fold_cond(o, node->ch);
+  int flat;
+
+  if (res == 1) {
+    report(o, node->lno, node->rch->size
+                             ? "condition is always true, else removed"
+                             : "condition is always true");
+    clear_list(node->rch);
+    *ret = opt_branch(o, node->lch, &flat);
+    return flat ? splice_lch : keep_node;
+  }
+
+  if (res == 0 && !node->rch->size) {
+    report(o, node->lno, "condition is always false, if removed");
+    return drop_node;
+  }
+
+  if (res == 0) {
+    report(o, node->lno, "condition is always false, body removed");
+    clear_list(node->lch);
+    *ret = opt_branch(o, node->rch, &flat);
+    return flat ? splice_rch : keep_node;
+  }
+
+  /* Both branches start from what's known here, and merge once they end. */
+  track(o);
+  const unsigned int n = o->scope.n_slots;
+  unsigned char known[n + 1], lknown[n + 1];
+  value_t vals[n + 1], lvals[n + 1];
+  memcpy(known, o->known, n);
+  memcpy(vals, o->vals, n * sizeof(value_t));
+
+  const int lret = opt_branch(o, node->lch, &flat);
+  memcpy(lknown, o->known, n);
+  memcpy(lvals, o->vals, n * sizeof(value_t));
+
+  memcpy(o->known, known, n);
+  memcpy(o->vals, vals, n * sizeof(value_t));
+  const int rret = opt_branch(o, node->rch, &flat);
+
+  *ret = lret && rret;
+  if (rret) {
+    memcpy(o->known, lknown, n);
+    memcpy(o->vals, lvals, n * sizeof(value_t));
+  } else if (!lret) {
+    for (unsigned int i = 0; i < n; i++)
+      o->known[i] =
+          o->known[i] && lknown[i] && same_value(&o->vals[i], &lvals[i]);
+  }
+
+  return keep_node;
+}
+
+/* Whether sym is a global var rather than a local or a global const. */
+static int global_var(const opt_t *o, const char *sym) {
+  value_t val;
+  return !resolve_sym(&o->scope, sym) && get_global(o->symtbl, sym) &&
+         !global_const(o->symtbl, sym, &val);
+}
+
+/* Whether evaling the operand calls a function, which may assign globals. */
+static int calls_func(const opt_t *o, const void *buf,
+                      const unsigned int type) {
+  if (type == fretval)
+    return get_fsig(o->symtbl, ((func_node_t *)buf)->func) != NULL;
+  if (type != indx) return 0;
+
+  const indx_node_t *ixnode = buf;
+  return (ixnode->beg && calls_func(o, ixnode->beg, ixnode->ltype)) ||
+         (ixnode->end && calls_func(o, ixnode->end, ixnode->rtype));
+}
+
+/* Same as calls_func(), for the statements of nodes & the blocks in them. */
+static int block_calls(const opt_t *o, const list_t *nodes) {
+  for (node_t *n = nodes->head; n; n = n->next) {
+    ast_node_t *node = n->data;
+    if (node->type == fcall && calls_func(o, node->ch, fretval)) return 1;
+
+    void **bufs[2];
+    unsigned int *types[2];
+    const unsigned int argc = node_operands(node, bufs, types);
+    for (unsigned int i = 0; i < argc; i++)
+      if (calls_func(o, *bufs[i], *types[i])) return 1;
+
+    if (block_calls(o, node->lch) || block_calls(o, node->rch)) return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * Marks the for as counted if its condition compares a var that the body only
+ * steps with a single ++/-- at its top level against an integer or a var the
+ * body doesn't assign, see cnode_t.step. A global var can also be assigned by
+ * the functions the body calls, if it does the for isn't counted.
+ */
+static void mark_counted(opt_t *o, const ast_node_t *node, const list_t *body) {
+  cnode_t *cnode = node->ch;
+  cnode->step = NULL;
+  if (cnode->ltype != identifier) return;
+  if (cnode->rtype != integer && cnode->rtype != identifier) return;
+
+  const char *sym = cnode->lhs;
+  if ((global_var(o, sym) ||
+       (cnode->rtype == identifier && global_var(o, cnode->rhs))) &&
+      block_calls(o, body))
+    return;
+
+  list_t *syms = init_list();
+  assigned(body, syms);
+  if (cnode->rtype == identifier && has_sym(syms, cnode->rhs)) return;
+
+  unsigned int n_steps = 0;
+  for (node_t *n = syms->head; n; n = n->next)
+    if (!strcmp(n->data, sym)) n_steps++;
+
+  for (node_t *n = body->head; n && n_steps == 1; n = n->next) {
+    ast_node_t *stmt = n->data;
+    if ((stmt->type == post_inc || stmt->type == post_dec) &&
+        !strcmp(((unary_node_t *)stmt->ch)->arg, sym)) {
+      cnode->step = stmt;
+      report(o, node->lno, "counted for");
+      return;
+    }
+  }
+}
+
+/* check_slice() on every slice in the operands of node & the blocks in it. */
+static unsigned int check_slices(const range_t *r, ast_node_t *node) {
+  void **bufs[2];
+  unsigned int *types[2];
+  unsigned int n_checked = 0;
+
+  const unsigned int argc = node_operands(node, bufs, types);
+  for (unsigned int i = 0; i < argc; i++)
+    if (*types[i] == indx) n_checked += check_slice(r, *bufs[i]);
+
+  for (node_t *n = node->lch->head; n; n = n->next)
+    n_checked += check_slices(r, n->data);
+  for (node_t *n = node->rch->head; n; n = n->next)
+    n_checked += check_slices(r, n->data);
+
+  return n_checked;
+}
+
+/**
+ * Checks the slices in the body of a counted for against the values its var
+ * takes, e.g, [start, bound - 1] for i++ while i < bound. The statements that
+ * come after the step see it one step further.
+ */
+static void check_range(opt_t *o, const ast_node_t *node, const list_t *body,
+                        const value_t *start) {
+  const cnode_t *cnode = node->ch;
+  const ast_node_t *step = cnode->step;
+  value_t bound;
+  if (!step || start->type != integer) return;
+
+  if (cnode->rtype == integer) {
+    bound.type = integer;
+    bound.as.i = *(long long *)cnode->rhs;
+  } else if (!lookup(o, cnode->rhs, &bound) || bound.type != integer) {
+    return;
+  }
+
+  const long long s = start->as.i, b = bound.as.i;
+  const char *op = cnode->op;
+  const int up = step->type == post_inc;
+  range_t r = {cnode->lhs, s, s};
+
+  if (up && (!strcmp(op, "<") || (!strcmp(op, "!=") && s <= b)))
+    r.hi = b - 1;
+  else if (up && !strcmp(op, "<="))
+    r.hi = b;
+  else if (!up && (!strcmp(op, ">") || (!strcmp(op, "!=") && s >= b)))
+    r.lo = b + 1;
+  else if (!up && !strcmp(op, ">="))
+    r.lo = b;
+  else
+    return;
+
+  if (r.lo > r.hi || r.lo <= -max_linear || r.hi >= max_linear) return;
+
+  unsigned int n_checked = 0;
+  for (node_t *n = body->head; n; n = n->next) {
+    if (n->data == step) {
+      r.lo += up ? 1 : -1;
+      r.hi += up ? 1 : -1;
+      continue;
+    }
+
+    n_checked += check_slices(&r, n->data);
+  }
+
+  if (!n_checked) return;
+
+  char buf[64];
+  snprintf(buf, sizeof buf, "%d slice(s) always in range", n_checked);
+  report(o, node->lno, buf);
+}
+
+/* The body may run any number of times, anything it assigns isn't known. */
+static int opt_for(opt_t *o, ast_node_t *node) {
+  /* What the var of a counted for starts at. */
+  value_t start = {none, {0}};
+  const cnode_t *cnode = node->ch;
+  if (cnode->ltype == identifier) lookup(o, cnode->lhs, &start);
+
+  kill(o, node->lch);
+  if (fold_cond(o, node->ch) == 0) {
+    report(o, node->lno, "condition is always false, for removed");
+    return drop_node;
+  }
+
+  track(o);
+  const unsigned int n = o->scope.n_slots;
+  unsigned char known[n + 1];
+  value_t vals[n + 1];
+  memcpy(known, o->known, n);
+  memcpy(vals, o->vals, n * sizeof(value_t));
+
+  int flat;
+  o->scope.loops++;
+  opt_branch(o, node->lch, &flat);
+  o->scope.loops--;
+
+  memcpy(o->known, known, n);
+  memcpy(o->vals, vals, n * sizeof(value_t));
+
+  /* licm() may take an invariant bound out into a temp. */
+  const list_t *body = node->lch;
+  const int action = o->ok ? licm(o, node) : keep_node;
+  mark_counted(o, node, body);
+  check_range(o, node, body, &start);
+  return action;
+}
+
+/* The body of a pfor is walked once, from what's known on any iteration. */
+static int opt_pfor(opt_t *o, ast_node_t *node) {
+  value_t val;
+  pfor_node_t *pnode = node->ch;
+  fold_operand(o, &pnode->beg, &pnode->btype, &val);
+  fold_operand(o, &pnode->end, &pnode->etype, &val);
+
+  kill(o, node->lch);
+  track(o);
+  const unsigned int n = o->scope.n_slots;
+  unsigned char known[n + 1];
+  value_t vals[n + 1];
+  memcpy(known, o->known, n);
+  memcpy(vals, o->vals, n * sizeof(value_t));
+
+  o->scope.loops++;
+  open_scope(&o->scope);
+  set_slot(o, add_var(&o->scope, pnode->var, 1)->slot, NULL);
+  opt_block(o, node->lch);
+  close_scope(&o->scope);
+  o->scope.loops--;
+
+  memcpy(o->known, known, n);
+  memcpy(o->vals, vals, n * sizeof(value_t));
+  return keep_node;
+}
+
+/* Sets ret if node never falls through to the next one. */
+static int opt_node(opt_t *o, ast_node_t *node, int *ret) {
+  value_t val;
+
+  o->lno = node->lno;
+  switch (node->type) {
+    case vdecl: {
+      decl_node_t *dnode = node->ch;
+      const int known = fold_operand(o, &dnode->rhs, &dnode->rtype, &val);
+
+      const cvar_t *v = assign_sym(&o->scope, dnode->lhs, dnode->is_const);
+      if (!v) {
+        o->ok = 0;
+        return keep_node;
+      }
+
+      set_slot(o, v->slot, known ? &val : NULL);
+      return keep_node;
+    }
+
+    case cin: {
+      const read_node_t *rnode = node->ch;
+      const cvar_t *v = assign_sym(&o->scope, rnode->arg, 0);
+      if (!v) {
+        o->ok = 0;
+        return keep_node;
+      }
+
+      set_slot(o, v->slot, NULL);
+      return keep_node;
+    }
+
+    case post_dec:
+    case post_inc: {
+      const unary_node_t *unode = node->ch;
+      const cvar_t *v = resolve_sym(&o->scope, unode->arg);
+      if (!v || v->is_const) {
+        o->ok = 0;
+        return keep_node;
+      }
+
+      const int step = node->type == post_inc ? 1 : -1;
+      if (!lookup(o, v->sym, &val) || !is_num(val.type)) {
+        set_slot(o, v->slot, NULL);
+      } else {
+        if (val.type == integer)
+          val.as.i = (unsigned long long)val.as.i + step;
+        else
+          val.as.d += step;
+
+        set_slot(o, v->slot, &val);
+      }
+
+      return keep_node;
+    }
+
+    case cout: {
+      print_node_t *pnode = node->ch;
+      fold_operand(o, &pnode->arg, &pnode->type, &val);
+      return keep_node;
+    }
+
+    case rettype: {
+      return_node_t *rnode = node->ch;
+      if (rnode->val) fold_operand(o, &rnode->val, &rnode->type, &val);
+
+      *ret = 1;
+      return keep_node;
+    }
+
+    /* The body of a for is walked from what's known on any iteration. */
+    case fbreak:
+    case fcontinue:
+      *ret = 1;
+      return keep_node;
+
+    case fcall: {
+      func_node_t *fnode = node->ch;
+      if (!fold_call(o, fnode, NULL)) return keep_node;
+
+      char buf[64];
+      snprintf(buf, sizeof buf, "result of %s() is unused, call removed",
+               fnode->func);
+      report(o, node->lno, buf);
+      return drop_node;
+    }
+
+    case cond:
+      return opt_if(o, node, ret);
+
+    case floop:
+      return opt_for(o, node);
+
+    case pfloop:
+      return opt_pfor(o, node);
+  }
+
+  /* Deferred calls resolve their args once the function returns. */
+  return keep_node;
+}
+
+/**
+ * Returns 1 if the block never falls through its end, i.e, it returns, breaks
+ * or continues.
+ */
+static int opt_block(opt_t *o, list_t *nodes) {
+  node_t **link = &nodes->head;
+
+  while (*link && o->ok) {
+    node_t *n = *link;
+    ast_node_t *node = n->data;
+
+    int ret = 0;
+    int action = opt_node(o, node, &ret);
+    if (action == keep_node && o->ok) action = opt_cse(o, node);
+    const list_t *branch = action == splice_lch   ? node->lch
+                           : action == splice_rch ? node->rch
+                                                  : NULL;
+
+    if (action == drop_node || (branch && !branch->head)) {
+      *link = n->next;
+      nodes->size--;
+    } else if (branch) {
+      /* The body takes the place of the if. */
+      node_t *tail = branch->head;
+      while (tail->next) tail = tail->next;
+
+      tail->next = n->next;
+      *link = branch->head;
+      nodes->size += branch->size - 1;
+      link = &tail->next;
+    } else {
+      link = &n->next;
+    }
+
+    if (!ret || !o->ok) continue;
+    if (!*link) return 1;
+
+    unsigned int dead = 0;
+    for (node_t *d = *link; d; d = d->next) dead++;
+
+    char buf[64];
+    snprintf(buf, sizeof buf, "unreachable, %d statement(s) removed", dead);
+    report(o, ((ast_node_t *)(*link)->data)->lno, buf);
+
+    *link = NULL;
+    nodes->size -= dead;
+    return 1;
+  }
+
+  return 0;
+}
+
+int optimize(fsig_t *sig, symtbl_t *symtbl) {
+  static sites_t sites = {NULL, 0, 0};
+
+  opt_t o;
+  memset(&o, 0, sizeof o);
+  o.sig = sig;
+  o.symtbl = symtbl;
+  o.ok = 1;
+
+  init_scope(&o.scope, sig, symtbl);
+  if (!o.scope.ok) return 1;
+
+  /* Taken while in use, a const call loads (and optimizes) its callee. */
+  o.sites = sites;
+  memset(&sites, 0, sizeof sites);
+
+  track(&o);
+  opt_block(&o, ((ast_node_t *)sig->node)->lch);
+  sites = o.sites;
+
+  if (opt_report && o.folds)
+    fprintf(stderr, "opt.c: %s() %d operand(s) folded\n", sig->func, o.folds);
+
+  return !o.failed;
+}
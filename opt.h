@@ -0,0 +1,23 @@
+#pragma once
+
+#include "symtbl.h"
+
+/* Whether fnode calls a builtin without side effects, not a function. */
+int pure_call(const func_node_t *fnode, const symtbl_t *symtbl);
+
+/**
+ * Names a new temp, a var that no program can refer to: $<n>, or <sym>$<n> for
+ * a copy of sym, so that errors still name it.
+ */
+char *temp_sym(const char *sym);
+
+/* Set by --opt-report, prints what optimize() changed to stderr. */
+extern int opt_report;
+
+/**
+ * Propagates constants through the body of sig, runs calls to const defs,
+ * removes what can never run, hoists loop invariants and evals common
+ * subexpressions once. Runs once, when the body is loaded (see load_body()).
+ * Fails if a call to a const def does.
+ */
+int optimize(fsig_t *sig, symtbl_t *symtbl);
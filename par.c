@@ -0,0 +1,551 @@
+/**
+ * par.c
+ * Parallel for - pfor var = beg, end runs its body once for every integer var
+ * in [beg, end), on a pool of threads.
+ *
+ * The body owns var and the locals it declares. It may read any other var, and
+ * only write one by reducing into it: acc = acc + ..., acc = acc - ..., acc =
+ * acc * ... (acc being the leftmost operand, reached through operators of the
+ * same kind), acc++ or acc--, with acc read nowhere else in the body. It can't
+ * print, read, call anything (builtins included), slice a string, defer or
+ * return, nor hold another pfor. That's checked when its function is loaded,
+ * anything else fails the load.
+ *
+ * The range is cut into chunks, how many only depends on its size. The threads
+ * take the chunks in turn and run them on closures (see closure.c), each in a
+ * frame of its own: var, a copy of every var read, the accumulators starting at
+ * 0 (1 for a *) and then the locals. Once every chunk is done, what each left
+ * in the accumulators is folded into them in chunk order, so the result doesn't
+ * depend on the number of threads or the order they ran in. Integer reductions
+ * give what a for would, float ones may round differently.
+ */
+
+#include "par.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ast.h"
+#include "closure.h"
+#include "compile.h"
+#include "expr.h"
+#include "token.h"
+#include "util.h"
+
+int par_threads = 0;
+int in_pfor = 0;
+
+/**
+ * Load-time check.
+ */
+
+typedef struct par {
+  const fsig_t *sig;
+  const symtbl_t *symtbl;
+  scope_t scope;
+  /* pfor being checked, the vars below outer were declared before it. */
+  pfor_node_t *pfor;
+  unsigned int outer;
+  int ok;
+} par_t;
+
+static void fail(par_t *p, const int lno, const char *what) {
+  if (!p->ok) return;
+
+  fprintf(stderr, "par.c: %s() L[%d] %s\n", p->sig->func, lno, what);
+  load_lno = lno;
+  p->ok = 0;
+}
+
+static int has_sym(const list_t *syms, const char *sym) {
+  for (node_t *n = syms->head; n; n = n->next)
+    if (!strcmp(n->data, sym)) return 1;
+
+  return 0;
+}
+
+/* Whether sym is a var declared outside of the pfor, var of the pfor aside. */
+static int shared(const par_t *p, const char *sym) {
+  value_t val;
+  const cvar_t *v = resolve_sym(&p->scope, sym);
+  if (v) return (unsigned int)(v - p->scope.vars) < p->outer;
+
+  return get_global(p->symtbl, sym) && !global_const(p->symtbl, sym, &val);
+}
+
+/* Checks an operand in the body, and records the shared vars it reads. */
+static void operand(par_t *p, const void *buf, const unsigned int type,
+                    const int lno) {
+  switch (type) {
+    case identifier:
+      if (shared(p, buf) && !has_sym(p->pfor->reads, buf))
+        add(p->pfor->reads, (void *)buf);
+      return;
+
+    case exprtree: {
+      const binary_node_t *node = buf;
+      if (!node->lhs && !node->rhs) {
+        operand(p, node->val->tk, node->val->type, lno);
+        return;
+      }
+
+      operand(p, node->lhs, exprtree, lno);
+      operand(p, node->rhs, exprtree, lno);
+      return;
+    }
+
+    case fretval: {
+      char what[96];
+      snprintf(what, sizeof what, "%.48s() can't be called in a pfor",
+               ((const func_node_t *)buf)->func);
+      fail(p, lno, what);
+      return;
+    }
+
+    case indx:
+      fail(p, lno, "strings can't be sliced in a pfor");
+      return;
+  }
+}
+
+/**
+ * The kind of reduction (+ or *) rhs makes into sym, 0 if it isn't one. Its
+ * other operands are checked as usual.
+ */
+static char reduction(par_t *p, const char *sym, const void *rhs,
+                      const unsigned int type, const int lno) {
+  if (type != exprtree) return 0;
+
+  const binary_node_t *node = rhs;
+  char kind = 0;
+  for (; node->lhs; node = node->lhs) {
+    const char *op = node->val->tk;
+    const char k = op[1] ? 0 : op[0] == '-' ? '+' : op[0];
+    if ((k != '+' && k != '*') || (kind && k != kind)) return 0;
+    kind = k;
+  }
+
+  if (!kind || node->val->type != identifier || strcmp(node->val->tk, sym))
+    return 0;
+
+  for (node = rhs; node->lhs; node = node->lhs)
+    operand(p, node->rhs, exprtree, lno);
+  return kind;
+}
+
+static void reduce(par_t *p, const char *sym, const char op, const int lno) {
+  for (node_t *n = p->pfor->accs->head; n; n = n->next) {
+    const reduce_t *r = n->data;
+    if (strcmp(r->sym, sym)) continue;
+
+    if (r->op != op) fail(p, lno, "accumulator reduced with both + and *");
+    return;
+  }
+
+  reduce_t *r = alloc(sizeof(reduce_t));
+  r->sym = sym;
+  r->op = op;
+  add(p->pfor->accs, r);
+}
+
+/* A write to sym in the body, rhs is NULL for ++/--. */
+static int owned(par_t *p, const char *sym, const void *rhs,
+                 const unsigned int type, const int lno) {
+  char what[96];
+  if (!strcmp(sym, p->pfor->var)) {
+    snprintf(what, sizeof what, "var of pfor [%.48s] can't be assigned", sym);
+    fail(p, lno, what);
+    return 0;
+  }
+
+  if (!shared(p, sym)) return 1;
+
+  const char op = rhs ? reduction(p, sym, rhs, type, lno) : '+';
+  if (op) {
+    reduce(p, sym, op, lno);
+    return 0;
+  }
+
+  snprintf(what, sizeof what,
+           "[%.48s] is shared, a pfor can only reduce into it", sym);
+  fail(p, lno, what);
+  return 0;
+}
+
+/* Declares sym unless it's a global, which the tree-walker assigns instead. */
+static void assign(par_t *p, const char *sym, const unsigned int is_const) {
+  if (resolve_sym(&p->scope, sym) || !get_global(p->symtbl, sym))
+    assign_sym(&p->scope, sym, is_const);
+}
+
+static void check_block(par_t *p, const list_t *nodes);
+
+static void check_branch(par_t *p, const list_t *nodes) {
+  open_scope(&p->scope);
+  check_block(p, nodes);
+  close_scope(&p->scope);
+}
+
+static void check_pfor(par_t *p, const ast_node_t *node) {
+  pfor_node_t *pnode = node->ch;
+  char what[96];
+
+  if (p->pfor) {
+    fail(p, node->lno, "pfor is invalid in a pfor");
+    return;
+  }
+
+  /* Locals and shared vars can't be told apart past this. */
+  if (!p->scope.ok) {
+    fail(p, node->lno, "pfor follows code whose scopes can't be resolved");
+    return;
+  }
+
+  if (resolve_sym(&p->scope, pnode->var) ||
+      get_global(p->symtbl, pnode->var)) {
+    snprintf(what, sizeof what, "var of pfor [%.48s] is already declared",
+             pnode->var);
+    fail(p, node->lno, what);
+    return;
+  }
+
+  pnode->reads = init_list();
+  pnode->accs = init_list();
+  p->pfor = pnode;
+  p->outer = p->scope.n_vars;
+
+  p->scope.loops++;
+  open_scope(&p->scope);
+  add_var(&p->scope, pnode->var, 1);
+  check_block(p, node->lch);
+  close_scope(&p->scope);
+  p->scope.loops--;
+  p->pfor = NULL;
+
+  if (!p->scope.ok) {
+    fail(p, node->lno, "scopes of the body of pfor can't be resolved");
+    return;
+  }
+
+  for (node_t *n = pnode->accs->head; n; n = n->next) {
+    const reduce_t *r = n->data;
+    if (!has_sym(pnode->reads, r->sym)) continue;
+
+    snprintf(what, sizeof what, "accumulator [%.48s] is read in the pfor",
+             r->sym);
+    fail(p, node->lno, what);
+    return;
+  }
+}
+
+static void check_node(par_t *p, const ast_node_t *node) {
+  const int in = p->pfor != NULL;
+
+  switch (node->type) {
+    case vdecl: {
+      const decl_node_t *dnode = node->ch;
+      if (in && !owned(p, dnode->lhs, dnode->rhs, dnode->rtype, node->lno))
+        return;
+
+      if (in) operand(p, dnode->rhs, dnode->rtype, node->lno);
+      assign(p, dnode->lhs, dnode->is_const);
+      return;
+    }
+
+    case cin:
+      if (!in) assign(p, ((read_node_t *)node->ch)->arg, 0);
+      break;
+
+    case post_dec:
+    case post_inc:
+      if (in) owned(p, ((unary_node_t *)node->ch)->arg, NULL, 0, node->lno);
+      return;
+
+    case cond:
+    case floop: {
+      const cnode_t *cnode = node->ch;
+      if (in) {
+        operand(p, cnode->lhs, cnode->ltype, node->lno);
+        operand(p, cnode->rhs, cnode->rtype, node->lno);
+      }
+
+      if (node->type == floop) p->scope.loops++;
+      check_branch(p, node->lch);
+      if (node->type == floop) p->scope.loops--;
+      check_branch(p, node->rch);
+      return;
+    }
+
+    case pfloop:
+      check_pfor(p, node);
+      return;
+
+    case fbreak:
+    case fcontinue:
+      return;
+  }
+
+  /* Calls, prints, reads, defers & returns. */
+  if (in) {
+    char what[64];
+    snprintf(what, sizeof what, "%.32s is invalid in a pfor", node->kwd);
+    fail(p, node->lno, what);
+  }
+}
+
+static void check_block(par_t *p, const list_t *nodes) {
+  for (node_t *n = nodes->head; n && p->ok; n = n->next) check_node(p, n->data);
+}
+
+int check_par(const fsig_t *sig, const symtbl_t *symtbl) {
+  par_t p;
+  memset(&p, 0, sizeof p);
+  p.sig = sig;
+  p.symtbl = symtbl;
+  p.ok = 1;
+
+  init_scope(&p.scope, sig, symtbl);
+  check_block(&p, ((ast_node_t *)sig->node)->lch);
+  return p.ok;
+}
+
+/**
+ * Runtime.
+ */
+
+/* Chunks a range is cut into at most, and the fewest indices in one. */
+enum { max_chunks = 256, min_chunk = 64 };
+
+/**
+ * The body of a pfor on closures. Its frame holds var, the n_reads vars it
+ * reads and the n_accs accumulators, in the order they're recorded in the
+ * pfor, then its locals.
+ */
+typedef struct par_body {
+  const struct cl_block *block;
+  unsigned int n_slots, n_reads, n_accs;
+} par_body_t;
+
+typedef struct job {
+  const par_body_t *body;
+  /* What every chunk starts with, and what each left in the accumulators. */
+  const value_t *frame;
+  value_t *parts;
+  long long beg;
+  unsigned long long len, size;
+  unsigned int n_chunks, next;
+  int failed;
+} job_t;
+
+/**
+ * The pool. A new job bumps gen, busy counts the workers that haven't given up
+ * on it yet. Each job waits for the last one to end, so no worker misses one.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER;
+static job_t *job = NULL;
+static unsigned long gen = 0;
+static unsigned int n_workers = 0, busy = 0;
+static int started = 0;
+
+static par_body_t *compile_pfor(symtbl_t *symtbl, const ast_node_t *node) {
+  const pfor_node_t *pnode = node->ch;
+
+  scope_t scope;
+  memset(&scope, 0, sizeof scope);
+  scope.symtbl = symtbl;
+  scope.ok = 1;
+  scope.loops = 1;
+
+  /* Only accumulators can be written, see check_par(). */
+  add_var(&scope, pnode->var, 1);
+  for (node_t *n = pnode->reads->head; n; n = n->next)
+    add_var(&scope, n->data, 1);
+  for (node_t *n = pnode->accs->head; n; n = n->next)
+    add_var(&scope, ((reduce_t *)n->data)->sym, 0);
+
+  open_scope(&scope);
+  const struct cl_block *block = closure_block(node->lch, &scope, symtbl);
+  if (!block) {
+    fprintf(stderr, "par.c: body of pfor can't run on closures L[%d]\n",
+            node->lno);
+    return NULL;
+  }
+
+  par_body_t *body = alloc(sizeof(par_body_t));
+  body->block = block;
+  body->n_slots = scope.n_slots;
+  body->n_reads = pnode->reads->size;
+  body->n_accs = pnode->accs->size;
+  return body;
+}
+
+static int run_chunk(const job_t *j, const unsigned int k) {
+  const par_body_t *body = j->body;
+  const unsigned int n_frame = 1 + body->n_reads + body->n_accs;
+
+  value_t slots[body->n_slots + 1];
+  memcpy(slots, j->frame, n_frame * sizeof(value_t));
+
+  const unsigned long long lo = k * j->size;
+  const unsigned long long hi = j->len - lo < j->size ? j->len : lo + j->size;
+  for (unsigned long long i = lo; i < hi; i++) {
+    slots[0].as.i = (unsigned long long)j->beg + i;
+    if (!closure_run(body->block, slots)) return 0;
+  }
+
+  memcpy(&j->parts[k * body->n_accs], &slots[1 + body->n_reads],
+         body->n_accs * sizeof(value_t));
+  return 1;
+}
+
+/* Runs chunks of j until none is left, or one of them failed. */
+static void work(job_t *j) {
+  for (;;) {
+    pthread_mutex_lock(&lock);
+    const unsigned int k = j->next++;
+    const int go = k < j->n_chunks && !j->failed;
+    pthread_mutex_unlock(&lock);
+    if (!go) return;
+
+    if (!run_chunk(j, k)) {
+      pthread_mutex_lock(&lock);
+      j->failed = 1;
+      pthread_mutex_unlock(&lock);
+      return;
+    }
+  }
+}
+
+static void *worker(void *arg) {
+  unsigned long seen = 0;
+  (void)arg;
+
+  pthread_mutex_lock(&lock);
+  for (;;) {
+    while (gen == seen) pthread_cond_wait(&wake, &lock);
+    seen = gen;
+    job_t *j = job;
+    pthread_mutex_unlock(&lock);
+
+    work(j);
+
+    pthread_mutex_lock(&lock);
+    if (--busy == 0) pthread_cond_signal(&idle);
+  }
+
+  return NULL;
+}
+
+/* The thread running the pfor is one of the threads, it starts the others. */
+static void start_pool(void) {
+  long n = par_threads ? par_threads : sysconf(_SC_NPROCESSORS_ONLN);
+  if (n > max_chunks) n = max_chunks;
+
+  for (long i = 1; i < n; i++) {
+    pthread_t t;
+    if (pthread_create(&t, NULL, worker, NULL)) break;
+
+    pthread_detach(t);
+    n_workers++;
+  }
+
+  started = 1;
+}
+
+static int run_job(job_t *j) {
+  if (!started) start_pool();
+
+  in_pfor = 1;
+  const int wakes = n_workers && j->n_chunks > 1;
+  if (wakes) {
+    pthread_mutex_lock(&lock);
+    job = j;
+    gen++;
+    busy = n_workers;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+  }
+
+  work(j);
+
+  if (wakes) {
+    pthread_mutex_lock(&lock);
+    while (busy) pthread_cond_wait(&idle, &lock);
+    pthread_mutex_unlock(&lock);
+  }
+
+  in_pfor = 0;
+  return !j->failed;
+}
+
+static entry_t *lookup(symtbl_t *symtbl, const char *sym) {
+  entry_t *e = get_symentry(symtbl, sym);
+  if (!e) fprintf(stderr, "par.c: missing decl for sym [%s]\n", sym);
+
+  return e;
+}
+
+int par_for(symtbl_t *symtbl, const ast_node_t *node, const long long beg,
+            const long long end) {
+  pfor_node_t *pnode = node->ch;
+  if (end <= beg) return 1;
+
+  if (!pnode->body && !(pnode->body = compile_pfor(symtbl, node))) return 0;
+  const par_body_t *body = pnode->body;
+
+  value_t frame[1 + body->n_reads + body->n_accs], accs[body->n_accs + 1];
+  frame[0].type = integer;
+  frame[0].as.i = beg;
+
+  unsigned int i = 1;
+  for (node_t *n = pnode->reads->head; n; n = n->next, i++) {
+    const entry_t *e = lookup(symtbl, n->data);
+    if (!e) return 0;
+
+    frame[i] = to_value(&(token_t){e->val, e->vtype});
+  }
+
+  unsigned int k = 0;
+  for (node_t *n = pnode->accs->head; n; n = n->next, i++, k++) {
+    const reduce_t *r = n->data;
+    const entry_t *e = lookup(symtbl, r->sym);
+    if (!e) return 0;
+
+    if (!is_num(e->vtype)) {
+      fprintf(stderr, "par.c: accumulator [%s] isn't a number\n", r->sym);
+      return 0;
+    }
+
+    accs[k] = to_value(&(token_t){e->val, e->vtype});
+    frame[i].type = integer;
+    frame[i].as.i = r->op == '*';
+  }
+
+  /* None of the chunks is empty. */
+  const unsigned long long len = (unsigned long long)end - beg;
+  unsigned long long n_chunks = (len + min_chunk - 1) / min_chunk;
+  if (n_chunks > max_chunks) n_chunks = max_chunks;
+  const unsigned long long size = (len + n_chunks - 1) / n_chunks;
+  n_chunks = (len + size - 1) / size;
+
+  value_t parts[n_chunks * body->n_accs + 1];
+  job_t j = {body, frame, parts, beg, len, size, n_chunks, 0, 0};
+  if (!run_job(&j)) return 0;
+
+  k = 0;
+  for (node_t *n = pnode->accs->head; n; n = n->next, k++) {
+    const reduce_t *r = n->data;
+    const char *op = r->op == '*' ? "*" : "+";
+    for (unsigned int c = 0; c < j.n_chunks; c++)
+      eval_expr(&accs[k], &parts[c * body->n_accs + k], op, &accs[k]);
+
+    const token_t tk = value_token(&accs[k]);
+    if (!register_sym(symtbl, r->sym, tk.tk, tk.type, 0)) return 0;
+  }
+
+  return 1;
+}
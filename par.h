@@ -0,0 +1,24 @@
+#pragma once
+
+#include "node.h"
+#include "symtbl.h"
+
+/* Threads pfors run on, set with --threads. 0 is one per online CPU. */
+extern int par_threads;
+
+/**
+ * Set while a pfor runs. Its threads can't free what the others use, so a
+ * failure that exits (see expr_fail()) skips cleanup() then.
+ */
+extern int in_pfor;
+
+/**
+ * Checks the bodies of the pfors of sig, see par.c, and records the vars each
+ * reads & reduces into. Fails on anything that another index could see. Called
+ * once the body is compiled, before calls are inlined into it.
+ */
+int check_par(const fsig_t *sig, const symtbl_t *symtbl);
+
+/* Runs the body of the pfor node for every integer in [beg, end). */
+int par_for(symtbl_t *symtbl, const ast_node_t *node, const long long beg,
+            const long long end);
@@ -24,13 +24,13 @@ list_t *parse_arglist(list_t *tokens, const unsigned int onlyvar) {
   token_t *arg;
   while (tokens->size) {
     arg = pop_token(tokens, 1);
-    if (!strcmp(arg->tk, ",")) {
+    if (match_token(arg, ",")) {
       if (idx % 2 != 1) {
         fprintf(stderr, "parse.c: invalid position in arglist [,]\n");
         cleanup();
         _Exit(1);
       }
-    } else if (strcmp(arg->tk, ")")) {
+    } else if (!match_token(arg, ")")) {
       switch (arg->type) {
         case identifier:
           break;
@@ -38,6 +38,7 @@ list_t *parse_arglist(list_t *tokens, const unsigned int onlyvar) {
           if (onlyvar) goto invarg;
           break;
         case numeric:
+        case integer:
           if (onlyvar) goto invarg;
           break;
 
@@ -46,7 +47,7 @@ list_t *parse_arglist(list_t *tokens, const unsigned int onlyvar) {
       }
 
       assert(add(args, arg));
-    } else if (!strcmp(arg->tk, ")"))
+    } else
       break;
 
     idx++;
@@ -70,7 +71,7 @@ int parse_next(list_t *tokens, void **buf, unsigned int *type) {
   token_t *ft = peek_front(tokens);
   token_t *la = tokens->size > 1 ? lookahead(tokens) : NULL;
 
-  if (ft->type == identifier && la && !strcmp(la->tk, "(")) {
+  if (ft->type == identifier && la && match_token(la, "(")) {
     if (parse_func(buf, tokens) >= 0) {
       *type = fretval;
       return 1;
@@ -78,7 +79,7 @@ int parse_next(list_t *tokens, void **buf, unsigned int *type) {
   }
 
   if ((ft->type == identifier || ft->type == string) &&
-      (la && !strcmp(la->tk, "["))) {
+      (la && match_token(la, "["))) {
     if (parse_indx(buf, tokens) >= 0) {
       *type = indx;
       return 1;
@@ -114,6 +115,8 @@ int parse_cond(const char *kwd, void **buf, list_t *tokens) {
 
   pop_front(tokens);
   cnode_t *cnode = alloc(sizeof(cnode_t));
+  cnode->type = unknown;
+  cnode->step = NULL;
 
   /* Parse LHS */
   if (!parse_next(tokens, &cnode->lhs, &cnode->ltype)) {
@@ -152,6 +155,52 @@ int parse_cond(const char *kwd, void **buf, list_t *tokens) {
   return strcmp(kwd, "if") == 0 ? cond : floop;
 }
 
+int parse_pfor(void **buf, list_t *tokens) {
+  /**
+   * pfor <idf> = <beg>, <end>
+   * beg -> [idf/numeric/function result]
+   * end -> [idf/numeric/function result]
+   */
+
+  pop_front(tokens);
+  token_t *var = pop_token(tokens, 0);
+  if (!var || var->type != identifier) {
+    fprintf(stderr, "parse.c: var of pfor must be an identifier\n");
+    return -1;
+  }
+
+  token_t *op = pop_token(tokens, 0);
+  if (!op || !match_token(op, "=")) {
+    fprintf(stderr, "parse.c: expected = after var of pfor\n");
+    return -1;
+  }
+
+  pfor_node_t *pnode = alloc(sizeof(pfor_node_t));
+  pnode->var = var->tk;
+  pnode->reads = init_list();
+  pnode->accs = init_list();
+  pnode->body = NULL;
+
+  if (!tokens->size || !parse_next(tokens, &pnode->beg, &pnode->btype)) {
+    fprintf(stderr, "parse.c: could not parse beg of pfor\n");
+    return -1;
+  }
+
+  token_t *sep = tokens->size ? pop_token(tokens, 0) : NULL;
+  if (!sep || !match_token(sep, ",")) {
+    fprintf(stderr, "parse.c: expected , after beg of pfor\n");
+    return -1;
+  }
+
+  if (!tokens->size || !parse_next(tokens, &pnode->end, &pnode->etype)) {
+    fprintf(stderr, "parse.c: could not parse end of pfor\n");
+    return -1;
+  }
+
+  *buf = pnode;
+  return pfloop;
+}
+
 /**
  * Caution!
  * If parse_xxx() fails, *buf remains NULL. Do not dereference it!
@@ -184,13 +233,13 @@ int parse_decl(const char *kwd, void **buf, list_t *tokens) {
   token_t *op_node = pop_front(tokens);
 
   /* Simple decl */
-  if (!strcmp(op_node->tk, "=")) {
+  if (match_token(op_node, "=")) {
     if (!parse_next(tokens, &decl->rhs, &decl->rtype)) {
       fprintf(stderr, "parse.c: could not parse RHS for var [%d]\n",
               decl->rtype);
       return -1;
     }
-  } else if (!strcmp(op_node->tk, ":")) {
+  } else if (match_token(op_node, ":")) {
     /* No init available */
     token_t *rtype = pop_token(tokens, 0);
     if (!rtype) {
@@ -198,18 +247,22 @@ int parse_decl(const char *kwd, void **buf, list_t *tokens) {
       return -1;
     }
 
-    if (!strcmp(rtype->tk, "int")) {
+    if (match_token(rtype, "int")) {
+      decl->rtype = integer;
+      decl->rhs = alloc(sizeof(long long));
+      *(long long *)decl->rhs = 0;
+    } else if (match_token(rtype, "float")) {
       decl->rtype = numeric;
       decl->rhs = alloc(sizeof(double));
       *(double *)decl->rhs = 0;
-    } else if (!strcmp(rtype->tk, "str")) {
+    } else if (match_token(rtype, "str")) {
       decl->rtype = string;
       decl->rhs = alloc(512);
       memset(decl->rhs, 0, 512);
-    } else if (!strcmp(rtype->tk, "glist")) {
+    } else if (match_token(rtype, "glist")) {
       decl->rtype = glist;
       decl->rhs = init_list();
-    } else if (!strcmp(rtype->tk, "gstack")) {
+    } else if (match_token(rtype, "gstack")) {
       decl->rtype = gstack;
       decl->rhs = init_list();
     } else {
@@ -230,12 +283,21 @@ int parse_decl(const char *kwd, void **buf, list_t *tokens) {
 }
 
 int parse_func(void **buf, list_t *tokens) {
-  int defer = 0;
+  int defer = 0, pure = 0, is_const = 0;
   unsigned int ret = -1;
 
   token_t *func;
   token_t *kwd = peek_front(tokens);
-  if (!strcmp(kwd->tk, "defer")) {
+  if ((match_token(kwd, "pure") || match_token(kwd, "const")) &&
+      match_token(lookahead(tokens), "def")) {
+    is_const = match_token(kwd, "const");
+    pure = 1;
+    pop_front(tokens);
+
+    kwd = peek_front(tokens);
+  }
+
+  if (match_token(kwd, "defer")) {
     defer = 1;
     ret = fdefer;
     pop_front(tokens);
@@ -243,7 +305,7 @@ int parse_func(void **buf, list_t *tokens) {
     kwd = peek_front(tokens);
   }
 
-  if (!strcmp(kwd->tk, "def")) {
+  if (match_token(kwd, "def")) {
     if (defer) {
       fprintf(stderr, "parse.c: unexpected defer keyword\n");
       return -1;
@@ -264,7 +326,7 @@ int parse_func(void **buf, list_t *tokens) {
     return -1;
   }
 
-  if (!strcmp(func->tk, "defer")) {
+  if (match_token(func, "defer")) {
     fprintf(stderr, "parse.c: unexpected defer keyword\n");
     return -1;
   }
@@ -273,6 +335,12 @@ int parse_func(void **buf, list_t *tokens) {
   if (!fnode) return -1;
 
   fnode->func = func->tk;
+  fnode->tail = 0;
+  fnode->pure = pure;
+  fnode->is_const = is_const;
+  fnode->sig = NULL;
+  fnode->builtin = NULL;
+  fnode->typed = 0;
   fnode->args = parse_arglist(tokens, ret == fdecl);
   if (fnode->args == NULL) return -1;
 
@@ -285,6 +353,9 @@ int parse_indx(void **buf, list_t *tokens) {
   ixnode->schar = 0;
   ixnode->beg = NULL;
   ixnode->end = NULL;
+  ixnode->typed = 0;
+  ixnode->in_range = 0;
+  ixnode->len = 0;
 
   token_t *arg = pop_front(tokens);
   switch (arg->type) {
@@ -404,9 +475,20 @@ int parse_return(void **buf, list_t *tokens) {
   return rettype;
 }
 
+int parse_jump(void **buf, list_t *tokens) {
+  /**
+   * break
+   * continue
+   */
+
+  token_t *kwd = pop_token(tokens, 0);
+  *buf = NULL;
+  return match_token(kwd, "break") ? fbreak : fcontinue;
+}
+
 int parse_skwd(void **buf, list_t *tokens) {
   token_t *kwd = pop_token(tokens, 0);
-  if (!strcmp(kwd->tk, "else") || !strcmp(kwd->tk, "end")) {
+  if (match_token(kwd, "else") || match_token(kwd, "end")) {
     return nreq;
   }
 
@@ -433,26 +515,34 @@ int parse_unary(void **buf, list_t *tokens, const unsigned int unarytype) {
 }
 
 int parse(void **buf, list_t *tokens) {
-  const char *kwd = ((token_t *)(tokens->head->data))->tk;
-  if (!strcmp(kwd, "const") || !strcmp(kwd, "var"))
+  token_t *head = tokens->head->data;
+  const char *kwd = head->tk;
+  if (match_token(head, "const") && match_token(lookahead(tokens), "def"))
+    return parse_func(buf, tokens);
+  if (match_token(head, "const") || match_token(head, "var"))
     return parse_decl(kwd, buf, tokens);
-  if (!strcmp(kwd, "def")) return parse_func(buf, tokens);
-  if (!strcmp(kwd, "defer")) return parse_func(buf, tokens);
-  if (!strcmp(kwd, "for")) return parse_cond(kwd, buf, tokens);
-  if (!strcmp(kwd, "if")) return parse_cond(kwd, buf, tokens);
-  if (!strcmp(kwd, "print")) return parse_print(buf, tokens);
-  if (!strcmp(kwd, "read")) return parse_read(buf, tokens);
-  if (!strcmp(kwd, "return")) return parse_return(buf, tokens);
-  if (!strcmp(kwd, "else") || !strcmp(kwd, "end"))
+  if (match_token(head, "def")) return parse_func(buf, tokens);
+  if (match_token(head, "pure") && match_token(lookahead(tokens), "def"))
+    return parse_func(buf, tokens);
+  if (match_token(head, "defer")) return parse_func(buf, tokens);
+  if (match_token(head, "for")) return parse_cond(kwd, buf, tokens);
+  if (match_token(head, "pfor")) return parse_pfor(buf, tokens);
+  if (match_token(head, "if")) return parse_cond(kwd, buf, tokens);
+  if (match_token(head, "print")) return parse_print(buf, tokens);
+  if (match_token(head, "read")) return parse_read(buf, tokens);
+  if (match_token(head, "return")) return parse_return(buf, tokens);
+  if (match_token(head, "break") || match_token(head, "continue"))
+    return parse_jump(buf, tokens);
+  if (match_token(head, "else") || match_token(head, "end"))
     return parse_skwd(buf, tokens);
 
   token_t *tk = lookahead(tokens);
   if (!tk) goto pfail;
 
-  if (!strcmp(tk->tk, "=")) return parse_decl(kwd, buf, tokens);
-  if (!strcmp(tk->tk, "(")) return parse_func(buf, tokens);
-  if (!strcmp(tk->tk, "--")) return parse_unary(buf, tokens, post_dec);
-  if (!strcmp(tk->tk, "++")) return parse_unary(buf, tokens, post_inc);
+  if (match_token(tk, "=")) return parse_decl(kwd, buf, tokens);
+  if (match_token(tk, "(")) return parse_func(buf, tokens);
+  if (match_token(tk, "--")) return parse_unary(buf, tokens, post_dec);
+  if (match_token(tk, "++")) return parse_unary(buf, tokens, post_inc);
 
 pfail:;
   fprintf(stderr, "parse.c: could not parse for kwd [%s]\n", kwd);
@@ -0,0 +1,129 @@
+/**
+ * rt.c
+ * Runtime of programs translated to C with --emit-c, see rt.h.
+ */
+
+#include "rt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtin.h"
+#include "symtbl.h"
+#include "util.h"
+
+unsigned int rt_depth = 0;
+rt_func_t rt_next = NULL;
+value_t rt_args[rt_max_args];
+
+/* Builtins leave their result in the return register of tbl. */
+static symtbl_t *tbl = NULL;
+
+void rt_init(void) { tbl = init_symtbl(); }
+
+int rt_exit(void) {
+  cleanup();
+  return 0;
+}
+
+void rt_halt(void) {
+  fprintf(stderr, "rt.c: error in line %d, program halted\n", lno);
+  cleanup();
+  exit(1);
+}
+
+void rt_deep(void) {
+  fprintf(stderr, "rt.c: stack depth exceeded at L[%d]\n", lno);
+  rt_halt();
+}
+
+void rt_noret(const char *func) {
+  fprintf(stderr, "rt.c: %s() did not return anything\n", func);
+  rt_halt();
+}
+
+/* eval_expr() fails the program on anything non-numeric. */
+void rt_arith(value_t *lhs, value_t *rhs, const char *op) {
+  eval_expr(lhs, rhs, op, lhs);
+}
+
+void rt_compare(value_t *lhs, value_t *rhs, const char *op) {
+  token_t a = value_token(lhs), b = value_token(rhs);
+  const int res = compare(&a, &b, op);
+  if (res < 0) {
+    fprintf(stderr, "rt.c: could not eval condition\n");
+    rt_halt();
+  }
+
+  lhs->type = integer;
+  lhs->as.i = res;
+}
+
+void rt_step(value_t *val, const int step) {
+  if (val->type != numeric) {
+    fprintf(stderr, "rt.c: unary cannot be used on non-numeric types\n");
+    rt_halt();
+  }
+
+  val->as.d += step;
+}
+
+void rt_slice(value_t *arg, value_t *lb, value_t *ub, const int schar) {
+  token_t a = value_token(arg), l, u;
+  if (lb) l = value_token(lb);
+  if (ub) u = value_token(ub);
+
+  char *s = slice(&a, lb ? &l : NULL, ub ? &u : NULL, schar);
+  if (!s) rt_halt();
+
+  arg->type = string;
+  arg->as.p = s;
+}
+
+void rt_print(value_t *val) {
+  const token_t tk = value_token(val);
+  print_token(&tk);
+}
+
+void rt_read(value_t *val) {
+  char *buf = alloc(512);
+  memset(buf, 0, 512);
+  scanf("%s", buf);
+
+  val->type = string;
+  val->as.p = buf;
+}
+
+void rt_builtin(const char *func, value_t *args, const unsigned int argc,
+                const int want, value_t *res) {
+  const builtin_t *builtin = get_builtin(func);
+  token_t tks[argc + 1];
+  const token_t *fargs[argc + 1];
+  for (unsigned int i = 0; i < argc; i++) {
+    tks[i] = value_token(&args[i]);
+    fargs[i] = &tks[i];
+  }
+
+  tbl->has_ret = 0;
+  if (!builtin || !call_builtin(builtin, fargs, argc, tbl)) {
+    fprintf(stderr, "rt.c: could not call %s()\n", func);
+    rt_halt();
+  }
+
+  if (!take_ret(tbl, res) && want) rt_noret(func);
+}
+
+void rt_defer(rt_defers_t *defers, const unsigned int site) {
+  if (defers->n == defers->cap) {
+    const unsigned int cap = defers->cap ? defers->cap * 2 : 8;
+    unsigned int *sites = alloc(cap * sizeof(unsigned int));
+    if (defers->sites)
+      memcpy(sites, defers->sites, defers->n * sizeof(unsigned int));
+
+    defers->sites = sites;
+    defers->cap = cap;
+  }
+
+  defers->sites[defers->n++] = site;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+/**
+ * Runtime of programs translated to C with --emit-c (see emit.c). Only the
+ * integer fast paths are inlined, everything else goes through the same code as
+ * the interpreters, so that translated programs behave exactly like them. Link
+ * against the cherry_core library.
+ */
+
+#include "eval.h"
+#include "expr.h"
+#include "memo.h"
+#include "token.h"
+#include "value.h"
+
+/* Deferred calls of a function, made in reverse once it returns. */
+typedef struct rt_defers {
+  unsigned int *sites;
+  unsigned int n, cap;
+} rt_defers_t;
+
+/**
+ * A translated function returns whether it left a value in ret, or that
+ * rt_next must be called in its place with rt_args (a tail call). The result of
+ * a bare tail call is discarded.
+ */
+typedef int (*rt_func_t)(value_t *args, value_t *ret);
+enum { rt_none, rt_value, rt_tail, rt_tail_bare };
+enum { rt_max_args = 64 };
+
+/* Calls on the C stack, deeper than DEFAULT_MAX_DEPTH fail. */
+extern unsigned int rt_depth;
+extern rt_func_t rt_next;
+extern value_t rt_args[rt_max_args];
+
+void rt_init(void);
+int rt_exit(void);
+void rt_halt(void);
+void rt_deep(void);
+void rt_noret(const char *func);
+void rt_arith(value_t *lhs, value_t *rhs, const char *op);
+void rt_compare(value_t *lhs, value_t *rhs, const char *op);
+void rt_step(value_t *val, const int step);
+void rt_slice(value_t *arg, value_t *lb, value_t *ub, const int schar);
+void rt_print(value_t *val);
+void rt_read(value_t *val);
+void rt_builtin(const char *func, value_t *args, const unsigned int argc,
+                const int want, value_t *res);
+void rt_defer(rt_defers_t *defers, const unsigned int site);
+
+static inline void rt_enter(void) {
+  if (++rt_depth > DEFAULT_MAX_DEPTH) rt_deep();
+}
+
+/* Returns 1 if func (or what it tail called) left a value in ret. */
+static inline int rt_call(rt_func_t func, value_t *args, value_t *ret) {
+  int status = func(args, ret), discard = 0;
+  while (status >= rt_tail) {
+    discard |= status == rt_tail_bare;
+    status = rt_next(rt_args, ret);
+  }
+
+  return status == rt_value && !discard;
+}
+
+static inline value_t rt_int(const long long i) {
+  value_t val = {integer, {.i = i}};
+  return val;
+}
+
+static inline value_t rt_num(const double d) {
+  value_t val = {numeric, {.d = d}};
+  return val;
+}
+
+static inline value_t rt_str(const char *s) {
+  value_t val = {string, {.p = (void *)s}};
+  return val;
+}
+
+/* / and % only leave the edge cases to eval_int(). */
+static inline long long rt_idiv(const long long a, const long long b,
+                                const char *op) {
+  if (b == 0 || b == -1) return eval_int(a, b, op);
+  return op[0] == '/' ? a / b : a % b;
+}
+
+/* The slow paths set lno for their errors. */
+#define RT_ARITH(l, r, op, expr, line)                \
+  do {                                                \
+    if ((l).type == integer && (r).type == integer) { \
+      const long long a = (l).as.i, b = (r).as.i;     \
+      (l).as.i = (expr);                              \
+    } else {                                          \
+      lno = (line);                                   \
+      rt_arith(&(l), &(r), op);                       \
+    }                                                 \
+  } while (0)
+
+#define RT_UNARY(v, op, expr, line)  \
+  do {                               \
+    if ((v).type == integer) {       \
+      const long long b = (v).as.i;  \
+      (v).as.i = (expr);             \
+    } else {                         \
+      lno = (line);                  \
+      rt_arith(&(v), &(v), op);      \
+    }                                \
+  } while (0)
+
+#define RT_CMP(l, r, op, cop, line)                   \
+  do {                                                \
+    if ((l).type == integer && (r).type == integer) { \
+      (l).as.i = (l).as.i cop (r).as.i;               \
+    } else {                                          \
+      lno = (line);                                   \
+      rt_compare(&(l), &(r), op);                     \
+    }                                                 \
+  } while (0)
+
+#define RT_STEP(v, step, line)                          \
+  do {                                                  \
+    if ((v).type == integer) {                          \
+      (v).as.i = (unsigned long long)(v).as.i + (step); \
+    } else {                                            \
+      lno = (line);                                     \
+      rt_step(&(v), step);                              \
+    }                                                   \
+  } while (0)
+
+#define RT_ADD(l, r, line) \
+  RT_ARITH(l, r, "+", (unsigned long long)a + b, line)
+#define RT_SUB(l, r, line) \
+  RT_ARITH(l, r, "-", (unsigned long long)a - b, line)
+#define RT_MUL(l, r, line) \
+  RT_ARITH(l, r, "*", (unsigned long long)a * b, line)
+#define RT_DIV(l, r, line) RT_ARITH(l, r, "/", rt_idiv(a, b, "/"), line)
+#define RT_MOD(l, r, line) RT_ARITH(l, r, "%", rt_idiv(a, b, "%"), line)
+#define RT_SHL(l, r, line) \
+  RT_ARITH(l, r, "<<", (unsigned long long)a << (b & 63), line)
+#define RT_SHR(l, r, line) RT_ARITH(l, r, ">>", a >> (b & 63), line)
+#define RT_BAND(l, r, line) RT_ARITH(l, r, "&", a & b, line)
+#define RT_BOR(l, r, line) RT_ARITH(l, r, "|", a | b, line)
+#define RT_BXOR(l, r, line) RT_ARITH(l, r, "^", a ^ b, line)
+#define RT_NEG(v, line) RT_UNARY(v, "u-", -(unsigned long long)b, line)
+#define RT_POS(v, line) RT_UNARY(v, "u+", b, line)
+#define RT_BNOT(v, line) RT_UNARY(v, "~", ~b, line)
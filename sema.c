@@ -0,0 +1,256 @@
+/**
+ * sema.c
+ * Semantic checks on the AST of a function.
+ *
+ * The body is checked once, when it's prepared and before anything is inlined
+ * into it or optimized away, so that what's reported is what was written.
+ * Syms are resolved with the same block scopes the compilers use (see
+ * compile.h). With --warn, reports -
+ * 1. statements after a return, break or continue (or an if whose branches
+ *    both end that way) in the same block, which never run,
+ * 2. conditions that only read literals & consts, which eval the same way
+ *    every time,
+ * 3. fors whose condition nothing in their body changes, and whose body
+ *    neither returns, breaks out of it nor makes a call that could end the
+ *    program, which never end once they're entered.
+ *
+ * Calls are resolved and their number of args verified when the body is linked
+ * (see load_body()), so nothing is checked again while the program runs.
+ */
+
+#include "sema.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "compile.h"
+#include "node.h"
+#include "opt.h"
+#include "token.h"
+#include "util.h"
+
+int warns = 0;
+
+typedef struct check {
+  const fsig_t *sig;
+  const symtbl_t *symtbl;
+  scope_t scope;
+} check_t;
+
+static void warn(const check_t *c, const int lno, const char *what) {
+  fprintf(stderr, "sema.c: %s() L[%d] %s\n", c->sig->func, lno, what);
+}
+
+/* Syms that nodes may assign, blocks nested in them included. */
+static void assigned(const list_t *nodes, list_t *syms) {
+  for (node_t *n = nodes->head; n; n = n->next) {
+    const ast_node_t *node = n->data;
+    if (node->type == vdecl) add(syms, ((decl_node_t *)node->ch)->lhs);
+    if (node->type == cin) add(syms, ((read_node_t *)node->ch)->arg);
+    if (node->type == post_dec || node->type == post_inc)
+      add(syms, ((unary_node_t *)node->ch)->arg);
+
+    assigned(node->lch, syms);
+    assigned(node->rch, syms);
+  }
+}
+
+static int has_sym(const list_t *syms, const char *sym) {
+  for (node_t *n = syms->head; n; n = n->next)
+    if (!strcmp(n->data, sym)) return 1;
+
+  return 0;
+}
+
+static int fixed_token(const check_t *c, const list_t *syms,
+                       const token_t *tk);
+
+/**
+ * Whether the operand evals the same way every time, i.e, it only reads
+ * literals, consts and (if syms isn't NULL) vars that aren't in syms, and only
+ * calls builtins without side effects.
+ */
+static int fixed(const check_t *c, const list_t *syms, const void *buf,
+                 const unsigned int type) {
+  switch (type) {
+    case string:
+    case numeric:
+    case integer:
+      return 1;
+
+    case identifier: {
+      value_t val;
+      const cvar_t *v = resolve_sym(&c->scope, buf);
+      if (!v) return global_const(c->symtbl, buf, &val);
+      return v->is_const || (syms && !has_sym(syms, buf));
+    }
+
+    case exprtree: {
+      const binary_node_t *node = buf;
+      if (!node->lhs && !node->rhs) return fixed_token(c, syms, node->val);
+      return fixed(c, syms, node->lhs, exprtree) &&
+             fixed(c, syms, node->rhs, exprtree);
+    }
+
+    case fretval: {
+      const func_node_t *fnode = buf;
+      if (!pure_call(fnode, c->symtbl)) return 0;
+
+      for (node_t *arg = fnode->args->head; arg; arg = arg->next)
+        if (!fixed_token(c, syms, arg->data)) return 0;
+      return 1;
+    }
+
+    case indx: {
+      const indx_node_t *ixnode = buf;
+      return fixed_token(c, syms, ixnode->arg) &&
+             (!ixnode->beg || fixed(c, syms, ixnode->beg, ixnode->ltype)) &&
+             (!ixnode->end || fixed(c, syms, ixnode->end, ixnode->rtype));
+    }
+  }
+
+  return 0;
+}
+
+static int fixed_token(const check_t *c, const list_t *syms,
+                       const token_t *tk) {
+  return fixed(c, syms, tk->tk, tk->type);
+}
+
+static int fixed_cond(const check_t *c, const list_t *syms,
+                      const cnode_t *cnode) {
+  return fixed(c, syms, cnode->lhs, cnode->ltype) &&
+         fixed(c, syms, cnode->rhs, cnode->rtype);
+}
+
+/* Whether the operand calls anything but builtins without side effects. */
+static int calls(const check_t *c, const void *buf, const unsigned int type) {
+  if (type == fretval) return !pure_call(buf, c->symtbl);
+  if (type != indx) return 0;
+
+  const indx_node_t *ixnode = buf;
+  return (ixnode->beg && calls(c, ixnode->beg, ixnode->ltype)) ||
+         (ixnode->end && calls(c, ixnode->end, ixnode->rtype));
+}
+
+/**
+ * Whether running nodes may leave the for they're the body of other than by
+ * its condition - by returning, breaking out of it, or by making a call that
+ * could exit() or fail. inner is set in the body of a for nested in it.
+ */
+static int leaves(const check_t *c, const list_t *nodes, const int inner) {
+  for (node_t *n = nodes->head; n; n = n->next) {
+    ast_node_t *node = n->data;
+    if (node->type == rettype || node->type == fcall || node->type == fdefer)
+      return 1;
+    if (node->type == fbreak && !inner) return 1;
+
+    void **bufs[2];
+    unsigned int *types[2];
+    const unsigned int count = node_operands(node, bufs, types);
+    for (unsigned int i = 0; i < count; i++)
+      if (calls(c, *bufs[i], *types[i])) return 1;
+
+    const int nested = inner || node->type == floop || node->type == pfloop;
+    if (leaves(c, node->lch, nested) || leaves(c, node->rch, nested)) return 1;
+  }
+
+  return 0;
+}
+
+static int check_block(check_t *c, const list_t *nodes);
+
+static int check_branch(check_t *c, const list_t *nodes) {
+  open_scope(&c->scope);
+  const int ret = check_block(c, nodes);
+  close_scope(&c->scope);
+  return ret;
+}
+
+/* Returns 1 if node never falls through to the next one. */
+static int check_node(check_t *c, const ast_node_t *node) {
+  switch (node->type) {
+    case vdecl: {
+      const decl_node_t *dnode = node->ch;
+      assign_sym(&c->scope, dnode->lhs, dnode->is_const);
+      return 0;
+    }
+
+    case cin:
+      assign_sym(&c->scope, ((read_node_t *)node->ch)->arg, 0);
+      return 0;
+
+    case cond: {
+      if (fixed_cond(c, NULL, node->ch))
+        warn(c, node->lno, "condition only depends on literals & consts");
+
+      const int lret = check_branch(c, node->lch);
+      const int rret = check_branch(c, node->rch);
+      return lret && rret;
+    }
+
+    case floop: {
+      list_t *syms = init_list();
+      assigned(node->lch, syms);
+
+      if (fixed_cond(c, NULL, node->ch))
+        warn(c, node->lno, "condition only depends on literals & consts");
+      if (fixed_cond(c, syms, node->ch) && !leaves(c, node->lch, 0))
+        warn(c, node->lno, "for never ends once it's entered");
+
+      c->scope.loops++;
+      check_branch(c, node->lch);
+      c->scope.loops--;
+      return 0;
+    }
+
+    case pfloop:
+      c->scope.loops++;
+      open_scope(&c->scope);
+      add_var(&c->scope, ((pfor_node_t *)node->ch)->var, 1);
+      check_block(c, node->lch);
+      close_scope(&c->scope);
+      c->scope.loops--;
+      return 0;
+
+    case rettype:
+    case fbreak:
+    case fcontinue:
+      return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * Returns 1 if the block never falls through its end, i.e, it returns, breaks
+ * or continues.
+ */
+static int check_block(check_t *c, const list_t *nodes) {
+  for (node_t *n = nodes->head; n && c->scope.ok; n = n->next) {
+    if (!check_node(c, n->data)) continue;
+    if (!n->next) return 1;
+
+    unsigned int dead = 0;
+    for (node_t *d = n->next; d; d = d->next) dead++;
+
+    char buf[64];
+    snprintf(buf, sizeof buf, "unreachable, %d statement(s) never run", dead);
+    warn(c, ((ast_node_t *)n->next->data)->lno, buf);
+    return 1;
+  }
+
+  return 0;
+}
+
+void check_body(const fsig_t *sig, const symtbl_t *symtbl) {
+  if (!warns) return;
+
+  check_t c;
+  memset(&c, 0, sizeof c);
+  c.sig = sig;
+  c.symtbl = symtbl;
+
+  init_scope(&c.scope, sig, symtbl);
+  if (c.scope.ok) check_block(&c, ((ast_node_t *)sig->node)->lch);
+}
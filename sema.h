@@ -0,0 +1,13 @@
+#pragma once
+
+#include "symtbl.h"
+
+/* Set by --warn, check_body() reports what it finds to stderr. */
+extern int warns;
+
+/**
+ * Reports code that never runs, conditions that never change and fors that
+ * never end in the body of sig, if --warn is set. Called once the body is
+ * compiled, before calls are inlined into it (see prepare_body()).
+ */
+void check_body(const fsig_t *sig, const symtbl_t *symtbl);
@@ -8,44 +8,65 @@
 #include "token.h"
 #include "util.h"
 
+static int store_sym(symtbl_t *symtbl, frame_t *frame, entry_t *e,
+                     const char *sym, const void *val, const unsigned int vtype,
+                     const unsigned int is_const);
+
 symtbl_t *init_symtbl(void) {
   symtbl_t *symtbl = alloc(sizeof(symtbl_t));
   assert(symtbl);
 
   symtbl->depth = 0;
-  symtbl->frames = init_list();
+  symtbl->frame = symtbl->spare = NULL;
   symtbl->fsigs = init_list();
-  symtbl->retstack = init_list();
-  symtbl->vscope = init_list();
-  return symtbl;
-}
+  symtbl->init = NULL;
+  symtbl->has_ret = 0;
 
-int init_frame(symtbl_t *symtbl) {
-  if (!symtbl) return 0;
+  symtbl->globals = alloc(sizeof(frame_t));
+  assert(symtbl->globals);
+  symtbl->globals->entries = init_list();
+  symtbl->globals->defer_stack = init_list();
+  symtbl->globals->prev = NULL;
+
+  int j = 0;
+  const char *s[] = {"string", "numeric", "integer", "identifier"};
 
-  frame_t *frame = alloc(sizeof(frame_t));
-  assert(frame);
+  /* store_sym() copies the value, nothing has to be alloc'd. */
+  for (int i = string; i <= identifier; i++, j++) {
+    long long t = i;
+    assert(store_sym(symtbl, symtbl->globals, NULL, s[j], &t, integer, 1));
+  }
 
-  frame->entries = init_list();
-  frame->defer_stack = init_list();
-  return add(symtbl->frames, frame);
+  return symtbl;
 }
 
-int init_globals(symtbl_t *symtbl) {
+/* Every entry of frame is dead (see scope_cleanup()) once it's popped. */
+int init_frame(symtbl_t *symtbl) {
   if (!symtbl) return 0;
 
-  int j = 0;
-  const char *s[] = {"string", "numeric", "identifier"};
+  frame_t *frame = symtbl->spare;
+  if (frame) {
+    symtbl->spare = frame->prev;
+  } else {
+    frame = alloc(sizeof(frame_t));
+    assert(frame);
 
-  for (int i = string; i <= identifier; i++, j++) {
-    double d = i;
-    token_t *tk = ptr_to_token(numeric, &d);
-    assert(register_sym(symtbl, s[j], tk->tk, numeric, 1));
+    frame->entries = init_list();
+    frame->defer_stack = init_list();
   }
 
+  frame->prev = symtbl->frame;
+  symtbl->frame = frame;
   return 1;
 }
 
+int is_arg(const fsig_t *sig, const char *sym) {
+  for (node_t *arg = sig->args->head; arg; arg = arg->next)
+    if (!strcmp(((token_t *)arg->data)->tk, sym)) return 1;
+
+  return 0;
+}
+
 fsig_t *get_fsig(const symtbl_t *symtbl, const char *func) {
   if (!symtbl) return NULL;
 
@@ -57,8 +78,9 @@ fsig_t *get_fsig(const symtbl_t *symtbl, const char *func) {
   return NULL;
 }
 
-entry_t *get_symentry(const symtbl_t *symtbl, const char *sym) {
-  frame_t *frame = peek_last(symtbl->frames);
+static entry_t *find_entry(const frame_t *frame, const char *sym) {
+  if (!frame) return NULL;
+
   for (node_t *entry = frame->entries->head; entry; entry = entry->next) {
     if (!strcmp(((entry_t *)(entry->data))->sym, sym)) return entry->data;
   }
@@ -66,47 +88,93 @@ entry_t *get_symentry(const symtbl_t *symtbl, const char *sym) {
   return NULL;
 }
 
-int init_funcargs(symtbl_t *symtbl, const list_t *sargs, const list_t *fargs) {
-  if (!symtbl || !sargs || !fargs) return 0;
-  entry_t e[sargs->size];
-
-  for (unsigned int i = 0; i < sargs->size; i++) {
-    token_t *alias = peek_idx(sargs, i);
-    token_t *val = peek_idx(fargs, i);
-
-    strcpy(e[i].sym, alias->tk);
-    if (val->type == identifier) {
-      entry_t *t = get_symentry(symtbl, val->tk);
-      assert(t);
-
-      e[i].val = t->val;
-      e[i].vtype = t->vtype;
-      e[i].is_const = t->is_const;
-    } else {
-      if (val->type == numeric) {
-        e[i].val = alloc(sizeof(double));
-        *(double *)(e[i].val) = *(double *)val->tk;
-      } else {
-        e[i].val = val->tk;
-      }
-
-      e[i].vtype = val->type;
-      e[i].is_const = 0;
-    }
-  }
+entry_t *get_global(const symtbl_t *symtbl, const char *sym) {
+  return find_entry(symtbl->globals, sym);
+}
 
-  assert(init_frame((symtbl_t *)symtbl));
-  for (unsigned int i = 0; i < sargs->size; i++) {
-    assert(register_sym(symtbl, e[i].sym, e[i].val, e[i].vtype, e[i].is_const));
+/* Locals (args included) shadow globals, which can't be read before set. */
+entry_t *get_symentry(const symtbl_t *symtbl, const char *sym) {
+  entry_t *e = find_entry(symtbl->frame, sym);
+  if (e) return e;
+
+  e = get_global(symtbl, sym);
+  return e && e->vtype != none ? e : NULL;
+}
+
+/* Args are always locals of the frame, even if a global has the same sym. */
+static int bind_args(symtbl_t *symtbl, const list_t *sargs, value_t *args) {
+  unsigned int i = 0;
+  for (node_t *alias = sargs->head; alias; alias = alias->next, i++) {
+    const char *sym = ((token_t *)alias->data)->tk;
+    const token_t val = value_token(&args[i]);
+    entry_t *e = find_entry(symtbl->frame, sym);
+    if (!store_sym(symtbl, symtbl->frame, e, sym, val.tk, val.type, 0))
+      return 0;
   }
 
   return 1;
 }
 
+/* Registers args (already evaluated) under the names in sargs. */
+int init_funcargs(symtbl_t *symtbl, const list_t *sargs, value_t *args) {
+  if (!symtbl || !sargs) return 0;
+  assert(init_frame(symtbl));
+
+  return bind_args(symtbl, sargs, args);
+}
+
+static void kill_entries(frame_t *frame) {
+  for (node_t *entry = frame->entries->head; entry; entry = entry->next)
+    ((entry_t *)entry->data)->sym[0] = '\0';
+}
+
 int pop_frame(symtbl_t *symtbl) {
-  if (!symtbl) return 0;
+  if (!symtbl || !symtbl->frame) return 0;
+
+  frame_t *frame = symtbl->frame;
+  kill_entries(frame);
+
+  symtbl->frame = frame->prev;
+  frame->prev = symtbl->spare;
+  symtbl->spare = frame;
+  return 1;
+}
+
+/**
+ * Tail calls - drops every sym of the last frame and registers args in it
+ * instead of pushing a new frame. The entries are reused by register_sym().
+ */
+int reuse_frame(symtbl_t *symtbl, const list_t *sargs, value_t *args) {
+  if (!symtbl || !sargs) return 0;
 
-  return pop_last(symtbl->frames) != NULL;
+  kill_entries(symtbl->frame);
+  return bind_args(symtbl, sargs, args);
+}
+
+fsig_t *init_fsig(const char *func, const list_t *args, const void *node) {
+  fsig_t *sig = alloc(sizeof(fsig_t));
+  assert(sig);
+
+  sig->func = (char *)func;
+  sig->args = (list_t *)args;
+  sig->node = (node_t *)node;
+  sig->src = NULL;
+  sig->body_beg = sig->body_end = 0;
+  sig->body_lno = 0;
+  sig->lazy = 0;
+  sig->prepared = sig->fail_lno = 0;
+  sig->linked = 0;
+  sig->chunk = NULL;
+  sig->no_chunk = 0;
+  sig->closure = NULL;
+  sig->no_closure = 0;
+  sig->native = NULL;
+  sig->no_native = 0;
+  sig->hits = 0;
+  sig->decl_pure = sig->decl_const = 0;
+  sig->purity = 0;
+  sig->memo = NULL;
+  return sig;
 }
 
 int register_func(symtbl_t *symtbl, const char *func, const list_t *args,
@@ -118,18 +186,25 @@ int register_func(symtbl_t *symtbl, const char *func, const list_t *args,
     return 0;
   }
 
-  fsig_t *sig = alloc(sizeof(fsig_t));
-  assert(sig);
+  return add(symtbl->fsigs, init_fsig(func, args, node));
+}
 
-  sig->func = (char *)func;
-  sig->args = (list_t *)args;
-  sig->node = (node_t *)node;
-  return add(symtbl->fsigs, sig);
+/* Returns an entry of frame whose sym went out of scope, if any. */
+static entry_t *dead_entry(const frame_t *frame) {
+  for (node_t *entry = frame->entries->head; entry; entry = entry->next) {
+    if (((entry_t *)entry->data)->sym[0] == '\0') return entry->data;
+  }
+
+  return NULL;
 }
 
-int register_sym(symtbl_t *symtbl, const char *sym, const void *val,
-                 const unsigned int vtype, const unsigned int is_const) {
-  if (!symtbl) return 0;
+/**
+ * Sets e, or a new entry of frame if e is NULL, to val. An entry that's alloc'd
+ * is only added to frame once it's set.
+ */
+static int store_sym(symtbl_t *symtbl, frame_t *frame, entry_t *e,
+                     const char *sym, const void *val, const unsigned int vtype,
+                     const unsigned int is_const) {
   if (is_reserved(sym)) {
     fprintf(stderr, "symtbl.c: sym is a reserved keyword [%s]\n", sym);
     return 0;
@@ -140,6 +215,7 @@ int register_sym(symtbl_t *symtbl, const char *sym, const void *val,
     case string:
     case identifier:
     case numeric:
+    case integer:
     case glist:
     case gstack:
       break;
@@ -148,52 +224,95 @@ int register_sym(symtbl_t *symtbl, const char *sym, const void *val,
       return 0;
   }
 
+  if (e && e->is_const) {
+    fprintf(stderr, "symtbl.c: sym is marked const, can't modify [%s]\n", sym);
+    return 0;
+  }
+
   /**
-   * Get a pointer to a slot into the symtbl. This pointer is NULL if we're
-   * declaring a new variable.
+   * Assigning to an existing sym keeps the scope it was declared in, otherwise
+   * a var declared outside a block would be cleaned up at the end of the block
+   * it was last assigned in.
    */
-  entry_t *e = get_symentry(symtbl, sym);
-  if (!e) {
-    e = alloc(sizeof(entry_t));
-  }
+  const int is_new = e == NULL;
+  if (is_new) e = dead_entry(frame);
 
-  if (e->is_const) {
-    fprintf(stderr, "symtbl.c: sym is marked const, can't modify [%s]\n", sym);
-    return 0;
+  /* Only alloc a new entry if no dead one is left in the frame. */
+  const int is_alloc = e == NULL;
+  if (is_alloc) e = alloc(sizeof(entry_t));
+
+  if (is_new) {
+    strcpy(e->sym, sym);
+    e->depth = symtbl->depth;
   }
 
-  strcpy(e->sym, sym);
-  e->val = (void *)val;
   e->vtype = vtype;
   e->is_const = is_const;
-  e->depth = symtbl->depth;
 
-  frame_t *lframe = peek_last(symtbl->frames);
-  return add(symtbl->vscope, e) && add(lframe->entries, e);
+  if (vtype == integer) {
+    e->num.i = *(const long long *)val;
+    e->val = &e->num.i;
+  } else if (vtype == numeric) {
+    e->num.d = *(const double *)val;
+    e->val = &e->num.d;
+  } else {
+    e->val = (void *)val;
+  }
+
+  return !is_alloc || add(frame->entries, e);
 }
 
+int register_sym(symtbl_t *symtbl, const char *sym, const void *val,
+                 const unsigned int vtype, const unsigned int is_const) {
+  if (!symtbl) return 0;
+
+  /**
+   * Get a pointer to a slot into the symtbl. This pointer is NULL if we're
+   * declaring a new variable. A global whose decl hasn't run yet is set too.
+   */
+  entry_t *e = find_entry(symtbl->frame, sym);
+  if (!e) e = get_global(symtbl, sym);
+  return store_sym(symtbl, symtbl->frame, e, sym, val, vtype, is_const);
+}
+
+int declare_global(symtbl_t *symtbl, const char *sym) {
+  if (!symtbl) return 0;
+  if (get_global(symtbl, sym)) return 1;
+
+  return store_sym(symtbl, symtbl->globals, NULL, sym, NULL, none, 0);
+}
+
+/**
+ * Do not free up vars that went out of scope, instead null the sym. This will
+ * prevent get_symentry() from being able to query it and lets register_sym()
+ * reuse the entry. Any mem alloc'd will be freed before quitting.
+ */
 int scope_cleanup(symtbl_t *symtbl) {
   if (!symtbl) return 0;
-  if (symtbl->vscope->size == 0) return 1;
-
-  entry_t *e = peek_last(symtbl->vscope);
-  if (!e) return 0;
-
-  while (e) {
-    if (symtbl->depth < e->depth) {
-      /**
-       * Do not free up this var, instead null the sym. This will prevent
-       * get_symentry() from being able to query it. Any mem alloc'd will
-       * be freed before quitting.
-       */
-      e->sym[0] = '\0';
-
-      pop_last(symtbl->vscope);
-      e = symtbl->vscope->size != 0 ? peek_last(symtbl->vscope) : NULL;
-    } else {
-      return 1;
-    }
+
+  frame_t *frame = symtbl->frame;
+  for (node_t *entry = frame->entries->head; entry; entry = entry->next) {
+    entry_t *e = entry->data;
+    if (symtbl->depth < e->depth) e->sym[0] = '\0';
   }
 
   return 1;
-}
\ No newline at end of file
+}
+
+/**
+ * Strings are moved into the register, not copied. Strings are never modified
+ * in place, so the caller can keep sharing it.
+ */
+void set_ret(symtbl_t *symtbl, const value_t *val) {
+  symtbl->ret = *val;
+  symtbl->has_ret = 1;
+}
+
+/* Empties the register into val. Returns 0 if nothing was returned. */
+int take_ret(symtbl_t *symtbl, value_t *val) {
+  if (!symtbl->has_ret) return 0;
+
+  symtbl->has_ret = 0;
+  if (val) *val = symtbl->ret;
+  return 1;
+}
@@ -1,45 +1,121 @@
 #pragma once
 
+#include <stdio.h>
+
 #include "list.h"
 #include "node.h"
 #include "token.h"
+#include "value.h"
 
 /* TODO: Use hashing rather than glist. */
 typedef struct entry {
   char sym[512];
   /**
    * If this is a generic container, val is a list and vtype is glist.
-   * Every element inside the list is arg_t as args are parsed by pop_arg in
-   * args.c.
+   * Every element inside the list is arg_t.
    */
   void *val;
   unsigned int depth, vtype, is_const;
+  /**
+   * register_sym() copies numbers in here and points val at it, so that every
+   * var owns its value instead of aliasing another var or a literal.
+   */
+  union {
+    long long i;
+    double d;
+  } num;
 } entry_t;
 
 typedef struct frame {
   list_t *entries, *defer_stack;
+  /* The frame below this one, or the next spare frame once popped. */
+  struct frame *prev;
 } frame_t;
 
 typedef struct fsig {
   char *func;
   void *node;
   list_t *args;
+  /**
+   * Bodies are compiled lazily. Until the first call, only the byte range
+   * [body_beg, body_end) of the body in src and the line it starts on is known.
+   */
+  FILE *src;
+  long body_beg, body_end;
+  int body_lno, lazy;
+  /**
+   * Set once calls in the body have been inlined (see inline.c) and it's been
+   * optimized, -1 while that's being done or for good if it failed, at line
+   * fail_lno.
+   */
+  int prepared, fail_lno;
+  /* Set once every call in the body has been linked to its target. */
+  int linked;
+  /**
+   * Bytecode for the VM (see compile.c), compiled on the first call. no_chunk
+   * is set if the body uses something the compiler doesn't support, in which
+   * case the function always runs on the tree-walker.
+   */
+  void *chunk;
+  int no_chunk;
+  /* Same as chunk, for the closure compiled engine (see closure.c). */
+  void *closure;
+  int no_closure;
+  /* Native code (see jit.c) & the number of calls made before it's compiled. */
+  void *native;
+  int no_native;
+  unsigned int hits;
+  /**
+   * Calls are looked up in memo first if the function is pure and was declared
+   * with pure def, or --memoize is set (see memo.c). purity is what's known
+   * about it so far. A const def is a pure def whose calls with args that are
+   * known are run when the caller is loaded (see opt.c).
+   */
+  int decl_pure, decl_const, purity;
+  struct memo *memo;
 } fsig_t;
 
 typedef struct symtbl {
   unsigned int depth;
-  list_t *frames, *fsigs, *retstack, *vscope;
+  /**
+   * frame is the top of the stack of frames. Popped frames are kept on spare
+   * and reused along with their entries, so that calls don't alloc once the
+   * stack has been that deep.
+   */
+  frame_t *frame, *spare;
+  list_t *fsigs;
+  /**
+   * Entries of the builtin type consts & of the vars and consts declared at the
+   * top level, seen by every function that doesn't shadow them with an arg.
+   * Top-level decls are the body of init, which is run once before main.
+   */
+  frame_t *globals;
+  fsig_t *init;
+  /**
+   * Return register. A function that returns a value leaves it in ret and sets
+   * has_ret, the caller takes it out with take_ret().
+   */
+  value_t ret;
+  int has_ret;
 } symtbl_t;
 
 symtbl_t *init_symtbl(void);
 int init_frame(symtbl_t *symtbl);
-int init_globals(symtbl_t *symtbl);
+fsig_t *init_fsig(const char *func, const list_t *args, const void *node);
+/* Whether sym is an arg of sig, which shadows a global with the same sym. */
+int is_arg(const fsig_t *sig, const char *sym);
 fsig_t *get_fsig(const symtbl_t *symtbl, const char *func);
 entry_t *get_symentry(const symtbl_t *symtbl, const char *sym);
-int init_funcargs(symtbl_t *symtbl, const list_t *sargs, const list_t *fargs);
+/* The entry of a global, vtype is none until its decl has run. */
+entry_t *get_global(const symtbl_t *symtbl, const char *sym);
+int declare_global(symtbl_t *symtbl, const char *sym);
+int init_funcargs(symtbl_t *symtbl, const list_t *sargs, value_t *args);
 int pop_frame(symtbl_t *symtbl);
+int reuse_frame(symtbl_t *symtbl, const list_t *sargs, value_t *args);
 int register_func(symtbl_t *symtbl, const char *func, const list_t *args,
                   const void *node);
 int register_sym(symtbl_t *symtbl, const char *sym, const void *val,
                  const unsigned int vtype, const unsigned int is_const);
-int scope_cleanup(symtbl_t *symtbl);
\ No newline at end of file
+int scope_cleanup(symtbl_t *symtbl);
+void set_ret(symtbl_t *symtbl, const value_t *val);
+int take_ret(symtbl_t *symtbl, value_t *val);
\ No newline at end of file
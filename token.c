@@ -1,19 +1,21 @@
 #include "token.h"
 
 #include <assert.h>
-#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "num.h"
 #include "util.h"
 
 double parse_numeric(const char *numeric) {
-  errno = 0;
-  char *endptr;
-  double num = strtod(numeric, &endptr);
+  double num;
+  if (!parse_num(numeric, &num)) {
+    fprintf(stderr, "token.c: invalid numeric literal [%s]\n", numeric);
+    cleanup();
+    _Exit(1);
+  }
 
-  assert(errno == 0 && endptr == (numeric + strlen(numeric)));
   return num;
 }
 
@@ -21,6 +23,18 @@ token_t *init_token(const char *tk, const unsigned int type) {
   token_t *token = alloc(sizeof(token_t));
   token->type = type;
 
+  if (token->type == integer) {
+    /* Integer literals that don't fit into 64 bits are read as doubles. */
+    long long num;
+    if (parse_int(tk, &num)) {
+      token->tk = alloc(sizeof(long long));
+      *(long long *)token->tk = num;
+      return token;
+    }
+
+    token->type = numeric;
+  }
+
   if (token->type != numeric) {
     token->tk = alloc(512);
     strcpy(token->tk, tk);
@@ -32,11 +46,17 @@ token_t *init_token(const char *tk, const unsigned int type) {
   return token;
 }
 
+/* Integers and doubles mix freely in arithmetic and comparisons. */
+int is_num(const unsigned int type) {
+  return type == numeric || type == integer;
+}
+
 int is_reserved(const char *kwd) {
   static const char *reserved[] = {/* From ast.c */
-                                   "def", "if", "for", "else", "end",
+                                   "def", "if", "for", "pfor", "else", "end",
                                    /* Keywords - from eval.c */
                                    "defer", "var", "print", "read", "return",
+                                   "break", "continue",
                                    /* Built-in - from builtin.c */
                                    "cmp", "len", "idx", "put", "rev", "exit",
                                    "gc", "none"};
@@ -50,7 +70,7 @@ int is_reserved(const char *kwd) {
 }
 
 int match_token(const token_t *tk, const char *val) {
-  if (!tk || tk->type == numeric) return 0;
+  if (!tk || is_num(tk->type)) return 0;
   return strcmp((char *)tk->tk, val) == 0;
 }
 
@@ -73,13 +93,15 @@ token_t *pop_token(list_t *tokens, const unsigned int exprm) {
 
   token_t *stk = peek_front(tokens);
   assert(stk);
-  if (stk->type != numeric) {
+  if (!is_num(stk->type)) {
     return ftk;
   }
 
   if (match_token(ftk, "+")) {
     pop_front(tokens);
     return stk;
+  } else if (stk->type == integer) {
+    *(long long *)stk->tk = -(unsigned long long)*(long long *)stk->tk;
   } else {
     *(double *)stk->tk *= -1;
   }
@@ -89,7 +111,7 @@ token_t *pop_token(list_t *tokens, const unsigned int exprm) {
 }
 
 token_t *ptr_to_token(const unsigned int type, const void *buf) {
-  if ((type != string && type != numeric) || !buf) {
+  if ((type != string && !is_num(type)) || !buf) {
     return NULL;
   }
 
@@ -98,6 +120,9 @@ token_t *ptr_to_token(const unsigned int type, const void *buf) {
   if (type == string) {
     tk->tk = alloc(512);
     strcpy((char *)tk->tk, (char *)buf);
+  } else if (type == integer) {
+    tk->tk = alloc(sizeof(long long));
+    *(long long *)tk->tk = *(long long *)buf;
   } else {
     tk->tk = alloc(sizeof(double));
     *(double *)tk->tk = *(double *)buf;
@@ -105,3 +130,9 @@ token_t *ptr_to_token(const unsigned int type, const void *buf) {
 
   return tk;
 }
+
+/* Reads a numeric token as a double, promoting integers. */
+double to_double(const token_t *tk) {
+  return tk->type == integer ? (double)*(long long *)tk->tk
+                             : *(double *)tk->tk;
+}
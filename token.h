@@ -10,6 +10,7 @@ enum {
   syntax,
   string,
   numeric,
+  integer,
   identifier,
   fretval,
   glist,
@@ -24,7 +25,9 @@ typedef struct token {
 } token_t;
 
 token_t *init_token(const char *tk, const unsigned int type);
+int is_num(const unsigned int type);
 int is_reserved(const char *tk);
 int match_token(const token_t *tk, const char *val);
 token_t *pop_token(list_t *tokens, const unsigned int exprm);
-token_t *ptr_to_token(const unsigned int type, const void *buf);
\ No newline at end of file
+token_t *ptr_to_token(const unsigned int type, const void *buf);
+double to_double(const token_t *tk);
\ No newline at end of file
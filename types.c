@@ -0,0 +1,484 @@
+/**
+ * types.c
+ * Type inference on the AST of a function.
+ *
+ * Syms are resolved to slots with the same block scopes the compilers use (see
+ * compile.h), and the type of every slot is tracked while the body is walked
+ * in order, the way opt.c tracks values. A slot has a type as long as every
+ * path to the statement at hand left a value of that type in it. The args and
+ * the results of calls to functions have no type, those of builtins do. The
+ * body of a for is walked until the types of the slots it assigns no longer
+ * change, along with those at its breaks & continues.
+ *
+ * Exprtrees, conditions, slices and calls to builtins whose operands always
+ * have the types they need are annotated, so that the tree-walker can eval
+ * them without checking. Operations that can't run with the types they're
+ * given, e.g, a string in an exprtree or a comparison of a string with a
+ * number, fail the load. Deferred calls are left alone, their args are only
+ * resolved once the function returns. The pass stops at anything the scopes
+ * can't follow, and then leaves the whole body unannotated.
+ */
+
+#include "types.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "args.h"
+#include "ast.h"
+#include "builtin.h"
+#include "compile.h"
+#include "node.h"
+#include "token.h"
+#include "util.h"
+
+typedef struct infer {
+  fsig_t *sig;
+  const symtbl_t *symtbl;
+  scope_t scope;
+  /* Type of every slot, unknown if it doesn't always have the same one. */
+  unsigned int *types;
+  unsigned int cap;
+  /**
+   * Types the slots declared before the innermost for have at its breaks and
+   * continues, merged. jumped is set once there's one.
+   */
+  unsigned int *jumps, n_jumps;
+  int jumped;
+  /* Set once an operation that can't run is found. */
+  int failed, lno;
+  /* Set while the types of a for settle, mismatches aren't reported then. */
+  int quiet;
+} infer_t;
+
+/* Type of the results of builtins, those missing here return nothing. */
+static const struct {
+  const char *func;
+  unsigned int type;
+} results[] = {{"cmp", integer},
+               {"len", integer},
+               {"idx", integer},
+               {"rev", string},
+               {"type", integer}};
+
+static int is_known(const unsigned int type) {
+  return type == string || is_num(type);
+}
+
+static const char *type_name(const unsigned int type) {
+  return type == string ? "str" : type == integer ? "int" : "float";
+}
+
+static void mismatch(infer_t *t, const char *what) {
+  if (t->failed || t->quiet) return;
+
+  fprintf(stderr, "types.c: %s L[%d]\n", what, t->lno);
+  load_lno = t->lno;
+  t->failed = 1;
+}
+
+/* Makes room for every slot declared so far, new slots have no type. */
+static void track(infer_t *t) {
+  while (t->cap < t->scope.n_slots) {
+    const unsigned int n = t->cap;
+    t->types = grow(t->types, &t->cap, n, sizeof(unsigned int));
+    for (unsigned int i = n; i < t->cap; i++) t->types[i] = unknown;
+  }
+}
+
+static void set_type(infer_t *t, const int slot, const unsigned int type) {
+  track(t);
+  t->types[slot] = is_known(type) ? type : unknown;
+}
+
+static unsigned int sym_type(const infer_t *t, const char *sym) {
+  value_t val;
+  const cvar_t *v = resolve_sym(&t->scope, sym);
+  if (v) return (unsigned int)v->slot < t->cap ? t->types[v->slot] : unknown;
+
+  return global_const(t->symtbl, sym, &val) ? val.type : unknown;
+}
+
+static unsigned int token_type(const infer_t *t, const token_t *tk) {
+  return tk->type == identifier ? sym_type(t, tk->tk) : tk->type;
+}
+
+static int is_bitwise(const char *op) {
+  return op[0] == '~' || op[0] == '&' || op[0] == '|' || op[0] == '^' ||
+         op[0] == '<' || op[0] == '>';
+}
+
+static unsigned int infer_tree(infer_t *t, binary_node_t *node) {
+  if (!node->lhs && !node->rhs) {
+    const token_t *tk = node->val;
+    const unsigned int type = token_type(t, tk);
+    if (type == string) {
+      char buf[128];
+      snprintf(buf, sizeof buf, "string [%.64s] in exprtree",
+               tk->type == identifier ? (char *)tk->tk : "literal");
+      mismatch(t, buf);
+    }
+
+    node->type = is_num(type) ? type : unknown;
+    return node->type;
+  }
+
+  const char *op = node->val->tk;
+  const int unary = op[0] == 'u' || op[0] == '~';
+  const unsigned int l = infer_tree(t, node->lhs);
+  const unsigned int r = infer_tree(t, node->rhs);
+
+  if (r == unknown || (!unary && l == unknown)) {
+    node->type = unknown;
+  } else if (r == integer && (unary || l == integer)) {
+    node->type = integer;
+  } else if (is_bitwise(op)) {
+    char buf[64];
+    snprintf(buf, sizeof buf, "operator [%s] requires integer operands", op);
+    mismatch(t, buf);
+    node->type = unknown;
+  } else {
+    node->type = numeric;
+  }
+
+  return node->type;
+}
+
+static unsigned int infer_call(infer_t *t, func_node_t *fnode) {
+  fnode->typed = 0;
+  if (get_fsig(t->symtbl, fnode->func)) return unknown;
+
+  const builtin_t *builtin = get_builtin(fnode->func);
+  if (!builtin) return unknown;
+
+  /* Calls with the wrong number of args are left to fail where they are. */
+  const unsigned int argc = fnode->args->size;
+  if (builtin->n_args == (int)argc) {
+    int typed = 1;
+    unsigned int j = 0;
+    for (node_t *arg = fnode->args->head; arg; arg = arg->next, j++) {
+      const int req = builtin->argtypes[j];
+      const unsigned int type = token_type(t, arg->data);
+      if (req == -1) continue;
+
+      if (!is_known(type)) {
+        typed = 0;
+      } else if (!type_fits(type, req)) {
+        char buf[128];
+        snprintf(buf, sizeof buf, "%s() arg %u must be a %s, not %s",
+                 fnode->func, j + 1, type_name(req), type_name(type));
+        mismatch(t, buf);
+        typed = 0;
+      }
+    }
+
+    fnode->typed = typed;
+  }
+
+  for (unsigned int i = 0; i < sizeof results / sizeof results[0]; i++)
+    if (!strcmp(fnode->func, results[i].func)) return results[i].type;
+
+  return unknown;
+}
+
+static unsigned int infer_operand(infer_t *t, void *buf,
+                                  const unsigned int type);
+
+static void infer_indx(infer_t *t, indx_node_t *ixnode) {
+  const unsigned int arg = token_type(t, ixnode->arg);
+  const unsigned int lb =
+      ixnode->beg ? infer_operand(t, ixnode->beg, ixnode->ltype) : integer;
+  const unsigned int ub =
+      ixnode->end ? infer_operand(t, ixnode->end, ixnode->rtype) : integer;
+
+  if (is_num(arg)) mismatch(t, "indexer cannot be applied to non-string");
+  if (lb == string || ub == string)
+    mismatch(t, "indexer bounds must be numeric");
+
+  ixnode->typed = arg == string && is_num(lb) && is_num(ub);
+}
+
+static unsigned int infer_operand(infer_t *t, void *buf,
+                                  const unsigned int type) {
+  switch (type) {
+    case identifier:
+      return sym_type(t, buf);
+
+    case exprtree:
+      return infer_tree(t, buf);
+
+    case fretval:
+      return infer_call(t, buf);
+
+    case indx:
+      infer_indx(t, buf);
+      return string;
+  }
+
+  return type;
+}
+
+static void infer_cond(infer_t *t, cnode_t *cnode) {
+  const unsigned int l = infer_operand(t, cnode->lhs, cnode->ltype);
+  const unsigned int r = infer_operand(t, cnode->rhs, cnode->rtype);
+
+  if (is_num(l) && is_num(r)) {
+    cnode->type = l == integer && r == integer ? integer : numeric;
+  } else if (l == string && r == string) {
+    cnode->type = string;
+  } else {
+    if (is_known(l) && is_known(r))
+      mismatch(t, "cannot compare a string with a number");
+    cnode->type = unknown;
+  }
+}
+
+static int infer_block(infer_t *t, list_t *nodes);
+
+static int infer_branch(infer_t *t, list_t *nodes) {
+  open_scope(&t->scope);
+  const int ret = infer_block(t, nodes);
+  close_scope(&t->scope);
+  return ret;
+}
+
+/* Sets ret if node never falls through to the next one. */
+static void infer_if(infer_t *t, ast_node_t *node, int *ret) {
+  infer_cond(t, node->ch);
+
+  /* Both branches start from the types here, and merge once they end. */
+  track(t);
+  const unsigned int n = t->scope.n_slots;
+  unsigned int types[n + 1], ltypes[n + 1];
+  memcpy(types, t->types, n * sizeof(unsigned int));
+
+  const int lret = infer_branch(t, node->lch);
+  memcpy(ltypes, t->types, n * sizeof(unsigned int));
+
+  memcpy(t->types, types, n * sizeof(unsigned int));
+  const int rret = infer_branch(t, node->rch);
+
+  *ret = lret && rret;
+  if (rret) {
+    memcpy(t->types, ltypes, n * sizeof(unsigned int));
+  } else if (!lret) {
+    for (unsigned int i = 0; i < n; i++)
+      if (t->types[i] != ltypes[i]) t->types[i] = unknown;
+  }
+}
+
+/* Merges the types at a break or continue into those of the others. */
+static void jump(infer_t *t) {
+  for (unsigned int i = 0; i < t->n_jumps; i++)
+    if (!t->jumped || t->jumps[i] != t->types[i])
+      t->jumps[i] = t->jumped ? unknown : t->types[i];
+
+  t->jumped = 1;
+}
+
+/**
+ * The condition & body see the types the slots have on entry merged with
+ * those they have at the end of the body and at its breaks & continues, until
+ * that no longer changes. Only then is it walked once more to report the
+ * mismatches, those that hold on every iteration, and the last walk leaves the
+ * annotations that do. The for is left with the same types, a break leaves it
+ * with what it would have had at the condition.
+ */
+static void infer_for(infer_t *t, ast_node_t *node) {
+  track(t);
+  const unsigned int n = t->scope.n_slots;
+  unsigned int types[n + 1], jumps[n + 1];
+
+  unsigned int *outer = t->jumps;
+  const unsigned int n_outer = t->n_jumps;
+  const int outer_jumped = t->jumped;
+  t->jumps = jumps;
+  t->n_jumps = n;
+
+  int settled = 0;
+  t->quiet++;
+  for (;;) {
+    memcpy(types, t->types, n * sizeof(unsigned int));
+    infer_cond(t, node->ch);
+
+    t->jumped = 0;
+    t->scope.loops++;
+    infer_branch(t, node->lch);
+    t->scope.loops--;
+    if (!t->scope.ok || t->failed) break;
+
+    int changed = 0;
+    for (unsigned int i = 0; i < n; i++) {
+      if (t->jumped && t->types[i] != jumps[i]) t->types[i] = unknown;
+      if (t->types[i] != types[i] && types[i] != unknown) changed = 1;
+      t->types[i] = t->types[i] == types[i] ? types[i] : unknown;
+    }
+
+    if (settled) break;
+    if (!changed) {
+      settled = 1;
+      t->quiet--;
+    }
+  }
+
+  if (!settled) t->quiet--;
+
+  t->jumps = outer;
+  t->n_jumps = n_outer;
+  t->jumped = outer_jumped;
+}
+
+/**
+ * A pfor's body runs on closures, so it's left unannotated. What it reduces
+ * into has no type after it, the reductions may mix ints & floats.
+ */
+static void forget(infer_t *t, const list_t *nodes) {
+  for (node_t *n = nodes->head; n; n = n->next) {
+    const ast_node_t *node = n->data;
+    const char *sym = node->type == vdecl ? ((decl_node_t *)node->ch)->lhs
+                      : node->type == post_inc || node->type == post_dec
+                          ? ((unary_node_t *)node->ch)->arg
+                          : NULL;
+    const cvar_t *v = sym ? resolve_sym(&t->scope, sym) : NULL;
+    if (v) set_type(t, v->slot, unknown);
+
+    forget(t, node->lch);
+    forget(t, node->rch);
+  }
+}
+
+static void infer_node(infer_t *t, ast_node_t *node, int *ret) {
+  void **bufs[2];
+  unsigned int *types[2];
+
+  switch (node->type) {
+    case vdecl: {
+      decl_node_t *dnode = node->ch;
+      const unsigned int type = infer_operand(t, dnode->rhs, dnode->rtype);
+
+      const cvar_t *v = assign_sym(&t->scope, dnode->lhs, dnode->is_const);
+      if (v) set_type(t, v->slot, type);
+      return;
+    }
+
+    case cin: {
+      const read_node_t *rnode = node->ch;
+      const cvar_t *v = assign_sym(&t->scope, rnode->arg, 0);
+      if (v) set_type(t, v->slot, string);
+      return;
+    }
+
+    case post_dec:
+    case post_inc: {
+      const unary_node_t *unode = node->ch;
+      const cvar_t *v = resolve_sym(&t->scope, unode->arg);
+      if (!v || v->is_const) {
+        t->scope.ok = 0;
+        return;
+      }
+
+      if (sym_type(t, unode->arg) == string)
+        mismatch(t, "unary cannot be used on non-numeric types");
+      return;
+    }
+
+    case fcall:
+      infer_call(t, node->ch);
+      return;
+
+    case cond:
+      infer_if(t, node, ret);
+      return;
+
+    case floop:
+      infer_for(t, node);
+      return;
+
+    case pfloop:
+      forget(t, node->lch);
+      break;
+
+    case rettype:
+      *ret = 1;
+      break;
+
+    case fbreak:
+    case fcontinue:
+      jump(t);
+      *ret = 1;
+      return;
+  }
+
+  const unsigned int n = node_operands(node, bufs, types);
+  for (unsigned int i = 0; i < n; i++) infer_operand(t, *bufs[i], *types[i]);
+}
+
+/**
+ * Returns 1 if the block never falls through its end, i.e, it returns, breaks
+ * or continues.
+ */
+static int infer_block(infer_t *t, list_t *nodes) {
+  for (node_t *n = nodes->head; n && t->scope.ok && !t->failed; n = n->next) {
+    ast_node_t *node = n->data;
+    int ret = 0;
+
+    t->lno = node->lno;
+    infer_node(t, node, &ret);
+    if (ret) return 1;
+  }
+
+  return 0;
+}
+
+static void clear_operand(void *buf, const unsigned int type) {
+  if (type == exprtree) {
+    binary_node_t *node = buf;
+    node->type = unknown;
+    if (node->lhs) clear_operand(node->lhs, exprtree);
+    if (node->rhs) clear_operand(node->rhs, exprtree);
+  } else if (type == fretval) {
+    ((func_node_t *)buf)->typed = 0;
+  } else if (type == indx) {
+    indx_node_t *ixnode = buf;
+    ixnode->typed = 0;
+    if (ixnode->beg) clear_operand(ixnode->beg, ixnode->ltype);
+    if (ixnode->end) clear_operand(ixnode->end, ixnode->rtype);
+  }
+}
+
+/* Takes back what a walk that didn't get through the body annotated. */
+static void clear_block(const list_t *nodes) {
+  for (node_t *n = nodes->head; n; n = n->next) {
+    ast_node_t *node = n->data;
+    void **bufs[2];
+    unsigned int *types[2];
+
+    const unsigned int count = node_operands(node, bufs, types);
+    for (unsigned int i = 0; i < count; i++) clear_operand(*bufs[i], *types[i]);
+
+    if (node->type == fcall) ((func_node_t *)node->ch)->typed = 0;
+    if (node->type == cond || node->type == floop) {
+      ((cnode_t *)node->ch)->type = unknown;
+      clear_block(node->lch);
+      clear_block(node->rch);
+    }
+  }
+}
+
+int infer_types(fsig_t *sig, const symtbl_t *symtbl) {
+  infer_t t;
+  memset(&t, 0, sizeof t);
+  t.sig = sig;
+  t.symtbl = symtbl;
+
+  list_t *body = ((ast_node_t *)sig->node)->lch;
+  init_scope(&t.scope, sig, symtbl);
+  if (!t.scope.ok) return 1;
+
+  track(&t);
+  infer_block(&t, body);
+  if (t.failed) return 0;
+
+  if (!t.scope.ok) clear_block(body);
+  return 1;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "symtbl.h"
+
+/**
+ * Infers the types of the operands in the body of sig, annotates exprtrees,
+ * conditions, slices and calls to builtins with them (see node.h) and fails on
+ * an operation that can never run with the types it's given. Called once the
+ * body is prepared, before it's linked.
+ */
+int infer_types(fsig_t *sig, const symtbl_t *symtbl);
@@ -8,6 +8,7 @@ static node_t *allocs = NULL;
 static node_t *avail = NULL;
 static unsigned int total_allocs = 0;
 static unsigned long total_mem_alloc = 0;
+static int quiet = 0;
 
 /**
  * Because Cherry uses malloc() extensively in different parts of the codebase,
@@ -60,6 +61,12 @@ void *alloc(const unsigned long size) {
   return ptr;
 }
 
+/* Number of live heap allocs made through alloc(). */
+unsigned int alloc_count(void) { return total_allocs; }
+
+/* Keeps cleanup() off stdout, when stdout carries something else. */
+void quiet_cleanup(void) { quiet = 1; }
+
 void cleanup(void) {
   node_t *ptr = allocs;
 
@@ -82,8 +89,9 @@ void cleanup(void) {
   if (total_allocs != 0)
     fprintf(stderr, "util.c: total_allocs != 0 [%d]\n", total_allocs);
 
-  printf("util.c: clearing heap, total mem alloc'd for runtime: %ld bytes\n",
-         total_mem_alloc);
+  if (!quiet)
+    printf("util.c: clearing heap, total mem alloc'd for runtime: %ld bytes\n",
+           total_mem_alloc);
 
   ptr = avail;
   while (ptr) {
@@ -3,5 +3,7 @@
 #include "list.h"
 
 void *alloc(const unsigned long size);
+unsigned int alloc_count(void);
 void cleanup(void);
+void quiet_cleanup(void);
 void mark_free(const void *fptr);
\ No newline at end of file
@@ -0,0 +1,40 @@
+#include "value.h"
+
+#include <stddef.h>
+
+value_t to_value(const token_t *tk) {
+  value_t val;
+  val.type = tk->type;
+
+  if (tk->type == integer)
+    val.as.i = *(long long *)tk->tk;
+  else if (tk->type == numeric)
+    val.as.d = *(double *)tk->tk;
+  else
+    val.as.p = tk->tk;
+
+  return val;
+}
+
+/**
+ * Returns a token that views val, so that it can be handed to code that works
+ * on tokens (builtins, compare(), print). The token is only valid for as long
+ * as val is.
+ */
+token_t value_token(value_t *val) {
+  token_t tk;
+  tk.type = val->type;
+
+  if (val->type == integer)
+    tk.tk = &val->as.i;
+  else if (val->type == numeric)
+    tk.tk = &val->as.d;
+  else
+    tk.tk = val->as.p;
+
+  return tk;
+}
+
+double value_double(const value_t *val) {
+  return val->type == integer ? (double)val->as.i : val->as.d;
+}
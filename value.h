@@ -0,0 +1,22 @@
+#pragma once
+
+#include "token.h"
+
+/**
+ * Unboxed value used by the evaluators. Numbers live inside the value itself,
+ * strings and containers are referenced through p exactly like token_t does.
+ */
+typedef struct value {
+  unsigned int type;
+  union {
+    long long i;
+    double d;
+    void *p;
+  } as;
+} value_t;
+
+value_t to_value(const token_t *tk);
+token_t value_token(value_t *val);
+
+/* Reads a numeric value as a double, promoting integers. */
+double value_double(const value_t *val);
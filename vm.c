@@ -0,0 +1,596 @@
+/**
+ * vm.c
+ * Stack based virtual machine that runs the bytecode produced by compile.c.
+ *
+ * Calls between functions on the VM don't recurse in C - every call pushes a
+ * vm_frame_t and the dispatch loop carries on with the callee. Functions that
+ * couldn't be compiled and builtins are called through the tree-walker.
+ */
+
+#include "vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "builtin.h"
+#include "compile.h"
+#include "expr.h"
+#include "jit.h"
+#include "memo.h"
+#include "util.h"
+#include "value.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define COMPUTED_GOTO 1
+#else
+#define COMPUTED_GOTO 0
+#endif
+
+typedef struct vm_frame {
+  const chunk_t *chunk;
+  const instr_t *pc;
+  /* Index of slot 0 in the stack & number of defers pending before the call. */
+  unsigned int base, defer_base;
+  unsigned char want, has_ret;
+  value_t ret;
+  /* Where the args were saved if the function is memoized (see memo.c). */
+  unsigned int memo;
+} vm_frame_t;
+
+/**
+ * The value stack is shared by all the frames - locals of a frame are followed
+ * by its operand stack, whose top becomes the args (slot 0..) of a callee.
+ * stack_top is where a nested vm_call() (VM -> tree-walker -> VM) starts.
+ */
+static value_t *stack = NULL;
+static unsigned int stack_cap = 0, stack_top = 0;
+
+static vm_frame_t *frames = NULL;
+static unsigned int n_frames = 0, frames_cap = 0;
+
+static const defer_site_t **defers = NULL;
+static unsigned int n_defers = 0, defers_cap = 0;
+
+/* Grows arr to hold at least need elements, the old block stays alloc'd. */
+static void *reserve(void *arr, unsigned int *cap, const unsigned int n,
+                     const unsigned int need, const unsigned long size) {
+  if (need <= *cap) return arr;
+
+  unsigned int ncap = *cap ? *cap * 2 : 1024;
+  while (ncap < need) ncap *= 2;
+
+  void *narr = alloc(ncap * size);
+  if (arr) memcpy(narr, arr, n * size);
+
+  *cap = ncap;
+  return narr;
+}
+
+static double num(const value_t *val) {
+  return val->type == integer ? (double)val->as.i : val->as.d;
+}
+
+static int take_result(symtbl_t *symtbl, const callsite_t *cs,
+                       const unsigned char want, value_t *res) {
+  if (!take_ret(symtbl, res) && want) {
+    fprintf(stderr, "vm.c: %s() did not return anything\n", cs->func);
+    return 0;
+  }
+
+  return 1;
+}
+
+int call_out(eval_t *eval, const callsite_t *cs, value_t *args,
+                    const unsigned char want, value_t *res) {
+  symtbl_t *symtbl = eval->tbl;
+  symtbl->has_ret = 0;
+
+  if (cs->sig) {
+    if (!eval_call(eval, cs->sig, args, cs->argc)) return 0;
+  } else {
+    token_t tks[cs->argc + 1];
+    const token_t *fargs[cs->argc + 1];
+    for (unsigned int i = 0; i < cs->argc; i++) {
+      tks[i] = value_token(&args[i]);
+      fargs[i] = &tks[i];
+    }
+
+    if (!call_builtin(cs->builtin, fargs, cs->argc, symtbl)) {
+      fprintf(stderr, "vm.c: could not call %s()\n", cs->func);
+      return 0;
+    }
+  }
+
+  return take_result(symtbl, cs, want, res);
+}
+
+/* Runs chunk with its args already at stack[base] until it returns. */
+static int run(eval_t *eval, const chunk_t *chunk, const unsigned int base,
+               value_t *res, unsigned char *has_res) {
+  const unsigned int entry = n_frames, saved_top = stack_top;
+  const unsigned int saved_defers = n_defers;
+
+  if (n_frames >= eval->max_depth) {
+    fprintf(stderr, "vm.c: stack depth exceeded at L[%d]\n", lno);
+    return 0;
+  }
+
+  frames = reserve(frames, &frames_cap, n_frames, n_frames + 1,
+                   sizeof(vm_frame_t));
+  vm_frame_t *f = &frames[n_frames++];
+  f->chunk = chunk;
+  f->base = base;
+  f->defer_base = n_defers;
+  f->want = 1;
+  f->has_ret = 0;
+  f->memo = chunk->sig->memo ? memo_enter(&stack[base], chunk->n_args) : 0;
+
+  const instr_t *pc = chunk->code, *ins = NULL;
+  value_t *bp = &stack[base];
+  value_t *sp = bp + chunk->n_slots;
+  const value_t *consts = chunk->consts;
+
+  /* Set up by op_call and op_leave before jumping to do_call. */
+  const callsite_t *cs = NULL;
+  unsigned char want = 0;
+
+#if COMPUTED_GOTO
+  static void *dispatch[op_count] = {
+      [op_const] = &&lbl_op_const, [op_load] = &&lbl_op_load,
+      [op_store] = &&lbl_op_store, [op_pop] = &&lbl_op_pop,
+      [op_add] = &&lbl_op_add,     [op_sub] = &&lbl_op_sub,
+      [op_mul] = &&lbl_op_mul,     [op_div] = &&lbl_op_div,
+      [op_mod] = &&lbl_op_mod,     [op_shl] = &&lbl_op_shl,
+      [op_shr] = &&lbl_op_shr,     [op_band] = &&lbl_op_band,
+      [op_bor] = &&lbl_op_bor,     [op_bxor] = &&lbl_op_bxor,
+      [op_neg] = &&lbl_op_neg,     [op_pos] = &&lbl_op_pos,
+      [op_bnot] = &&lbl_op_bnot,   [op_lt] = &&lbl_op_lt,
+      [op_le] = &&lbl_op_le,       [op_eq] = &&lbl_op_eq,
+      [op_ne] = &&lbl_op_ne,       [op_gt] = &&lbl_op_gt,
+      [op_ge] = &&lbl_op_ge,       [op_jmp] = &&lbl_op_jmp,
+      [op_jz] = &&lbl_op_jz,       [op_inc] = &&lbl_op_inc,
+      [op_dec] = &&lbl_op_dec,     [op_slice] = &&lbl_op_slice,
+      [op_print] = &&lbl_op_print, [op_read] = &&lbl_op_read,
+      [op_call] = &&lbl_op_call,   [op_tailcall] = &&lbl_op_tailcall,
+      [op_defer] = &&lbl_op_defer, [op_ret] = &&lbl_op_ret,
+      [op_leave] = &&lbl_op_leave};
+#define VM_CASE(op) lbl_##op
+#define DISPATCH()           \
+  do {                       \
+    ins = pc++;              \
+    goto *dispatch[ins->op]; \
+  } while (0)
+
+  DISPATCH();
+#else
+#define VM_CASE(op) case op
+#define DISPATCH() goto next
+
+next:
+  ins = pc++;
+  switch (ins->op) {
+#endif
+
+/* Integer fast path, everything else goes through eval_int/eval_double. */
+#define ARITH(opstr, intexpr)                                       \
+  do {                                                              \
+    value_t *r = --sp, *l = sp - 1;                                 \
+    if (l->type == integer && r->type == integer) {                 \
+      const long long a = l->as.i, b = r->as.i;                     \
+      l->as.i = (intexpr);                                          \
+    } else if (is_num(l->type) && is_num(r->type)) {                \
+      l->as.d = eval_double(num(l), num(r), opstr);                 \
+      l->type = numeric;                                            \
+    } else {                                                        \
+      goto nonnum;                                                  \
+    }                                                               \
+    DISPATCH();                                                     \
+  } while (0)
+
+/* eval_int() & eval_double() exit on these, the VM fails the call instead. */
+#define DIVIDE(opstr)                                       \
+  do {                                                      \
+    if (sp[-2].type == integer && sp[-1].type == integer && \
+        !sp[-1].as.i)                                       \
+      goto divzero;                                         \
+    ARITH(opstr, eval_int(a, b, opstr));                    \
+  } while (0)
+
+#define BITWISE(intexpr)                                            \
+  do {                                                              \
+    value_t *r = --sp, *l = sp - 1;                                 \
+    if (l->type == integer && r->type == integer) {                 \
+      const long long a = l->as.i, b = r->as.i;                     \
+      l->as.i = (intexpr);                                          \
+    } else if (is_num(l->type) && is_num(r->type)) {                \
+      goto intonly;                                                 \
+    } else {                                                        \
+      goto nonnum;                                                  \
+    }                                                               \
+    DISPATCH();                                                     \
+  } while (0)
+
+#define COMPARE(opstr, cop)                                   \
+  do {                                                        \
+    value_t *r = --sp, *l = sp - 1;                           \
+    int cres;                                                 \
+    if (l->type == integer && r->type == integer) {           \
+      cres = l->as.i cop r->as.i;                             \
+    } else if (is_num(l->type) && is_num(r->type)) {          \
+      cres = num(l) cop num(r);                               \
+    } else {                                                  \
+      token_t a = value_token(l), b = value_token(r);         \
+      if ((cres = compare(&a, &b, opstr)) < 0) goto cmpfail;  \
+    }                                                         \
+    l->type = integer;                                        \
+    l->as.i = cres;                                           \
+    DISPATCH();                                               \
+  } while (0)
+
+  VM_CASE(op_const) : *sp++ = consts[ins->a];
+  DISPATCH();
+
+  VM_CASE(op_load) : *sp++ = bp[ins->a];
+  DISPATCH();
+
+  VM_CASE(op_store) : bp[ins->a] = *--sp;
+  DISPATCH();
+
+  VM_CASE(op_pop) : sp--;
+  DISPATCH();
+
+  VM_CASE(op_add) : ARITH("+", (unsigned long long)a + b);
+  VM_CASE(op_sub) : ARITH("-", (unsigned long long)a - b);
+  VM_CASE(op_mul) : ARITH("*", (unsigned long long)a * b);
+  VM_CASE(op_div) : DIVIDE("/");
+  VM_CASE(op_mod) : DIVIDE("%");
+  VM_CASE(op_shl) : BITWISE(eval_int(a, b, "<<"));
+  VM_CASE(op_shr) : BITWISE(eval_int(a, b, ">>"));
+  VM_CASE(op_band) : BITWISE(a & b);
+  VM_CASE(op_bor) : BITWISE(a | b);
+  VM_CASE(op_bxor) : BITWISE(a ^ b);
+
+  VM_CASE(op_neg) : {
+    value_t *v = sp - 1;
+    if (v->type == integer)
+      v->as.i = -(unsigned long long)v->as.i;
+    else if (v->type == numeric)
+      v->as.d = -v->as.d;
+    else
+      goto nonnum;
+    DISPATCH();
+  }
+
+  VM_CASE(op_pos) : if (!is_num(sp[-1].type)) goto nonnum;
+  DISPATCH();
+
+  VM_CASE(op_bnot) : {
+    value_t *v = sp - 1;
+    if (v->type == integer)
+      v->as.i = ~v->as.i;
+    else if (v->type == numeric)
+      goto intonly;
+    else
+      goto nonnum;
+    DISPATCH();
+  }
+
+  VM_CASE(op_lt) : COMPARE("<", <);
+  VM_CASE(op_le) : COMPARE("<=", <=);
+  VM_CASE(op_eq) : COMPARE("==", ==);
+  VM_CASE(op_ne) : COMPARE("!=", !=);
+  VM_CASE(op_gt) : COMPARE(">", >);
+  VM_CASE(op_ge) : COMPARE(">=", >=);
+
+  VM_CASE(op_jmp) : pc = &f->chunk->code[ins->a];
+  DISPATCH();
+
+  VM_CASE(op_jz) : if (!(--sp)->as.i) pc = &f->chunk->code[ins->a];
+  DISPATCH();
+
+  VM_CASE(op_inc) : VM_CASE(op_dec) : {
+    value_t *v = &bp[ins->a];
+    const int step = ins->op == op_inc ? 1 : -1;
+
+    if (v->type == integer) {
+      v->as.i = (unsigned long long)v->as.i + step;
+    } else if (v->type == numeric) {
+      v->as.d += step;
+    } else {
+      fprintf(stderr, "vm.c: unary cannot be used on non-numeric types\n");
+      goto fail;
+    }
+    DISPATCH();
+  }
+
+  VM_CASE(op_slice) : {
+    value_t *ub = ins->b & slice_ub ? --sp : NULL;
+    value_t *lb = ins->b & slice_lb ? --sp : NULL;
+    value_t *arg = sp - 1;
+
+    token_t a = value_token(arg), l, u;
+    if (lb) l = value_token(lb);
+    if (ub) u = value_token(ub);
+
+    char *s =
+        slice(&a, lb ? &l : NULL, ub ? &u : NULL, ins->b & slice_schar);
+    if (!s) goto fail;
+
+    arg->type = string;
+    arg->as.p = s;
+    DISPATCH();
+  }
+
+  VM_CASE(op_print) : {
+    token_t tk = value_token(--sp);
+    print_token(&tk);
+    DISPATCH();
+  }
+
+  VM_CASE(op_read) : {
+    char *buf = alloc(512);
+    memset(buf, 0, 512);
+    scanf("%s", buf);
+
+    bp[ins->a].type = string;
+    bp[ins->a].as.p = buf;
+    DISPATCH();
+  }
+
+  VM_CASE(op_call) : cs = &f->chunk->calls[ins->a];
+  want = ins->b;
+  goto do_call;
+
+  /**
+   * The callee replaces the frame if it runs on the VM too, unless there are
+   * deferred calls pending - those must run after the callee returns. A bare
+   * call only does if the result of the frame is discarded anyway.
+   */
+  VM_CASE(op_tailcall) : cs = &f->chunk->calls[ins->a];
+  want = ins->b;
+  if (cs->sig && !cs->sig->no_chunk && !cs->sig->native &&
+      n_defers == f->defer_base && (want || !f->want)) {
+    if (!load_body(cs->sig, eval->tbl)) {
+      lno = load_lno;
+      goto unwind;
+    }
+    if (cs->sig->memo) goto do_call;
+
+    const chunk_t *callee = compile_func(cs->sig, eval->tbl);
+    if (!callee) goto do_call;
+
+    const unsigned int argi = (sp - cs->argc) - stack;
+    stack = reserve(stack, &stack_cap, sp - stack,
+                    f->base + callee->n_slots + callee->max_stack,
+                    sizeof(value_t));
+
+    bp = &stack[f->base];
+    memmove(bp, &stack[argi], cs->argc * sizeof(value_t));
+
+    f->chunk = callee;
+    pc = callee->code;
+    sp = bp + callee->n_slots;
+    consts = callee->consts;
+    DISPATCH();
+  }
+  goto do_call;
+
+  VM_CASE(op_defer) : defers = reserve(defers, &defers_cap, n_defers,
+                                       n_defers + 1, sizeof(defer_site_t *));
+  defers[n_defers++] = &f->chunk->defers[ins->a];
+  DISPATCH();
+
+  VM_CASE(op_ret) : if (ins->b) {
+    f->ret = *--sp;
+    f->has_ret = 1;
+  }
+  pc = &f->chunk->code[f->chunk->n_code - 1];
+  DISPATCH();
+
+  /**
+   * Runs the deferred calls one at a time (returning to op_leave after each),
+   * then pops the frame.
+   */
+  VM_CASE(op_leave) : if (n_defers > f->defer_base) {
+    const defer_site_t *ds = defers[--n_defers];
+    cs = &f->chunk->calls[ds->call];
+
+    for (unsigned int i = 0; i < cs->argc; i++) {
+      const int arg = ds->args[i];
+      *sp++ = arg >= 0 ? bp[arg] : consts[-arg - 1];
+    }
+
+    want = 0;
+    pc--;
+    goto do_call;
+  }
+  else {
+    value_t ret = f->ret;
+    const unsigned char has_ret = f->has_ret, fwant = f->want;
+
+    memo_t *memo = f->chunk->sig->memo;
+    if (memo)
+      memo_leave(memo, f->memo, f->chunk->n_args, has_ret ? &ret : NULL);
+
+    sp = &stack[f->base];
+    if (--n_frames == entry) {
+      *res = ret;
+      *has_res = has_ret;
+      stack_top = saved_top;
+      return 1;
+    }
+
+    f = &frames[n_frames - 1];
+    pc = f->pc;
+    bp = &stack[f->base];
+    consts = f->chunk->consts;
+
+    if (fwant) {
+      if (!has_ret) {
+        fprintf(stderr, "vm.c: %s() did not return anything\n",
+                frames[n_frames].chunk->sig->func);
+        /* The error is on the line of the call, ins is still in the callee. */
+        ins = pc - 1;
+        goto fail;
+      }
+
+      *sp++ = ret;
+    }
+    DISPATCH();
+  }
+
+#if !COMPUTED_GOTO
+    default:
+      goto fail;
+  }
+#endif
+
+do_call : {
+  value_t *args = sp - cs->argc;
+  fsig_t *sig = cs->sig;
+  const chunk_t *callee = NULL;
+
+  if (sig && !sig->no_chunk) {
+    if (!load_body(sig, eval->tbl)) {
+      lno = load_lno;
+      goto unwind;
+    }
+    callee = compile_func(sig, eval->tbl);
+  }
+
+  f->pc = pc;
+
+  /* A memoized call made before returns right away. */
+  if (callee && sig->memo) {
+    value_t ret;
+    if (memo_get(sig->memo, args, cs->argc, &ret)) {
+      sp = args;
+      if (want) *sp++ = ret;
+      DISPATCH();
+    }
+  }
+
+  /* Native code doesn't touch the stack. */
+  if (callee) {
+    const int res = jit_call(eval, sig, args, cs->argc);
+    if (!res) goto unwind;
+
+    if (res > 0) {
+      value_t ret;
+      if (!take_result(eval->tbl, cs, want, &ret)) goto fail;
+
+      sp = args;
+      if (want) *sp++ = ret;
+      DISPATCH();
+    }
+  }
+
+  if (!callee) {
+    value_t ret;
+    const unsigned int argi = args - stack;
+
+    stack_top = sp - stack;
+    if (!call_out(eval, cs, args, want, &ret)) goto fail;
+
+    /* The stack & frames may have been grown by a nested vm_call(). */
+    f = &frames[n_frames - 1];
+    bp = &stack[f->base];
+    sp = &stack[argi];
+    if (want) *sp++ = ret;
+    DISPATCH();
+  }
+
+  if (n_frames >= eval->max_depth) {
+    lno = f->chunk->lines[ins - f->chunk->code];
+    fprintf(stderr, "vm.c: stack depth exceeded at L[%d]\n", lno);
+    goto fail;
+  }
+
+  const unsigned int nbase = args - stack;
+  stack = reserve(stack, &stack_cap, sp - stack,
+                  nbase + callee->n_slots + callee->max_stack,
+                  sizeof(value_t));
+  frames = reserve(frames, &frames_cap, n_frames, n_frames + 1,
+                   sizeof(vm_frame_t));
+
+  f = &frames[n_frames++];
+  f->chunk = callee;
+  f->base = nbase;
+  f->defer_base = n_defers;
+  f->want = want;
+  f->has_ret = 0;
+  f->memo = sig->memo ? memo_enter(args, cs->argc) : 0;
+
+  pc = callee->code;
+  bp = &stack[nbase];
+  sp = bp + callee->n_slots;
+  consts = callee->consts;
+  DISPATCH();
+}
+
+nonnum:
+  fprintf(stderr, "vm.c: non-numeric in exprtree\n");
+  goto fail;
+
+cmpfail:
+  fprintf(stderr, "vm.c: could not eval condition\n");
+  goto fail;
+
+divzero:
+  fprintf(stderr, "vm.c: integer division by zero\n");
+  goto fail;
+
+intonly:
+  fprintf(stderr, "vm.c: operator requires integer operands\n");
+
+fail:
+  lno = f->chunk->lines[(ins ? ins : pc) - f->chunk->code];
+
+/* lno has been set already. */
+unwind:
+  n_frames = entry;
+  n_defers = saved_defers;
+  stack_top = saved_top;
+  return 0;
+}
+
+/**
+ * Runs sig on the VM if it can be compiled, with the args of fnode resolved in
+ * the caller's frame. Returns -1 if sig must run on the tree-walker instead.
+ */
+int vm_call(eval_t *eval, fsig_t *sig, const func_node_t *fnode) {
+  if (sig->no_chunk) return -1;
+  if (!load_body(sig, eval->tbl)) {
+    lno = load_lno;
+    return 0;
+  }
+
+  const chunk_t *chunk = compile_func(sig, eval->tbl);
+  if (!chunk) return -1;
+
+  /* Linking checked that fnode passes chunk->n_args, main is passed none. */
+  const unsigned int argc = fnode ? fnode->args->size : 0;
+
+  const unsigned int base = stack_top;
+  stack = reserve(stack, &stack_cap, stack_top,
+                  base + chunk->n_slots + chunk->max_stack, sizeof(value_t));
+
+  if (argc && !eval_args(eval, fnode, &stack[base])) return 0;
+
+  value_t res;
+  if (sig->memo && memo_get(sig->memo, &stack[base], argc, &res)) {
+    set_ret(eval->tbl, &res);
+    return 1;
+  }
+
+  const int jres = jit_call(eval, sig, &stack[base], argc);
+  if (jres >= 0) return jres;
+
+  unsigned char has_res = 0;
+  if (!run(eval, chunk, base, &res, &has_res)) return 0;
+
+  if (has_res) set_ret(eval->tbl, &res);
+  return 1;
+}
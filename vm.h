@@ -0,0 +1,16 @@
+#pragma once
+
+#include "compile.h"
+#include "eval.h"
+#include "node.h"
+#include "symtbl.h"
+#include "value.h"
+
+/**
+ * Calls func (a function that isn't compiled, or a builtin) with args through
+ * the tree-walker. If want is set, its result is stored in res.
+ */
+int call_out(eval_t *eval, const callsite_t *cs, value_t *args,
+             const unsigned char want, value_t *res);
+
+int vm_call(eval_t *eval, fsig_t *sig, const func_node_t *fnode);